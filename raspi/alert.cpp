@@ -13,30 +13,68 @@ std::string WeatherAlert::get_name() const {
     return name;
 }
 
+/**
+ * Gets alert start time
+ *
+ * @return alert start as unix time
+ */
+int64_t WeatherAlert::get_start() const {
+    return start;
+}
+
+/**
+ * Gets alert end time
+ *
+ * @return alert end as unix time
+ */
+int64_t WeatherAlert::get_end() const {
+    return end;
+}
+
 /**
  * Gets information about alert start/end (starts at ... / ends at ...)
  *
  * @return information about alert start/end
  */
 std::string WeatherAlert::get_time() const {
-    // Get current time
-    int64_t now = std::time(nullptr);
-    int today = localtime((time_t *) &now)->tm_yday;
+    return get_time(std::time(nullptr), *TimeFormatter::get_host());
+}
 
-    char datetime_buf[64];
+/**
+ * Gets information about alert start/end as seen at a given time, for frames rendered ahead of time
+ *
+ * @param [in] now time to describe alert relative to, as unix time
+ * @param [in] time_format formatter for the alert location's time zone
+ * @return information about alert start/end
+ */
+std::string WeatherAlert::get_time(const int64_t now, const TimeFormatter & time_format) const {
+    int64_t today = time_format.get_local(now).day_number;
+
+    // Show day of week if it isn't today
+    auto describe = [&](const std::string & prefix, const int64_t timestamp) {
+        std::string description = prefix + " at ";
+        if (time_format.get_local(timestamp).day_number != today) {
+            description += time_format.format_weekday(timestamp) + " ";
+        }
+        return description + time_format.format_time(timestamp);
+    };
 
     // Compare to alert start/end time
     if (now < start) {
-        tm *start_tm = localtime((time_t *) &start);
-        strftime(datetime_buf, 64, today == start_tm->tm_yday ? "Starts at %H:%M" : "Starts at %a %H:%M", start_tm);
-        return std::string(datetime_buf);
+        return describe("Starts", start);
     } else if (now < end) {
-        tm *end_tm = localtime((time_t *) &end);
-        strftime(datetime_buf, 64, today == end_tm->tm_yday ? "Ends at %H:%M" : "Ends at %a %H:%M", end_tm);
-        return std::string(datetime_buf);
+        return describe("Ends", end);
     } else {
-        tm *end_tm = localtime((time_t *) &end);
-        strftime(datetime_buf, 64, today == end_tm->tm_yday ? "Ended at %H:%M" : "Ended at %a %H:%M", end_tm);
         return std::string();
     }
 }
+
+/**
+ * Checks if alert has ended
+ *
+ * @param [in] now time to check against, as unix time
+ * @return true if alert is over by the given time
+ */
+bool WeatherAlert::is_expired(const int64_t now) const {
+    return now >= end;
+}
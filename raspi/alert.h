@@ -3,11 +3,17 @@
 
 #include <string>
 
+#include "timeformat.h"
+
 class WeatherAlert {
 public:
     explicit WeatherAlert(std::string name, int64_t start, int64_t end);
     std::string get_name() const;               // Getter method for name
+    int64_t get_start() const;                  // Getter method for start
+    int64_t get_end() const;                    // Getter method for end
     std::string get_time() const;               // Gets time description
+    std::string get_time(int64_t now, const TimeFormatter & time_format) const;  // Gets time description as seen at a given time
+    bool is_expired(int64_t now) const;         // Checks if alert has ended at a given time
 private:
     std::string name;                           // Name of alert
     int64_t start;                              // Units: Unix time
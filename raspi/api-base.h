@@ -9,9 +9,28 @@ class API {
 public:
     virtual CurrentWeather get_current() = 0;
     virtual Precipitation get_precipitation() = 0;
+    virtual std::vector<MinutelyPrecipitation> get_minutely() = 0;
     virtual std::vector<HourlyWeather> get_hourly(int hours) = 0;
     virtual std::vector<DailyWeather> get_daily(int days) = 0;
     virtual std::vector<WeatherAlert> get_alerts() = 0;
+    virtual std::string get_timezone() = 0;
+    virtual int64_t get_timezone_offset() = 0;
+    virtual double get_lat() = 0;
+    virtual double get_lon() = 0;
+    virtual std::vector<HourlyAirQuality> get_airquality_forecast(int hours) = 0;
+
+    /**
+     * Gets everything needed to render a frame
+     *
+     * @param [in] hours number of hours to get
+     * @param [in] days number of days to get
+     * @return Forecast struct with all extracted data
+     */
+    Forecast get_forecast(const int hours, const int days) {
+        return Forecast{get_current(), get_precipitation(), get_hourly(hours), get_daily(days), get_alerts(),
+                        get_timezone(), get_timezone_offset(), get_minutely(), get_lat(), get_lon(),
+                        get_airquality_forecast(hours)};
+    }
 };
 
 #endif
\ No newline at end of file
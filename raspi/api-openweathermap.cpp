@@ -1,92 +1,111 @@
 #include <sstream>
 #include <algorithm>
 
-#include <curl/curl.h>
-
 #include "api-openweathermap.h"
+#include "flightrecorder.h"
 
 /**
- * Writes data from curl's response to a string
+ * Gets the address of the One Call forecast for a location
  *
- * @param [in] contents data from curl
- * @param [in] size size of each element (always 1)
- * @param [in] nmemb number of elements/characters
- * @param [in,out] s string to save data to
- * @return number of elements handled correctly (returns 0 if error)
+ * @param [in] lat Latitude of location
+ * @param [in] lon Longitude of location
+ * @param [in] appid key to use for the API call
+ * @param [in] minutely include the next hour's precipitation by the minute
+ * @return url to fetch
  */
-size_t OpenWeatherMap::curl_callback(void *contents, size_t size, size_t nmemb, std::string *s) {
-    size_t newLength = size*nmemb;
-    try {
-        s->append((char *) contents, nmemb);
-    } catch (std::bad_alloc &e) {
-        return 0;
-    } catch (std::length_error &e) {
-        return 0;
-    }
-    return newLength;
+std::string OpenWeatherMap::get_onecall_url(const double lat, const double lon, const std::string & appid,
+                                            const bool minutely) {
+    std::stringstream onecall_urlstream = std::stringstream();
+    onecall_urlstream << "https://api.openweathermap.org/data/3.0/onecall"
+                         "?lat=" << lat << "&lon=" << lon << (minutely ? "" : "&exclude=minutely")
+                      << "&units=metric&appid=" << appid;
+    return onecall_urlstream.str();
 }
 
-
-
 /**
- * Intializes OpenWeatherMap object and gets data from server
+ * Gets the address of the current air pollution, or its hourly forecast, for a location
  *
  * @param [in] lat Latitude of location
  * @param [in] lon Longitude of location
  * @param [in] appid key to use for the API call
+ * @param [in] forecast get the forecast for the coming days instead of current air pollution
+ * @return url to fetch
  */
-OpenWeatherMap::OpenWeatherMap(const double lat, const double lon, const std::string & appid){
-    // Initialize variables
-    std::stringstream onecall_urlstream = std::stringstream();
-    onecall_urlstream << "https://api.openweathermap.org/data/3.0/onecall"
-                         "?lat=" << lat << "&lon=" << lon << "&exclude=minutely&units=metric&appid=" << appid;
-    std::string response_onecall_str;
+std::string OpenWeatherMap::get_airpollution_url(const double lat, const double lon, const std::string & appid,
+                                                 const bool forecast) {
+    std::stringstream airpollution_urlstream = std::stringstream();
+    airpollution_urlstream << "http://api.openweathermap.org/data/2.5/air_pollution" << (forecast ? "/forecast" : "")
+                           << "?lat=" << lat << "&lon=" << lon << "&appid=" << appid;
+    return airpollution_urlstream.str();
+}
 
-    // Initialize curl
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        throw std::runtime_error("Unable to initialize curl");
+/**
+ * Intializes OpenWeatherMap object from responses fetched from the server
+ *
+ * @param [in] onecall body of the One Call response
+ * @param [in] airpollution body of the air pollution response
+ * @param [in] airpollution_forecast body of the air pollution forecast response (empty if not fetched)
+ */
+OpenWeatherMap::OpenWeatherMap(const std::string & onecall, const std::string & airpollution,
+                               const std::string & airpollution_forecast) {
+    // Parse string responses as JSON and save
+    response_onecall = ArenaJson::parse(onecall);
+    response_airpollution = ArenaJson::parse(airpollution);
+
+    // The forecast is only for the trend strip, so a bad one is dropped rather than failing the location
+    if (!airpollution_forecast.empty()) {
+        try {
+            response_airpollution_forecast = ArenaJson::parse(airpollution_forecast);
+        } catch (ArenaJson::exception &e) {
+            record_event(FlightEventType::anomaly, 0, "air pollution forecast unreadable, dropped");
+        }
     }
+}
 
-    // Setup curl options
-    curl_easy_setopt(curl, CURLOPT_URL, onecall_urlstream.str().c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, OpenWeatherMap::curl_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_onecall_str);
-
-    // Perform curl operation and clean up
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        curl_easy_cleanup(curl);
-        throw std::runtime_error("Unable to get weather data");
+/**
+ * Works out the air quality of each entry of an air pollution list
+ * Concentrations of each pollutant are gathered into their own array, so severities are worked out for the whole
+ * series one pollutant at a time
+ *
+ * @param [in] list "list" of an air pollution response
+ * @param [in] count number of entries to use, from the start
+ * @return air quality of each entry
+ */
+std::vector<HourlyAirQuality> OpenWeatherMap::get_airquality_series(const ArenaJson & list, const size_t count) {
+    static const char *components[] = {"no2", "pm10", "o3", "pm2_5"};
+    const size_t pollutants = (size_t) Pollutant::count;
+
+    // Concentrations, then severities, of each pollutant in turn
+    std::vector<double> concentrations(pollutants * count);
+    std::vector<double> severities(pollutants * count);
+    std::vector<HourlyAirQuality> series(count);
+    for (size_t i = 0; i < count; i++) {
+        const ArenaJson & entry = list.at(i);
+        int aq_index = entry.at("main").at("aqi");
+        if (aq_index < 1 || aq_index > 5) {
+            record_event(FlightEventType::anomaly, aq_index, "aqi out of range, clamped");
+        }
+        series[i] = HourlyAirQuality{entry.value("dt", (int64_t) 0), std::clamp(aq_index, 1, 5), 0, Pollutant::no2};
+        for (size_t pollutant = 0; pollutant < pollutants; pollutant++) {
+            concentrations[pollutant * count + i] = entry.at("components").value(components[pollutant], 0.0);
+        }
     }
-    curl_easy_cleanup(curl);
-
-    // Parse string response as JSON and save
-    response_onecall = nlohmann::json::parse(response_onecall_str);
-
-    // Repeat to get air quality data
-    std::stringstream airpollution_urlstream = std::stringstream();
-    airpollution_urlstream << "http://api.openweathermap.org/data/2.5/air_pollution"
-                              "?lat=" << lat << "&lon=" << lon << "&appid=" << appid;
-    std::string response_airpollution_str;
-
-    curl = curl_easy_init();
-    if (!curl) {
-        throw std::runtime_error("Unable to initialize curl");
+    for (size_t pollutant = 0; pollutant < pollutants; pollutant++) {
+        get_caqi_severities((Pollutant) pollutant, concentrations.data() + pollutant * count,
+                            severities.data() + pollutant * count, count);
     }
 
-    curl_easy_setopt(curl, CURLOPT_URL, airpollution_urlstream.str().c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, OpenWeatherMap::curl_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_airpollution_str);
-
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        curl_easy_cleanup(curl);
-        throw std::runtime_error("Unable to get weather data");
+    // Most severe pollutant at each time
+    for (size_t pollutant = 0; pollutant < pollutants; pollutant++) {
+        const double *severity = severities.data() + pollutant * count;
+        for (size_t i = 0; i < count; i++) {
+            if (pollutant == 0 || severity[i] > series[i].severity) {
+                series[i].severity = severity[i];
+                series[i].pollutant = (Pollutant) pollutant;
+            }
+        }
     }
-    curl_easy_cleanup(curl);
-
-    response_airpollution = nlohmann::json::parse(response_airpollution_str);
+    return series;
 }
 
 /**
@@ -97,70 +116,35 @@ OpenWeatherMap::OpenWeatherMap(const double lat, const double lon, const std::st
  * @return AQI object
  */
 AQI OpenWeatherMap::get_airquality() {
-    // Get number and category description
-    int aq_index = response_airpollution["list"][0]["main"]["aqi"];
+    HourlyAirQuality now = get_airquality_series(response_airpollution.at("list"), 1)[0];
     std::string aq_categories[] = {"Good", "Fair", "Moderate", "Poor", "Low"};
-    if (aq_index > 5) {
-        aq_index = 5;
-    }
-    if (aq_index < 1) {
-        aq_index = 1;
-    }
-    std::string aq_category = aq_categories[aq_index - 1];
+    std::string aq_category = aq_categories[now.aqi - 1];
 
-    // If air quality is good, don't bother with calculating pollutant levels
-    if (aq_index == 1) {
-        return AQI(aq_index, aq_category);
+    // If air quality is good, there's no pollutant worth showing
+    if (now.aqi == 1) {
+        return AQI(now.aqi, aq_category);
     }
+    return AQI(now.aqi, aq_category, get_pollutant_name(now.pollutant));
+}
 
-    // Get pollutants
-    std::string pollutants[] = {"no2", "pm10", "o3", "pm2.5"};
-
-    // Get pollutant concentrations
-    double no2 = response_airpollution["list"][0]["components"]["no2"];
-    double pm10 = response_airpollution["list"][0]["components"]["pm10"];
-    double o3 = response_airpollution["list"][0]["components"]["o3"];
-    double pm25 = response_airpollution["list"][0]["components"]["pm2_5"];
-    double concentrations[4] = {no2, pm10, o3, pm25};
-
-    // Use CAQI scales
-    double no2_cutoffs[5] = {0, 50, 100, 200, 400};
-    double pm10_cutoffs[5] = {0, 25, 50, 90, 180};
-    double o3_cutoffs[5] = {0, 60, 120, 180, 240};
-    double pm25_cutoffs[5] = {0, 15, 30, 55, 110};
-    double *cutoffs[4] = {no2_cutoffs, pm10_cutoffs, o3_cutoffs, pm25_cutoffs};
-
-    // Calculate most severe pollutant
-    double severity[4] = {0, 0, 0, 0};
-    for (int i = 0; i < 4; i++) {
-        double concentration = concentrations[i];
-
-        // If concentration falls within range
-        for (int index = 1; index < 5; index++) {
-            if (concentration <= cutoffs[i][index]) {
-                severity[i] = index + (concentration - cutoffs[i][index]) / (cutoffs[i][index] - cutoffs[i][index - 1]);
-                break;
-            }
-        }
-
-        // If concentration is beyond range, extrapolate
-        if (concentration > cutoffs[i][4]) {
-            severity[i] = concentration / cutoffs[i][4] * 5;
-        }
+/**
+ * Gets the air quality forecast for the coming hours
+ *
+ * @param [in] hours most hours to get, from the current one
+ * @return air quality of each hour, or none if the forecast wasn't fetched or can't be read
+ */
+std::vector<HourlyAirQuality> OpenWeatherMap::get_airquality_forecast(const int hours) {
+    const ArenaJson & response = response_airpollution_forecast;
+    if (!response.is_object() || !response.contains("list")) {
+        return {};
     }
-
-    // Find maximum
-    int max_i = 0;
-    double max_severity = severity[0];
-    for (int i = 1; i < 4; i++) {
-        if (severity[i] > max_severity) {
-            max_i = i;
-            max_severity = severity[i];
-        }
+    try {
+        const ArenaJson & list = response.at("list");
+        return get_airquality_series(list, std::min(list.size(), (size_t) std::max(hours, 0)));
+    } catch (ArenaJson::exception &e) {
+        record_event(FlightEventType::anomaly, 0, "air pollution forecast unreadable, dropped");
+        return {};
     }
-
-    // Return AQI object
-    return AQI(aq_index, aq_category, pollutants[max_i]);
 }
 
 /**
@@ -200,6 +184,22 @@ Precipitation OpenWeatherMap::get_precipitation() {
     return Precipitation{hour, today};
 }
 
+/**
+ * Gets precipitation for each minute of the next hour from response
+ *
+ * @returns vector of MinutelyPrecipitation structs from response, empty if minutely data wasn't requested
+ */
+std::vector<MinutelyPrecipitation> OpenWeatherMap::get_minutely() {
+    std::vector<MinutelyPrecipitation> minutely;
+    if (!response_onecall.contains("minutely")) {
+        return minutely;
+    }
+    for (const ArenaJson & minute : response_onecall["minutely"]) {
+        minutely.push_back(MinutelyPrecipitation{minute["dt"], minute["precipitation"]});
+    }
+    return minutely;
+}
+
 /**
  * Gets hourly weather data from response
  * Check size of returned vector for how many hours were extracted successfully, might not be the same as input parameter
@@ -210,6 +210,9 @@ Precipitation OpenWeatherMap::get_precipitation() {
 std::vector<HourlyWeather> OpenWeatherMap::get_hourly(const int hours) {
     // Determine maximum number of hours available in response
     int extractable_hours = std::min(hours, (int) response_onecall["hourly"].size());
+    if (extractable_hours < hours) {
+        record_event(FlightEventType::anomaly, extractable_hours, "fewer hourly entries than requested");
+    }
 
     // Handle zero/negative number of hours
     if (extractable_hours <= 0) {
@@ -223,6 +226,11 @@ std::vector<HourlyWeather> OpenWeatherMap::get_hourly(const int hours) {
         hourly[i].temp = response_onecall["hourly"][i]["temp"];
         hourly[i].pop = response_onecall["hourly"][i]["pop"];
         hourly[i].icon = response_onecall["hourly"][i]["weather"][0]["icon"];
+        hourly[i].feels_like = response_onecall["hourly"][i]["feels_like"];
+        hourly[i].weather = response_onecall["hourly"][i]["weather"][0]["description"];
+        hourly[i].wind_speed = response_onecall["hourly"][i]["wind_speed"];
+        hourly[i].uvi = response_onecall["hourly"][i]["uvi"];
+        hourly[i].humidity = (double) response_onecall["hourly"][i]["humidity"] / 100;
     }
 
     return hourly;
@@ -238,6 +246,9 @@ std::vector<HourlyWeather> OpenWeatherMap::get_hourly(const int hours) {
 std::vector<DailyWeather> OpenWeatherMap::get_daily(const int days) {
     // Determine maximum number of hours available in response
     int extractable_days = std::min(days, (int) response_onecall["daily"].size());
+    if (extractable_days < days) {
+        record_event(FlightEventType::anomaly, extractable_days, "fewer daily entries than requested");
+    }
 
     // Handle zero/negative number of hours
     if (extractable_days <= 0) {
@@ -251,6 +262,7 @@ std::vector<DailyWeather> OpenWeatherMap::get_daily(const int days) {
         daily[i].weather = response_onecall["daily"][i]["weather"][0]["description"];
         daily[i].icon = response_onecall["daily"][i]["weather"][0]["icon"];
         daily[i].hi = response_onecall["daily"][i]["temp"]["max"];
+        daily[i].pop = response_onecall["daily"][i]["pop"];
 
         // usually this would be the lowest temp between today and tomorrow
         // since this usually happens in the early hours of the next day, just use the next day's min temperature
@@ -258,6 +270,7 @@ std::vector<DailyWeather> OpenWeatherMap::get_daily(const int days) {
             daily[i].lo = response_onecall["daily"][i+1]["temp"]["min"];
         } else {
             daily[i].lo = NAN;
+            record_event(FlightEventType::anomaly, i, "daily lo is NaN, no next day's min");
         }
     }
 
@@ -290,3 +303,40 @@ std::vector<WeatherAlert> OpenWeatherMap::get_alerts() {
 
     return alerts;
 }
+
+
+/**
+ * Gets location's time zone name from response
+ *
+ * @returns IANA time zone name
+ */
+std::string OpenWeatherMap::get_timezone() {
+    return response_onecall["timezone"];
+}
+
+/**
+ * Gets location's current offset from UTC from response
+ *
+ * @returns offset in seconds east of UTC
+ */
+int64_t OpenWeatherMap::get_timezone_offset() {
+    return response_onecall["timezone_offset"];
+}
+
+/**
+ * Gets latitude of the location the response is for
+ *
+ * @returns latitude in degrees
+ */
+double OpenWeatherMap::get_lat() {
+    return response_onecall["lat"];
+}
+
+/**
+ * Gets longitude of the location the response is for
+ *
+ * @returns longitude in degrees east
+ */
+double OpenWeatherMap::get_lon() {
+    return response_onecall["lon"];
+}
@@ -4,20 +4,36 @@
 #include <nlohmann/json.hpp>
 
 #include "api-base.h"
+#include "arena.h"
+
+// JSON whose objects and arrays are allocated from the active arena, if there is one
+typedef nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t, std::uint64_t, double,
+                             ArenaAllocator> ArenaJson;
 
 class OpenWeatherMap : API {
 public:
-    explicit OpenWeatherMap(double lat, double lon, const std::string & appid);
+    OpenWeatherMap(const std::string & onecall, const std::string & airpollution,
+                   const std::string & airpollution_forecast);
     CurrentWeather get_current() override;
     Precipitation get_precipitation() override;
+    std::vector<MinutelyPrecipitation> get_minutely() override;
     std::vector<HourlyWeather> get_hourly(int hours) override;
     std::vector<DailyWeather> get_daily(int days) override;
     std::vector<WeatherAlert> get_alerts() override;
+    std::string get_timezone() override;
+    int64_t get_timezone_offset() override;
+    double get_lat() override;
+    double get_lon() override;
+    std::vector<HourlyAirQuality> get_airquality_forecast(int hours) override;
+    using API::get_forecast;
+    static std::string get_onecall_url(double lat, double lon, const std::string & appid, bool minutely);
+    static std::string get_airpollution_url(double lat, double lon, const std::string & appid, bool forecast);
 private:
-    nlohmann::json response_onecall;
-    nlohmann::json response_airpollution;
-    static size_t curl_callback(void *contents, size_t size, size_t nmemb, std::string *s);
+    ArenaJson response_onecall;
+    ArenaJson response_airpollution;
+    ArenaJson response_airpollution_forecast;   // Null if not fetched
     AQI get_airquality();
+    static std::vector<HourlyAirQuality> get_airquality_series(const ArenaJson & list, size_t count);
 };
 
 #endif //NOOK_WEATHER_API_OPENWEATHERMAP_H
@@ -1,6 +1,55 @@
+#include <algorithm>
 #include <climits>
 #include "aqi.h"
 
+static const char *pollutant_names[] = {"no2", "pm10", "o3", "pm2.5"};
+
+// CAQI scales: concentration (μg/m3) at the bottom of each band, then at the top of the highest
+static const double caqi_cutoffs[(size_t) Pollutant::count][5] = {
+    {0, 50, 100, 200, 400},  // no2
+    {0, 25, 50, 90, 180},    // pm10
+    {0, 60, 120, 180, 240},  // o3
+    {0, 15, 30, 55, 110}     // pm2.5
+};
+
+/**
+ * Gets the name of a pollutant
+ *
+ * @param [in] pollutant pollutant
+ * @return name shown on display
+ */
+const char *get_pollutant_name(const Pollutant pollutant) {
+    return (size_t) pollutant < (size_t) Pollutant::count ? pollutant_names[(size_t) pollutant] : "";
+}
+
+/**
+ * Works out how severe a pollutant is over a series of concentrations, on the CAQI scale
+ * Within the scale, severity is the band the concentration is in plus how far through the band it is, which is the sum
+ * of how full each band is; past the top of the scale it is extrapolated from the top
+ * Summing clamped bands instead of searching for the band leaves the loop without branches, so it vectorizes
+ *
+ * @param [in] pollutant pollutant the concentrations are of
+ * @param [in] concentrations concentration at each time  Units: μg/m3
+ * @param [out] severities severity at each time, 0 - 5 within the scale
+ * @param [in] count number of concentrations
+ */
+void get_caqi_severities(const Pollutant pollutant, const double *concentrations, double *severities,
+                         const size_t count) {
+    const double (&cutoffs)[5] = caqi_cutoffs[(size_t) pollutant];
+    double scales[4];
+    for (int band = 0; band < 4; band++) {
+        scales[band] = 1 / (cutoffs[band + 1] - cutoffs[band]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        double concentration = concentrations[i];
+        double severity = 0;
+        for (int band = 0; band < 4; band++) {
+            severity += std::min(std::max((concentration - cutoffs[band]) * scales[band], 0.0), 1.0);
+        }
+        severities[i] = concentration > cutoffs[4] ? concentration / cutoffs[4] * 5 : severity;
+    }
+}
+
 /**
  * Creates an AQI object for an air quality index
  *
@@ -27,6 +76,15 @@ std::string AQI::get_description() const {
     return description;
 }
 
+/**
+ * Gets primary pollutant
+ *
+ * @return primary pollutant, or an empty string if air quality is good
+ */
+std::string AQI::get_pollutant() const {
+    return pollutant;
+}
+
 /**
  * Gets summary to show on weather display
  *
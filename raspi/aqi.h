@@ -1,13 +1,28 @@
 #ifndef NOOK_WEATHER_AQI_H
 #define NOOK_WEATHER_AQI_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
+// Pollutants with a CAQI scale
+enum class Pollutant : uint8_t {
+    no2,
+    pm10,
+    o3,
+    pm25,
+    count                                                                           // Number of pollutants, not a pollutant
+};
+
+const char *get_pollutant_name(Pollutant pollutant);                                 // Name shown on display, e.g. "pm2.5"
+void get_caqi_severities(Pollutant pollutant, const double *concentrations, double *severities, size_t count);
+
 class AQI {
 public:
     explicit AQI(int number, std::string description, std::string pollutant="");    // Construct AQI object from supplied number and description
     int get_number() const;                                                         // Getter method for number
     std::string get_description() const;                                            // Getter method for description
+    std::string get_pollutant() const;                                              // Getter method for pollutant
     std::string get_summary() const;                                                // Gets summary to show on weather display
 private:
     int number;                                                                     // Units: AQI (not standardized)
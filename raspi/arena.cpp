@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <libxml/parser.h>
+#include <libxml/xmlerror.h>
+#include <libxml/xmlmemory.h>
+
+#include "arena.h"
+
+// Every allocation is preceded by its size so it can be reallocated
+static const size_t alignment = 16;
+static const size_t header_size = alignment;
+
+static thread_local Arena *active_arena = nullptr;
+static bool xml_arena = false;
+
+/**
+ * Creates an empty arena; memory is only reserved on first allocation
+ *
+ * @param [in] chunk_size size of each block of memory the arena reserves, in bytes
+ */
+Arena::Arena(const size_t chunk_size) : chunk_size(chunk_size), in_use(0), peak(0) {}
+
+Arena::~Arena() {
+    for (Chunk & chunk : chunks) {
+        std::free(chunk.data);
+    }
+}
+
+/**
+ * Allocates memory from the arena
+ *
+ * @param [in] size number of bytes
+ * @return pointer to memory, or nullptr if out of memory
+ */
+void *Arena::allocate(const size_t size) {
+    size_t needed = header_size + (size + alignment - 1) / alignment * alignment;
+
+    // Start a new chunk if the current one is full; oversized allocations get a chunk of their own
+    if (chunks.empty() || chunks.back().size - chunks.back().used < needed) {
+        size_t new_size = std::max(chunk_size, needed);
+        auto *data = (char *) std::malloc(new_size);
+        if (data == nullptr) {
+            return nullptr;
+        }
+        chunks.push_back(Chunk{data, new_size, 0});
+    }
+
+    Chunk & chunk = chunks.back();
+    char *block = chunk.data + chunk.used;
+    chunk.used += needed;
+    in_use += needed;
+    peak = std::max(peak, in_use);
+
+    *(size_t *) block = size;
+    return block + header_size;
+}
+
+/**
+ * Resizes an arena allocation, in place if it is the most recent one
+ *
+ * @param [in] ptr pointer from this arena, or nullptr
+ * @param [in] size new size in bytes
+ * @return pointer to resized memory, or nullptr if out of memory
+ */
+void *Arena::reallocate(void *ptr, const size_t size) {
+    if (ptr == nullptr) {
+        return allocate(size);
+    }
+    char *block = (char *) ptr - header_size;
+    size_t old_size = *(size_t *) block;
+
+    // Grow in place if nothing was allocated after it
+    Chunk & chunk = chunks.back();
+    size_t old_needed = header_size + (old_size + alignment - 1) / alignment * alignment;
+    size_t new_needed = header_size + (size + alignment - 1) / alignment * alignment;
+    if (block + old_needed == chunk.data + chunk.used && block - chunk.data + new_needed <= chunk.size) {
+        chunk.used = block - chunk.data + new_needed;
+        in_use = in_use - old_needed + new_needed;
+        peak = std::max(peak, in_use);
+        *(size_t *) block = size;
+        return ptr;
+    }
+
+    void *moved = allocate(size);
+    if (moved != nullptr) {
+        std::memcpy(moved, ptr, std::min(old_size, size));
+    }
+    return moved;
+}
+
+/**
+ * Gives back an allocation if it was the most recent one; otherwise it is freed on reset
+ *
+ * @param [in] ptr pointer from this arena
+ */
+void Arena::release(void *ptr) {
+    char *block = (char *) ptr - header_size;
+    Chunk & chunk = chunks.back();
+    size_t needed = header_size + (*(size_t *) block + alignment - 1) / alignment * alignment;
+    if (block + needed == chunk.data + chunk.used) {
+        chunk.used -= needed;
+        in_use -= needed;
+    }
+}
+
+/**
+ * Checks if a pointer was allocated from this arena
+ *
+ * @param [in] ptr pointer to check
+ * @return true if pointer is inside one of the arena's chunks
+ */
+bool Arena::contains(const void *ptr) const {
+    for (auto chunk = chunks.rbegin(); chunk != chunks.rend(); ++chunk) {
+        if (ptr >= chunk->data && ptr < chunk->data + chunk->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Frees every allocation at once, keeping the first chunk for reuse
+ */
+void Arena::reset() {
+    for (size_t i = 1; i < chunks.size(); i++) {
+        std::free(chunks[i].data);
+    }
+    if (!chunks.empty()) {
+        chunks.resize(1);
+        chunks[0].used = 0;
+    }
+    in_use = 0;
+}
+
+/**
+ * Gets the most memory the arena has had in use at once
+ *
+ * @return peak usage in bytes
+ */
+size_t Arena::get_peak() const {
+    return peak;
+}
+
+/**
+ * Makes an arena the destination for arena-aware allocations on this thread
+ *
+ * @param [in] arena arena to use, or nullptr to use the heap until the scope ends
+ */
+ArenaScope::ArenaScope(Arena *arena) : arena(arena), previous(active_arena) {
+    active_arena = arena;
+}
+
+ArenaScope::~ArenaScope() {
+    active_arena = previous;
+    if (arena != nullptr) {
+        // libxml2 keeps the last error around, which may point into the arena
+        xmlResetLastError();
+        arena->reset();
+    }
+}
+
+/**
+ * Allocates from the thread's active arena, or the heap if there is none
+ *
+ * @param [in] size number of bytes
+ * @return pointer to memory, or nullptr if out of memory
+ */
+void *arena_malloc(const size_t size) {
+    return active_arena ? active_arena->allocate(size) : std::malloc(size);
+}
+
+/**
+ * Frees memory from arena_malloc; arena memory is only really freed when the arena is reset
+ *
+ * @param [in] ptr pointer to free
+ */
+void arena_free(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (active_arena && active_arena->contains(ptr)) {
+        active_arena->release(ptr);
+    } else {
+        std::free(ptr);
+    }
+}
+
+/**
+ * Resizes memory from arena_malloc
+ *
+ * @param [in] ptr pointer to resize, or nullptr
+ * @param [in] size new size in bytes
+ * @return pointer to resized memory, or nullptr if out of memory
+ */
+void *arena_realloc(void *ptr, const size_t size) {
+    if (active_arena && (ptr == nullptr || active_arena->contains(ptr))) {
+        return active_arena->reallocate(ptr, size);
+    }
+
+    // Heap memory resized while an arena is active stays on the heap
+    return std::realloc(ptr, size);
+}
+
+/**
+ * Copies a string using arena_malloc
+ *
+ * @param [in] str string to copy
+ * @return copy of string, or nullptr if out of memory
+ */
+char *arena_strdup(const char *str) {
+    size_t length = std::strlen(str) + 1;
+    auto *copy = (char *) arena_malloc(length);
+    if (copy != nullptr) {
+        std::memcpy(copy, str, length);
+    }
+    return copy;
+}
+
+/**
+ * Routes libxml2's allocations through the arena hooks
+ * Must be called before libxml2 is used for anything else
+ */
+void install_xml_arena() {
+    xmlMemSetup(arena_free, arena_malloc, arena_realloc, arena_strdup);
+    xmlInitParser();
+    xml_arena = true;
+}
+
+/**
+ * Checks if libxml2 can allocate from arenas
+ *
+ * @return true if install_xml_arena has been called
+ */
+bool xml_arena_installed() {
+    return xml_arena;
+}
@@ -0,0 +1,85 @@
+#ifndef NOOK_WEATHER_ARENA_H
+#define NOOK_WEATHER_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+class Arena {
+public:
+    explicit Arena(size_t chunk_size = 256 * 1024);    // Construct arena that grows in chunks of chunk_size bytes
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+    void *allocate(size_t size);                        // Allocate from arena
+    void *reallocate(void *ptr, size_t size);           // Grow or shrink an arena allocation
+    void release(void *ptr);                            // Give back memory if it was the last allocation
+    bool contains(const void *ptr) const;               // Checks if pointer was allocated from this arena
+    void reset();                                       // Free every allocation at once
+    size_t get_peak() const;                            // Units: bytes  (most ever in use since construction)
+private:
+    struct Chunk {
+        char *data;
+        size_t size;                                    // Units: bytes
+        size_t used;                                    // Units: bytes
+    };
+    std::vector<Chunk> chunks;
+    size_t chunk_size;                                  // Units: bytes
+    size_t in_use;                                      // Units: bytes
+    size_t peak;                                        // Units: bytes
+};
+
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena *arena);                  // Route allocations on this thread to arena (nullptr to pause)
+    ~ArenaScope();                                      // Restore previous arena, resetting this one
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope & operator=(const ArenaScope &) = delete;
+private:
+    Arena *arena;
+    Arena *previous;
+};
+
+void *arena_malloc(size_t size);
+void arena_free(void *ptr);
+void *arena_realloc(void *ptr, size_t size);
+char *arena_strdup(const char *str);
+void install_xml_arena();
+bool xml_arena_installed();
+
+/**
+ * Standard allocator that uses the thread's active arena, or the heap if there is none
+ */
+template<typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator() = default;
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &) {}
+
+    T *allocate(const size_t n) {
+        void *ptr = arena_malloc(n * sizeof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return (T *) ptr;
+    }
+
+    void deallocate(T *ptr, size_t) {
+        arena_free(ptr);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+    return false;
+}
+
+#endif //NOOK_WEATHER_ARENA_H
@@ -0,0 +1,518 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <libxml/parser.h>
+
+#include "arena.h"
+#include "assets.h"
+#include "flightrecorder.h"
+
+// Groups modify_svg fills in; a template missing any of them can't be rendered
+static const char *required_groups[] = {"group-date", "group-current", "group-precipitation",
+                                        "group-hourly", "group-daily", "group-alerts"};
+
+// Elements modify_svg walks through by position at the start of each group, in order
+struct GroupLayout {
+    const char *id;
+    std::vector<const char *> elements;
+};
+static const GroupLayout group_layouts[] = {
+    {"group-date", {"text"}},
+    {"group-current", {"text", "text", "text", "text", "text", "text", "text", "text", "text", "image"}},
+    {"group-precipitation", {"text", "text", "text", "image"}},
+    {"group-daily", {"text", "text", "image"}},  // at least one box
+    {"group-alerts", {"rect", "text"}}
+};
+
+// Groups whose text is fitted to their data-bounds
+static const char *fitted_groups[] = {"group-date", "group-current", "group-alerts"};
+
+// Classes of the hourly graph's elements, and how many of each modify_svg needs
+static const std::pair<const char *, size_t> hourly_classes[] = {
+    {"hourlyrain", 1}, {"hourlygrid", 1}, {"hourlyhour", 1}, {"hourlytemp", 2}, {"hourlygraph", 1}
+};
+
+/**
+ * Finds the first element with a name, searching depth first
+ *
+ * @param [in] node first node of the subtree to search
+ * @param [in] name element name
+ * @return element, or nullptr if there is none
+ */
+static xmlNodePtr find_element(xmlNodePtr node, const char *name) {
+    for (; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        if (xmlStrcmp(node->name, (xmlChar *) name) == 0) {
+            return node;
+        }
+        xmlNodePtr found = find_element(node->children, name);
+        if (found) {
+            return found;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Gets the template's stylesheet
+ *
+ * @param [in] root_element root of the template
+ * @return CSS of the first <style> element, or an empty string if there isn't one
+ */
+static std::string read_stylesheet(xmlNodePtr root_element) {
+    xmlNodePtr style = find_element(root_element->children, "style");
+    if (style == nullptr) {
+        return "";
+    }
+    xmlChar *content = xmlNodeGetContent(style);
+    std::string css = content ? (char *) content : "";
+    xmlFree(content);
+    return css;
+}
+
+/**
+ * Gets the font-family the stylesheet sets for text elements
+ *
+ * @param [in] css stylesheet of the template
+ * @return font-family list, or "sans-serif" if the stylesheet doesn't set one
+ */
+static std::string read_font_family(const std::string & css) {
+    std::string family = "sans-serif";
+    size_t rule = css.find("text{");
+    size_t start = rule == std::string::npos ? rule : css.find("font-family:", rule);
+    size_t rule_end = rule == std::string::npos ? rule : css.find('}', rule);
+    if (start != std::string::npos && start < rule_end) {
+        start += std::string("font-family:").size();
+        size_t end = css.find_first_of(";}", start);
+        family = css.substr(start, end - start);
+    }
+    return family;
+}
+
+/**
+ * Gets the font-size a list of CSS declarations sets
+ *
+ * @param [in] declarations declarations, e.g. "fill:white;font-size:24px"
+ * @return font size in px, or 0 if not set (later declarations win)
+ */
+static double read_font_size(const std::string & declarations) {
+    size_t start = declarations.rfind("font-size:");
+    return start == std::string::npos ? 0 : strtod(declarations.c_str() + start + strlen("font-size:"), nullptr);
+}
+
+/**
+ * Gets the font-size of every class the stylesheet sets one for, e.g. ".small{font-size:20px;}"
+ *
+ * @param [in] css stylesheet of the template
+ * @return position of rule and font size in px, by class name
+ */
+static std::map<std::string, std::pair<size_t, double>> read_class_font_sizes(const std::string & css) {
+    std::map<std::string, std::pair<size_t, double>> sizes;
+    size_t rule_start = 0;
+    for (size_t position = 0; rule_start < css.size(); position++) {
+        size_t open = css.find('{', rule_start);
+        size_t close = css.find('}', open);
+        if (close == std::string::npos) {
+            break;
+        }
+        double size = read_font_size(css.substr(open + 1, close - open - 1));
+
+        // Only simple class selectors, which are all a template uses for text
+        std::stringstream selectors(css.substr(rule_start, open - rule_start));
+        std::string selector;
+        while (size > 0 && std::getline(selectors, selector, ',')) {
+            selector.erase(0, selector.find_first_not_of(" \t\r\n"));
+            selector.erase(selector.find_last_not_of(" \t\r\n") + 1);
+            if (selector.size() > 1 && selector[0] == '.' && selector.find_first_of(" .:>[", 1) == std::string::npos) {
+                sizes[selector.substr(1)] = {position, size};
+            }
+        }
+        rule_start = close + 1;
+    }
+    return sizes;
+}
+
+/**
+ * Reads the area a group covers from its data-bounds attribute
+ *
+ * @param [in] group_ptr pointer to the <g> node
+ * @param [out] bounds x, y, width and height in svg user units
+ * @return false if the group has no valid data-bounds
+ */
+bool read_group_bounds(xmlNodePtr group_ptr, double bounds[4]) {
+    xmlChar *value = xmlGetProp(group_ptr, (xmlChar *) "data-bounds");
+    std::stringstream fields(value ? (char *) value : "");
+    xmlFree(value);
+    return (bool) (fields >> bounds[0] >> bounds[1] >> bounds[2] >> bounds[3]) && bounds[2] > 0 && bounds[3] > 0;
+}
+
+/**
+ * Checks that a group has the elements modify_svg fills in, so a half-saved or rearranged template is turned away
+ * when it is loaded instead of failing every render
+ *
+ * @param [in] group_ptr pointer to the <g> node
+ * @param [in] id id of group
+ * @return what is wrong with the group, or an empty string if nothing is
+ */
+static std::string check_group(xmlNodePtr group_ptr, const std::string & id) {
+    for (const GroupLayout & layout : group_layouts) {
+        if (id != layout.id) {
+            continue;
+        }
+        xmlNodePtr node = group_ptr->children;
+        for (const char *element : layout.elements) {
+            if (node == nullptr || node->type != XML_ELEMENT_NODE || xmlStrcmp(node->name, (xmlChar *) element) != 0) {
+                return id + " needs <" + element + "> at position " + std::to_string(&element - layout.elements.data());
+            }
+            node = node->next;
+        }
+    }
+
+    for (const char *fitted : fitted_groups) {
+        double bounds[4];
+        if (id == fitted && !read_group_bounds(group_ptr, bounds)) {
+            return id + " needs data-bounds=\"<x> <y> <width> <height>\"";
+        }
+    }
+
+    // Alerts are shown on the two lines of the text after the box
+    if (id == "group-alerts") {
+        xmlNodePtr lines = group_ptr->children->next;
+        if (xmlFirstElementChild(lines) == nullptr || xmlNextElementSibling(xmlFirstElementChild(lines)) == nullptr) {
+            return id + " needs two <tspan> lines in its <text>";
+        }
+    }
+
+    // The hourly graph is found by class instead
+    if (id == "group-hourly") {
+        for (const auto & hourly_class : hourly_classes) {
+            size_t count = 0;
+            for (xmlNodePtr node = group_ptr->children; node; node = node->next) {
+                xmlChar *value = xmlGetProp(node, (xmlChar *) "class");
+                count += value && xmlStrcmp(value, (xmlChar *) hourly_class.first) == 0;
+                xmlFree(value);
+            }
+            if (count < hourly_class.second) {
+                return id + " needs " + std::to_string(hourly_class.second) + " ." + hourly_class.first;
+            }
+        }
+    }
+    return "";
+}
+
+/**
+ * Parses a template, indexes its top-level groups and checks they can be filled in
+ *
+ * @param [in] filepath path to template svg
+ */
+Template::Template(const std::string & filepath) {
+    // Templates outlive any render, so keep them out of its arena
+    ArenaScope heap(nullptr);
+    doc = xmlReadFile(filepath.c_str(), nullptr, XML_PARSE_NOBLANKS);  // no whitespace text elements
+    if (doc == nullptr) {
+        throw std::runtime_error("Failed to read template file " + filepath);
+    }
+
+    xmlNodePtr root_element = xmlDocGetRootElement(doc);
+    if (root_element == nullptr || xmlStrcmp(root_element->name, (xmlChar *) "svg") != 0) {
+        xmlFreeDoc(doc);
+        throw std::runtime_error("Template " + filepath + " is not an svg");
+    }
+    size_t position = 0;
+    for (xmlNodePtr node = root_element->children; node; node = node->next, position++) {
+        xmlChar *node_id = xmlGetProp(node, (xmlChar *) "id");
+        if (node_id) {
+            groups[(char *) node_id] = position;
+        }
+        xmlFree(node_id);
+    }
+    for (const char *id : required_groups) {
+        if (groups.count(id) == 0) {
+            xmlFreeDoc(doc);
+            throw std::runtime_error("Template " + filepath + " is missing " + id);
+        }
+        std::string problem = check_group(get_group(doc, id), id);
+        if (!problem.empty()) {
+            xmlFreeDoc(doc);
+            throw std::runtime_error("Template " + filepath + " can't be filled in: " + problem);
+        }
+    }
+    std::string css = read_stylesheet(root_element);
+    font_family = read_font_family(css);
+    class_font_sizes = read_class_font_sizes(css);
+}
+
+Template::~Template() {
+    xmlFreeDoc(doc);
+}
+
+/**
+ * Gets a copy of the template to fill in
+ *
+ * @return copy of parsed template, to be freed by the caller
+ */
+xmlDocPtr Template::copy() const {
+    return xmlCopyDoc(doc, 1);
+}
+
+/**
+ * Finds a top-level group in a copy of this template by id
+ *
+ * @param [in] doc copy of template
+ * @param [in] id id of group
+ * @return pointer to the <g> node
+ */
+xmlNodePtr Template::get_group(xmlDocPtr doc, const char *id) const {
+    auto group = groups.find(id);
+    if (group == groups.end()) {
+        throw std::runtime_error(std::string("Template is missing ") + id);
+    }
+    xmlNodePtr node = xmlDocGetRootElement(doc)->children;
+    for (size_t i = 0; i < group->second && node; i++) {
+        node = node->next;
+    }
+    return node;
+}
+
+/**
+ * Gets the font-family the template's text is set in
+ *
+ * @return CSS font-family list
+ */
+const std::string & Template::get_font_family() const {
+    return font_family;
+}
+
+/**
+ * Gets the font size a node in a copy of this template is drawn at, following CSS: its style attribute beats the
+ * stylesheet, which beats its font-size attribute, and nodes that don't set one inherit their parent's
+ *
+ * @param [in] node text or tspan node
+ * @return font size in px (16 if nothing sets one)
+ */
+double Template::get_font_size(xmlNodePtr node) const {
+    for (; node && node->type == XML_ELEMENT_NODE; node = node->parent) {
+        xmlChar *style = xmlGetProp(node, (xmlChar *) "style");
+        double size = read_font_size(style ? (char *) style : "");
+        xmlFree(style);
+        if (size > 0) {
+            return size;
+        }
+
+        // The class with the last rule wins
+        xmlChar *classes = xmlGetProp(node, (xmlChar *) "class");
+        std::stringstream class_list(classes ? (char *) classes : "");
+        xmlFree(classes);
+        std::string name;
+        size_t position = 0;
+        while (class_list >> name) {
+            auto rule = class_font_sizes.find(name);
+            if (rule != class_font_sizes.end() && (size == 0 || rule->second.first >= position)) {
+                position = rule->second.first;
+                size = rule->second.second;
+            }
+        }
+        if (size > 0) {
+            return size;
+        }
+
+        xmlChar *attribute = xmlGetProp(node, (xmlChar *) "font-size");
+        size = attribute ? strtod((char *) attribute, nullptr) : 0;
+        xmlFree(attribute);
+        if (size > 0) {
+            return size;
+        }
+    }
+    return 16;
+}
+
+/**
+ * Creates a store for the templates and icons in an image directory
+ *
+ * @param [in] img_dir directory of images
+ */
+AssetStore::AssetStore(const std::string & img_dir) : img_dir(img_dir) {}
+
+AssetStore::~AssetStore() {
+    if (watcher.joinable()) {
+        uint64_t stop = 1;
+        write(stop_fd, &stop, sizeof(stop));
+        watcher.join();
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+    }
+}
+
+/**
+ * Gets a shared store for an image directory
+ *
+ * @param [in] img_dir directory of images
+ * @return shared store
+ */
+std::shared_ptr<AssetStore> AssetStore::get_instance(const std::string & img_dir) {
+    static std::mutex instances_mutex;
+    static std::map<std::string, std::shared_ptr<AssetStore>> instances;
+
+    std::lock_guard<std::mutex> lock(instances_mutex);
+    std::shared_ptr<AssetStore> & instance = instances[img_dir];
+    if (!instance) {
+        instance = std::make_shared<AssetStore>(img_dir);
+    }
+    return instance;
+}
+
+/**
+ * Gets the current version of a template, parsing it on first use
+ * Renders keep the version they got even if a new one is swapped in while they run
+ *
+ * @param [in] filename filename of template, relative to image directory
+ * @return parsed template
+ */
+std::shared_ptr<const Template> AssetStore::get_template(const std::string & filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const Template> & loaded = templates[filename];
+    if (!loaded) {
+        try {
+            loaded = std::make_shared<const Template>(img_dir + filename);
+        } catch (std::runtime_error &e) {
+            templates.erase(filename);
+            throw;
+        }
+    }
+    return loaded;
+}
+
+/**
+ * Gets the filename of an icon; the rasterizer reads icons itself, so they are only watched for changes
+ *
+ * @param [in] name icon name, e.g. "01d"
+ * @return filename of icon, relative to image directory
+ */
+std::string AssetStore::get_icon(const std::string & name) {
+    std::string filename = name + ".svg";
+    std::lock_guard<std::mutex> lock(mutex);
+    icons.insert(filename);
+    return filename;
+}
+
+/**
+ * Starts a thread that reloads templates and checks icons whenever they are written or replaced
+ */
+void AssetStore::watch() {
+    if (watcher.joinable()) {
+        return;
+    }
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (inotify_fd < 0 || stop_fd < 0
+        || inotify_add_watch(inotify_fd, img_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        throw std::runtime_error("Failed to watch " + img_dir);
+    }
+    watcher = std::thread(&AssetStore::watch_events, this);
+}
+
+/**
+ * Gets a counter that goes up every time an asset in use changes
+ *
+ * @return generation
+ */
+uint64_t AssetStore::get_generation() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return generation;
+}
+
+/**
+ * Waits until an asset in use changes
+ *
+ * @param [in] generation generation already seen
+ * @param [in] deadline time to give up waiting
+ * @return true if assets changed, false if the deadline passed first
+ */
+bool AssetStore::wait_for_change(const uint64_t generation, const std::chrono::system_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return changed.wait_until(lock, deadline, [this, generation] { return this->generation != generation; });
+}
+
+/**
+ * Reads file events until the store is destroyed
+ * Editors either rewrite a file in place (close after write) or rename a new one over it (moved to)
+ */
+void AssetStore::watch_events() {
+    alignas(inotify_event) char buffer[4096];
+    pollfd fds[] = {{inotify_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    while (true) {
+        // poll is never restarted after a signal handler (e.g. the profiler's or flight recorder's), even with SA_RESTART
+        int ready = poll(fds, 2, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0) {
+            std::cerr << "error: Failed to watch " << img_dir << " (" << strerror(errno)
+                      << "), assets won't be reloaded" << std::endl;
+            record_event(FlightEventType::error, errno, "asset watcher stopped");
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        for (ssize_t offset = 0; offset < length;) {
+            auto *event = (inotify_event *) (buffer + offset);
+            if (event->len > 0) {
+                reload(event->name);
+            }
+            offset += (ssize_t) sizeof(inotify_event) + event->len;
+        }
+    }
+}
+
+/**
+ * Re-parses a changed template, or checks a changed icon, keeping the old template if the new one is invalid
+ *
+ * @param [in] filename filename of changed file, relative to image directory
+ */
+void AssetStore::reload(const std::string & filename) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (templates.count(filename)) {
+        // Parse without holding the lock so renders aren't held up
+        lock.unlock();
+        std::shared_ptr<const Template> parsed;
+        try {
+            parsed = std::make_shared<const Template>(img_dir + filename);
+        } catch (std::runtime_error &e) {
+            std::cerr << "error: " << e.what() << ", keeping previous version" << std::endl;
+            return;
+        }
+        lock.lock();
+        templates[filename] = parsed;
+    } else if (icons.count(filename)) {
+        lock.unlock();
+        xmlDocPtr icon = xmlReadFile((img_dir + filename).c_str(), nullptr, XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+        if (icon == nullptr) {
+            std::cerr << "error: Icon " << filename << " is not valid svg" << std::endl;
+            return;
+        }
+        xmlFreeDoc(icon);
+        lock.lock();
+    } else {
+        return;
+    }
+    generation++;
+    changed.notify_all();
+}
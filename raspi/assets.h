@@ -0,0 +1,60 @@
+#ifndef NOOK_WEATHER_ASSETS_H
+#define NOOK_WEATHER_ASSETS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <libxml/tree.h>
+
+class Template {
+public:
+    explicit Template(const std::string & filepath);        // Parse and validate template file
+    ~Template();
+    Template(const Template &) = delete;
+    Template & operator=(const Template &) = delete;
+    xmlDocPtr copy() const;                                 // Copy of template to modify, to be freed by the caller
+    xmlNodePtr get_group(xmlDocPtr doc, const char *id) const;  // Find top-level group in a copy by id
+    const std::string & get_font_family() const;            // font-family of text in the stylesheet
+    double get_font_size(xmlNodePtr node) const;            // Units: px  (computed font-size of a node in a copy)
+private:
+    xmlDocPtr doc;                                          // Parsed template, never modified
+    std::string font_family;
+    std::map<std::string, std::pair<size_t, double>> class_font_sizes;  // Position of rule and font-size, by class
+    std::map<std::string, size_t> groups;                   // Position of each top-level group among the root's children
+};
+
+bool read_group_bounds(xmlNodePtr group_ptr, double bounds[4]);  // x, y, width and height from data-bounds
+
+class AssetStore {
+public:
+    explicit AssetStore(const std::string & img_dir);
+    ~AssetStore();
+    AssetStore(const AssetStore &) = delete;
+    AssetStore & operator=(const AssetStore &) = delete;
+    static std::shared_ptr<AssetStore> get_instance(const std::string & img_dir);
+    std::shared_ptr<const Template> get_template(const std::string & filename);     // Current version of a template
+    std::string get_icon(const std::string & name);         // Filename of an icon, noting that it is in use
+    void watch();                                           // Start reloading assets as they change
+    uint64_t get_generation();                              // Number of asset changes seen so far
+    bool wait_for_change(uint64_t generation, std::chrono::system_clock::time_point deadline);
+private:
+    std::string img_dir;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<std::string, std::shared_ptr<const Template>> templates;   // Keyed by filename
+    std::set<std::string> icons;                            // Filenames of icons that have been used
+    uint64_t generation = 0;
+    int inotify_fd = -1;
+    int stop_fd = -1;
+    std::thread watcher;
+    void watch_events();
+    void reload(const std::string & filename);
+};
+
+#endif //NOOK_WEATHER_ASSETS_H
@@ -0,0 +1,162 @@
+#include <cmath>
+
+#include "astronomy.h"
+
+// Low precision solar and lunar formulas, good to about a minute for sunrise and sunset away from the poles
+static const double unix_epoch_jd = 2440587.5;      // Julian day of 1970-01-01 00:00 UTC
+static const double j2000_jd = 2451545.0;           // Julian day of 2000-01-01 12:00 UTC
+static const double new_moon_jd = 2451550.26;       // Julian day of the new moon of 2000-01-06
+static const double synodic_month = 29.530588853;   // Units: days
+static const double horizon = -0.833;               // Units: degrees  (sun's upper edge on the horizon, with refraction)
+static const double civil_twilight = -6;            // Units: degrees
+static const double degree = M_PI / 180;
+
+/**
+ * Converts unix time to days since J2000
+ *
+ * @param [in] timestamp unix time
+ * @return days since 2000-01-01 12:00 UTC
+ */
+static double get_j2000_days(const int64_t timestamp) {
+    return (double) timestamp / 86400 + unix_epoch_jd - j2000_jd;
+}
+
+/**
+ * Converts days since J2000 to unix time
+ *
+ * @param [in] days days since 2000-01-01 12:00 UTC
+ * @return unix time
+ */
+static int64_t get_timestamp(const double days) {
+    return (int64_t) std::round((days + j2000_jd - unix_epoch_jd) * 86400);
+}
+
+/**
+ * Gets sunrise, sunset and civil twilight for the day around a solar noon
+ *
+ * @param [in] lat latitude in degrees
+ * @param [in] lon longitude in degrees east
+ * @param [in] noon unix time near the local noon of the day
+ * @return times the sun crosses the horizon and civil twilight elevations
+ */
+SunTimes get_sun_times(const double lat, const double lon, const int64_t noon) {
+    // Solar transit nearest to noon
+    double cycle = std::round(get_j2000_days(noon) - 0.0009 + lon / 360);
+    double mean_noon = cycle + 0.0009 - lon / 360;
+    double anomaly = std::fmod(357.5291 + 0.98560028 * mean_noon, 360) * degree;
+    double center = 1.9148 * std::sin(anomaly) + 0.02 * std::sin(2 * anomaly) + 0.0003 * std::sin(3 * anomaly);
+    double ecliptic_lon = std::fmod(anomaly / degree + center + 180 + 102.9372, 360) * degree;
+    double transit = mean_noon + 0.0053 * std::sin(anomaly) - 0.0069 * std::sin(2 * ecliptic_lon);
+    double declination = std::asin(std::sin(ecliptic_lon) * std::sin(23.4397 * degree));
+
+    // Hour angle at which the sun reaches an elevation, as a fraction of a day
+    auto get_hour_angle = [&](const double elevation) {
+        return (std::sin(elevation * degree) - std::sin(lat * degree) * std::sin(declination))
+               / (std::cos(lat * degree) * std::cos(declination));
+    };
+
+    SunTimes times{0, 0, 0, 0, false};
+    double cos_rise = get_hour_angle(horizon);
+    if (cos_rise < -1) {
+        times.midnight_sun = true;
+    } else if (cos_rise <= 1) {
+        double half_day = std::acos(cos_rise) / (2 * M_PI);
+        times.sunrise = get_timestamp(transit - half_day);
+        times.sunset = get_timestamp(transit + half_day);
+    }
+    double cos_twilight = get_hour_angle(civil_twilight);
+    if (cos_twilight >= -1 && cos_twilight <= 1) {
+        double half_day = std::acos(cos_twilight) / (2 * M_PI);
+        times.dawn = get_timestamp(transit - half_day);
+        times.dusk = get_timestamp(transit + half_day);
+    }
+    return times;
+}
+
+/**
+ * Gets the sun's elevation at many times at once
+ * The loop has no branches and only works on contiguous arrays, so the compiler can vectorize it
+ *
+ * @param [in] lat latitude in degrees
+ * @param [in] lon longitude in degrees east
+ * @param [in] timestamps unix times
+ * @return elevation of the sun's center above the horizon in degrees, for each time
+ */
+std::vector<double> get_sun_elevations(const double lat, const double lon, const std::vector<int64_t> & timestamps) {
+    const double sin_lat = std::sin(lat * degree);
+    const double cos_lat = std::cos(lat * degree);
+    std::vector<double> elevations(timestamps.size());
+    for (size_t i = 0; i < timestamps.size(); i++) {
+        double days = get_j2000_days(timestamps[i]);
+        double anomaly = (357.529 + 0.98560028 * days) * degree;
+        double mean_lon = (280.459 + 0.98564736 * days) * degree;
+        double ecliptic_lon = mean_lon + (1.915 * std::sin(anomaly) + 0.020 * std::sin(2 * anomaly)) * degree;
+        double obliquity = (23.439 - 0.00000036 * days) * degree;
+        double right_ascension = std::atan2(std::cos(obliquity) * std::sin(ecliptic_lon), std::cos(ecliptic_lon));
+        double declination = std::asin(std::sin(obliquity) * std::sin(ecliptic_lon));
+        double sidereal = (280.46061837 + 360.98564736629 * days + lon) * degree;
+        double hour_angle = sidereal - right_ascension;
+        elevations[i] = std::asin(sin_lat * std::sin(declination)
+                                  + cos_lat * std::cos(declination) * std::cos(hour_angle)) / degree;
+    }
+    return elevations;
+}
+
+/**
+ * Gets how far the moon is through its cycle of phases
+ *
+ * @param [in] timestamp unix time
+ * @return phase from 0 (new) through 0.5 (full) to 1 (new again)
+ */
+double get_moon_phase(const int64_t timestamp) {
+    double cycles = (get_j2000_days(timestamp) + j2000_jd - new_moon_jd) / synodic_month;
+    return cycles - std::floor(cycles);
+}
+
+/**
+ * Gets the name of a moon phase
+ *
+ * @param [in] phase phase from 0 (new) to 1
+ * @return phase name, e.g. "Waxing crescent"
+ */
+std::string get_moon_phase_name(const double phase) {
+    static const char *names[] = {"New moon", "Waxing crescent", "First quarter", "Waxing gibbous",
+                                  "Full moon", "Waning gibbous", "Last quarter", "Waning crescent"};
+    return names[(int) std::floor(phase * 8 + 0.5) % 8];
+}
+
+/**
+ * Picks day or night versions of every icon in a forecast from where the sun is, so frames for later hours
+ * don't depend on the API having chosen for them
+ * Icons are left alone if the forecast doesn't know its location
+ *
+ * @param [in,out] forecast forecast to update
+ */
+void set_day_night_icons(Forecast & forecast) {
+    if (std::isnan(forecast.lat) || std::isnan(forecast.lon)) {
+        return;
+    }
+
+    // Work out every icon's time at once
+    std::vector<std::string *> icons;
+    std::vector<int64_t> timestamps;
+    icons.push_back(&forecast.current.icon);
+    timestamps.push_back(forecast.current.timestamp);
+    for (HourlyWeather & hour : forecast.hourly) {
+        icons.push_back(&hour.icon);
+        timestamps.push_back(hour.timestamp);
+    }
+    for (DailyWeather & day : forecast.daily) {
+        icons.push_back(&day.icon);
+        timestamps.push_back(day.timestamp);
+    }
+    std::vector<double> elevations = get_sun_elevations(forecast.lat, forecast.lon, timestamps);
+
+    // Icon names end in "d" for day or "n" for night
+    for (size_t i = 0; i < icons.size(); i++) {
+        std::string & icon = *icons[i];
+        if (!icon.empty() && (icon.back() == 'd' || icon.back() == 'n')) {
+            icon.back() = elevations[i] > horizon ? 'd' : 'n';
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef NOOK_WEATHER_ASTRONOMY_H
+#define NOOK_WEATHER_ASTRONOMY_H
+
+#include <string>
+#include <vector>
+
+#include "weathertypes.h"
+
+struct SunTimes {
+    int64_t dawn;           // Units: Unix time  (start of civil twilight, 0 if the sun never gets that low)
+    int64_t sunrise;        // Units: Unix time  (0 if the sun doesn't rise or set that day)
+    int64_t sunset;         // Units: Unix time  (0 if the sun doesn't rise or set that day)
+    int64_t dusk;           // Units: Unix time  (end of civil twilight, 0 if the sun never gets that low)
+    bool midnight_sun;      // Sun stays up all day (when sunrise is 0)
+};
+
+SunTimes get_sun_times(double lat, double lon, int64_t noon);
+
+std::vector<double> get_sun_elevations(double lat, double lon, const std::vector<int64_t> & timestamps);
+
+double get_moon_phase(int64_t timestamp);
+
+std::string get_moon_phase_name(double phase);
+
+void set_day_night_icons(Forecast & forecast);
+
+#endif //NOOK_WEATHER_ASTRONOMY_H
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cmath>
+
+#include "downsample.h"
+
+// Closest two chart vertices need to be for the line to still look smooth on an e-ink screen
+static const double pixels_per_point = 5;
+
+/**
+ * Reduces a series to fewer points using Largest-Triangle-Three-Buckets
+ * The first and last points are kept, and from each bucket in between the point making the largest triangle with
+ * the previous kept point and the next bucket's average is kept, so peaks and dips survive where averaging would
+ * flatten them
+ *
+ * @param [in] points series, ordered by x
+ * @param [in] threshold most points to keep (at least 3 to have any buckets)
+ * @return downsampled series, or the original series if it is already small enough
+ */
+std::vector<ChartPoint> downsample_lttb(const std::vector<ChartPoint> & points, const size_t threshold) {
+    if (threshold >= points.size() || threshold < 3) {
+        return points;
+    }
+
+    std::vector<ChartPoint> sampled;
+    sampled.reserve(threshold);
+    sampled.push_back(points.front());
+
+    // Points between the first and last are split into threshold - 2 buckets
+    const double bucket_size = (double) (points.size() - 2) / (double) (threshold - 2);
+    size_t kept = 0;
+    for (size_t bucket = 0; bucket < threshold - 2; bucket++) {
+        size_t start = (size_t) std::floor((double) bucket * bucket_size) + 1;
+        size_t end = (size_t) std::floor((double) (bucket + 1) * bucket_size) + 1;
+
+        // Average of the next bucket, which is just the last point for the final bucket
+        size_t next_start = end;
+        size_t next_end = std::min((size_t) std::floor((double) (bucket + 2) * bucket_size) + 1, points.size());
+        if (bucket + 3 == threshold) {
+            next_start = points.size() - 1;
+            next_end = points.size();
+        }
+        double average_x = 0;
+        double average_y = 0;
+        for (size_t i = next_start; i < next_end; i++) {
+            average_x += points[i].x;
+            average_y += points[i].y;
+        }
+        average_x /= (double) (next_end - next_start);
+        average_y /= (double) (next_end - next_start);
+
+        // Keep the point with the largest triangle
+        const ChartPoint & previous = points[kept];
+        double max_area = -1;
+        for (size_t i = start; i < end; i++) {
+            double area = std::abs((previous.x - average_x) * (points[i].y - previous.y)
+                                   - (previous.x - points[i].x) * (average_y - previous.y));
+            if (area > max_area) {
+                max_area = area;
+                kept = i;
+            }
+        }
+        sampled.push_back(points[kept]);
+    }
+
+    sampled.push_back(points.back());
+    return sampled;
+}
+
+/**
+ * Gets how many points a chart can show without vertices closer than the screen can make out
+ *
+ * @param [in] width width of chart in px
+ * @return most points worth drawing
+ */
+size_t get_point_budget(const double width) {
+    return std::max((size_t) 2, (size_t) (width / pixels_per_point) + 1);
+}
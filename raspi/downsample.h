@@ -0,0 +1,16 @@
+#ifndef NOOK_WEATHER_DOWNSAMPLE_H
+#define NOOK_WEATHER_DOWNSAMPLE_H
+
+#include <cstddef>
+#include <vector>
+
+struct ChartPoint {
+    double x;                           // Units: px
+    double y;                           // Units: px
+};
+
+std::vector<ChartPoint> downsample_lttb(const std::vector<ChartPoint> & points, size_t threshold);
+
+size_t get_point_budget(double width);
+
+#endif //NOOK_WEATHER_DOWNSAMPLE_H
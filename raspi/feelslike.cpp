@@ -0,0 +1,45 @@
+#include <cmath>
+
+#include "feelslike.h"
+
+/**
+ * Gets the apparent temperature the way the US National Weather Service does:
+ * wind chill when it is cold and windy, heat index when it is hot, and the air temperature otherwise
+ *
+ * @param [in] temp air temperature in degrees Celsius
+ * @param [in] humidity relative humidity, 0 (0%) - 1 (100%)
+ * @param [in] wind_speed wind speed in m/s
+ * @return apparent temperature in degrees Celsius
+ */
+double get_feels_like(const double temp, const double humidity, const double wind_speed) {
+    // Wind chill (Environment Canada/NWS 2001), valid at or below 10 °C with wind above 4.8 km/h
+    double wind_kmh = wind_speed * 3.6;
+    if (temp <= 10 && wind_kmh > 4.8) {
+        double wind_factor = std::pow(wind_kmh, 0.16);
+        return 13.12 + 0.6215 * temp - 11.37 * wind_factor + 0.3965 * temp * wind_factor;
+    }
+
+    // Heat index (Rothfusz regression with NWS adjustments), in Fahrenheit
+    double temp_f = temp * 9 / 5 + 32;
+    double rh = humidity * 100;
+    if (temp_f >= 80) {
+        double heat_index = -42.379 + 2.04901523 * temp_f + 10.14333127 * rh - 0.22475541 * temp_f * rh
+                            - 0.00683783 * temp_f * temp_f - 0.05481717 * rh * rh
+                            + 0.00122874 * temp_f * temp_f * rh + 0.00085282 * temp_f * rh * rh
+                            - 0.00000199 * temp_f * temp_f * rh * rh;
+        if (rh < 13 && temp_f <= 112) {
+            heat_index -= (13 - rh) / 4 * std::sqrt((17 - std::abs(temp_f - 95)) / 17);
+        } else if (rh > 85 && temp_f <= 87) {
+            heat_index += (rh - 85) / 10 * (87 - temp_f) / 5;
+        }
+
+        // Simple formula is more accurate when it gives a lower value
+        double simple = 0.5 * (temp_f + 61 + (temp_f - 68) * 1.2 + rh * 0.094);
+        if ((simple + temp_f) / 2 < 80) {
+            heat_index = simple;
+        }
+        return (heat_index - 32) * 5 / 9;
+    }
+
+    return temp;
+}
@@ -0,0 +1,6 @@
+#ifndef NOOK_WEATHER_FEELSLIKE_H
+#define NOOK_WEATHER_FEELSLIKE_H
+
+double get_feels_like(double temp, double humidity, double wind_speed);    // Units: degrees Celsius
+
+#endif //NOOK_WEATHER_FEELSLIKE_H
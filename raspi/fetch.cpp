@@ -0,0 +1,161 @@
+#include <stdexcept>
+
+#include "fetch.h"
+#include "flightrecorder.h"
+
+size_t Fetcher::max_response_size = 4 * 1024 * 1024;
+
+// Every location's transfers go to the same API host, so many locations would otherwise open a connection each
+static const long max_total_connections = 8;
+static const long max_host_connections = 4;
+
+// A stalled server would otherwise hold its location (and the refresh of every other location) forever
+static const long connect_timeout = 10;                 // Units: s
+static const long transfer_timeout = 60;                // Units: s
+static const long low_speed_limit = 64;                 // Units: bytes/s
+static const long low_speed_time = 20;                  // Units: s
+
+/**
+ * Writes data from curl's response to a string
+ *
+ * @param [in] contents data from curl
+ * @param [in] size size of each element (always 1)
+ * @param [in] nmemb number of elements/characters
+ * @param [in,out] s string to save data to
+ * @return number of elements handled correctly (returns 0 if error or response is too large)
+ */
+size_t Fetcher::curl_callback(void *contents, size_t size, size_t nmemb, std::string *s) {
+    size_t newLength = size*nmemb;
+    if (s->size() + newLength > max_response_size) {
+        return 0;
+    }
+    try {
+        s->append((char *) contents, nmemb);
+    } catch (std::bad_alloc &e) {
+        return 0;
+    } catch (std::length_error &e) {
+        return 0;
+    }
+    return newLength;
+}
+
+/**
+ * Sets the largest response that will be accepted, so a bad response can't exhaust memory
+ *
+ * @param [in] bytes maximum size of each response body
+ */
+void Fetcher::set_max_response_size(const size_t bytes) {
+    max_response_size = bytes;
+}
+
+/**
+ * Creates a fetcher that runs any number of transfers at the same time on one thread
+ * Transfers past the connection limits wait for a connection to be free
+ */
+Fetcher::Fetcher() {
+    multi = curl_multi_init();
+    if (!multi) {
+        throw std::runtime_error("Unable to initialize curl");
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_total_connections);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_connections);
+}
+
+Fetcher::~Fetcher() {
+    for (auto & transfer : transfers) {
+        curl_multi_remove_handle(multi, transfer.first);
+        curl_easy_cleanup(transfer.first);
+    }
+    curl_multi_cleanup(multi);
+}
+
+/**
+ * Queues a transfer; nothing is sent until run is called
+ *
+ * @param [in] url address to get
+ * @param [in] callback called from run with the response once the transfer finishes
+ */
+void Fetcher::add(const std::string & url, FetchCallback callback) {
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        throw std::runtime_error("Unable to initialize curl");
+    }
+    auto transfer = std::make_unique<Transfer>();
+    transfer->callback = std::move(callback);
+
+    // Setup curl options
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Fetcher::curl_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer->body);
+    curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t) max_response_size);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, transfer_timeout);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, low_speed_limit);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, low_speed_time);
+
+    curl_multi_add_handle(multi, curl);
+    transfers[curl] = std::move(transfer);
+}
+
+/**
+ * Records a finished transfer's status and timing in the flight recorder
+ * Only the host and path are kept, as the query holds the API key
+ *
+ * @param [in] curl handle of finished transfer
+ * @param [in] result result of transfer
+ */
+void Fetcher::record_transfer(CURL *curl, const CURLcode result) {
+    long status = 0;
+    curl_off_t duration = 0;
+    char *url = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &duration);
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+    std::string address = url ? url : "";
+    address = address.substr(0, address.find('?'));
+    size_t scheme = address.find("://");
+    if (scheme != std::string::npos) {
+        address = address.substr(scheme + 3);
+    }
+    record_event(FlightEventType::http, status, address.c_str(), (int64_t) duration * 1000);
+    if (result != CURLE_OK) {
+        record_event(FlightEventType::error, result, curl_easy_strerror(result));
+    }
+}
+
+/**
+ * Runs queued transfers concurrently, calling each callback as soon as its transfer finishes
+ * A transfer that times out finishes with an error for its callback, so it only fails its own location
+ * Callbacks may queue more transfers
+ */
+void Fetcher::run() {
+    int running = 0;
+    do {
+        CURLMcode code = curl_multi_perform(multi, &running);
+        if (code == CURLM_OK && running > 0) {
+            code = curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+        if (code != CURLM_OK) {
+            throw std::runtime_error("Unable to get weather data");
+        }
+
+        // Hand finished transfers to their callbacks
+        int queued;
+        while (CURLMsg *message = curl_multi_info_read(multi, &queued)) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL *curl = message->easy_handle;
+            CURLcode result = message->data.result;
+            record_transfer(curl, result);
+            std::unique_ptr<Transfer> transfer = std::move(transfers[curl]);
+            transfers.erase(curl);
+            curl_multi_remove_handle(multi, curl);
+            curl_easy_cleanup(curl);
+
+            transfer->callback(transfer->body, result == CURLE_OK ? "" : curl_easy_strerror(result));
+        }
+    } while (running > 0 || !transfers.empty());
+}
@@ -0,0 +1,35 @@
+#ifndef NOOK_WEATHER_FETCH_H
+#define NOOK_WEATHER_FETCH_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <curl/curl.h>
+
+// Called with the response body, or an error message if the transfer failed
+typedef std::function<void(const std::string & body, const std::string & error)> FetchCallback;
+
+class Fetcher {
+public:
+    Fetcher();
+    ~Fetcher();
+    Fetcher(const Fetcher &) = delete;
+    Fetcher & operator=(const Fetcher &) = delete;
+    void add(const std::string & url, FetchCallback callback);          // Queue a transfer
+    void run();                                                         // Run transfers until all are finished
+    static void set_max_response_size(size_t bytes);                    // Limit size of each response
+private:
+    struct Transfer {
+        std::string body;
+        FetchCallback callback;
+    };
+    CURLM *multi;
+    std::map<CURL *, std::unique_ptr<Transfer>> transfers;
+    static size_t max_response_size;                                    // Units: bytes
+    static size_t curl_callback(void *contents, size_t size, size_t nmemb, std::string *s);
+    static void record_transfer(CURL *curl, CURLcode result);
+};
+
+#endif //NOOK_WEATHER_FETCH_H
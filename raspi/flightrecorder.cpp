@@ -0,0 +1,276 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flightrecorder.h"
+
+// Ring of the most recent events; older ones are overwritten
+static const size_t ring_size = 2048;       // Must be a power of two
+static FlightEvent ring[ring_size];
+static std::atomic<uint64_t> next_event{0};
+
+// Path to dump to, kept in a fixed buffer so signal handlers can use it
+static char dump_path[4096];
+static char dump_tmp_path[4100];
+
+static thread_local Stage current_stage = Stage::idle;
+static thread_local uint32_t thread_id = 0;
+
+static const char *stage_names[] = {"idle", "fetch", "decode", "render", "modify_svg_date", "modify_svg_current",
+                                    "modify_svg_precipitation", "modify_svg_hourly", "modify_svg_daily",
+                                    "modify_svg_alerts", "optimize_svg", "serialize", "rasterize", "publish"};
+static const char *type_names[] = {"enter", "leave", "http", "anomaly", "error"};
+static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+/**
+ * Gets the wall clock time cheaply (clock_gettime doesn't enter the kernel)
+ *
+ * @return nanoseconds since Unix epoch
+ */
+static int64_t get_time() {
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Records an event in the ring
+ * Any thread may record at once: each takes its own slot, and marks it written only once it is complete
+ *
+ * @param [in] type kind of event
+ * @param [in] value HTTP status for http events, otherwise anything useful (e.g. a count)
+ * @param [in] detail short description, cut to fit
+ * @param [in] duration how long the event took in nanoseconds, if timed
+ */
+void record_event(const FlightEventType type, const int64_t value, const char *detail, const int64_t duration) {
+    if (thread_id == 0) {
+        thread_id = (uint32_t) syscall(SYS_gettid);
+    }
+    uint64_t index = next_event.fetch_add(1, std::memory_order_relaxed);
+    FlightEvent & event = ring[index & (ring_size - 1)];
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event.time = get_time();
+    event.value = value;
+    event.duration = duration;
+    event.thread = thread_id;
+    event.type = type;
+    event.stage = current_stage;
+    strncpy(event.detail, detail, sizeof(event.detail) - 1);
+    event.detail[sizeof(event.detail) - 1] = '\0';
+
+    event.sequence.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * Enters a stage on this thread, recording when it started
+ *
+ * @param [in] stage stage to enter
+ * @param [in] detail what the stage is working on, e.g. a profile name
+ */
+StageScope::StageScope(const Stage stage, const std::string & detail)
+        : previous(current_stage), exceptions(std::uncaught_exceptions()) {
+    current_stage = stage;
+    record_event(FlightEventType::enter, 0, detail.c_str());
+    start = get_time();
+}
+
+/**
+ * Records how long the stage took, and whether it ended by throwing, then returns to the previous stage
+ */
+StageScope::~StageScope() {
+    record_event(FlightEventType::leave, 0, std::uncaught_exceptions() > exceptions ? "unwound" : "",
+                 get_time() - start);
+    current_stage = previous;
+}
+
+/**
+ * Gets the stage this thread is in
+ *
+ * @return current stage
+ */
+Stage get_current_stage() {
+    return current_stage;
+}
+
+/**
+ * Gets the name of a stage
+ *
+ * @param [in] stage stage
+ * @return name, e.g. "modify_svg_hourly"
+ */
+const char *get_stage_name(const Stage stage) {
+    return (size_t) stage < sizeof(stage_names) / sizeof(stage_names[0]) ? stage_names[(size_t) stage] : "unknown";
+}
+
+/**
+ * Appends a number to a buffer without allocating, so it can be used from signal handlers
+ *
+ * @param [in,out] buffer buffer to append to
+ * @param [in,out] length length of text in buffer
+ * @param [in] number number to append
+ * @param [in] digits pad with zeros to at least this many digits
+ */
+static void append_number(char *buffer, size_t & length, int64_t number, const int digits = 1) {
+    if (number < 0) {
+        buffer[length++] = '-';
+        number = -number;
+    }
+    char reversed[24];
+    int count = 0;
+    do {
+        reversed[count++] = (char) ('0' + number % 10);
+        number /= 10;
+    } while (number > 0 || count < digits);
+    while (count > 0) {
+        buffer[length++] = reversed[--count];
+    }
+}
+
+/**
+ * Appends a string to a buffer without allocating
+ *
+ * @param [in,out] buffer buffer to append to
+ * @param [in,out] length length of text in buffer
+ * @param [in] text null terminated string to append
+ */
+static void append_text(char *buffer, size_t & length, const char *text) {
+    size_t text_length = strlen(text);
+    memcpy(buffer + length, text, text_length);
+    length += text_length;
+}
+
+/**
+ * Writes every event still in the ring to the dump file, oldest first, replacing it in one step
+ * Only uses async-signal-safe calls, so it can run from a signal handler while other threads keep recording;
+ * events overwritten or half written while dumping are left out
+ * Each line is "<sequence> <unix time> <thread> <stage> <type> <value> <duration us> <detail>"
+ *
+ * @return true if the dump was written
+ */
+bool dump_flight_recorder() {
+    if (dump_path[0] == '\0') {
+        return false;
+    }
+    int fd = open(dump_tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool written = true;
+    uint64_t end = next_event.load(std::memory_order_acquire);
+    for (uint64_t index = end > ring_size ? end - ring_size : 0; index < end && written; index++) {
+        const FlightEvent & slot = ring[index & (ring_size - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != index + 1) {
+            continue;
+        }
+        int64_t time = slot.time;
+        int64_t value = slot.value;
+        int64_t duration = slot.duration;
+        uint32_t thread = slot.thread;
+        auto type = (size_t) slot.type;
+        Stage stage = slot.stage;
+        char detail[sizeof(slot.detail)];
+        memcpy(detail, slot.detail, sizeof(detail));
+        detail[sizeof(detail) - 1] = '\0';
+        for (char & c : detail) {
+            c = c == '\n' || c == '\r' ? ' ' : c;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != index + 1) {
+            continue;
+        }
+
+        char line[256];
+        size_t length = 0;
+        append_number(line, length, (int64_t) index);
+        line[length++] = ' ';
+        append_number(line, length, time / 1000000000);
+        line[length++] = '.';
+        append_number(line, length, time % 1000000000, 9);
+        line[length++] = ' ';
+        append_number(line, length, thread);
+        line[length++] = ' ';
+        append_text(line, length, get_stage_name(stage));
+        line[length++] = ' ';
+        append_text(line, length, type < sizeof(type_names) / sizeof(type_names[0]) ? type_names[type] : "unknown");
+        line[length++] = ' ';
+        append_number(line, length, value);
+        line[length++] = ' ';
+        append_number(line, length, duration / 1000);
+        line[length++] = ' ';
+        append_text(line, length, detail);
+        line[length++] = '\n';
+        written = write(fd, line, length) == (ssize_t) length;
+    }
+    written = close(fd) == 0 && written;
+    return written && rename(dump_tmp_path, dump_path) == 0;
+}
+
+/**
+ * Dumps the ring when a signal arrives
+ * Fatal signals are handled once, then the default action runs (e.g. a core dump) as the faulting code resumes
+ *
+ * @param [in] signal signal number
+ */
+static void handle_signal(const int signal) {
+    int saved_errno = errno;
+    dump_flight_recorder();
+    errno = saved_errno;
+    (void) signal;
+}
+
+/**
+ * Records why the program is about to terminate, then aborts, which dumps the ring
+ */
+static void handle_terminate() {
+    try {
+        std::exception_ptr exception = std::current_exception();
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        record_event(FlightEventType::error, 0, "terminate called without an exception");
+    } catch (std::exception &e) {
+        record_event(FlightEventType::error, 0, (std::string("terminate: ") + e.what()).c_str());
+        std::cerr << "terminate called after throwing: " << e.what() << std::endl;
+    } catch (...) {
+        record_event(FlightEventType::error, 0, "terminate called after throwing an unknown exception");
+    }
+    std::abort();
+}
+
+/**
+ * Sets where the ring is dumped to, and dumps it on crashes, uncaught exceptions and SIGUSR1
+ * Events are recorded whether or not this is called
+ *
+ * @param [in] filepath file to dump to (empty to never dump)
+ */
+void install_flight_recorder(const std::string & filepath) {
+    if (filepath.empty() || filepath.size() >= sizeof(dump_path)) {
+        dump_path[0] = '\0';
+        return;
+    }
+    memcpy(dump_path, filepath.c_str(), filepath.size() + 1);
+    memcpy(dump_tmp_path, filepath.c_str(), filepath.size());
+    memcpy(dump_tmp_path + filepath.size(), ".tmp", 5);
+
+    struct sigaction action{};
+    action.sa_handler = handle_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+    action.sa_flags = SA_RESETHAND;
+    for (int signal : fatal_signals) {
+        sigaction(signal, &action, nullptr);
+    }
+    std::set_terminate(handle_terminate);
+}
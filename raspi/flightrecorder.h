@@ -0,0 +1,64 @@
+#ifndef NOOK_WEATHER_FLIGHTRECORDER_H
+#define NOOK_WEATHER_FLIGHTRECORDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// What a thread is working on; also used to tag profiler samples
+enum class Stage : uint8_t {
+    idle,
+    fetch,
+    decode,
+    render,
+    modify_svg_date,
+    modify_svg_current,
+    modify_svg_precipitation,
+    modify_svg_hourly,
+    modify_svg_daily,
+    modify_svg_alerts,
+    optimize_svg,
+    serialize,
+    rasterize,
+    publish,
+    count                                   // Number of stages, not a stage
+};
+
+enum class FlightEventType : uint8_t {
+    enter,                                  // Stage started
+    leave,                                  // Stage finished  (duration set, detail "unwound" if it threw)
+    http,                                   // Transfer finished  (value is HTTP status, 0 if none)
+    anomaly,                                // Unexpected data that was worked around
+    error                                   // Failure  (detail is the error message)
+};
+
+struct alignas(64) FlightEvent {
+    std::atomic<uint64_t> sequence;         // Index of event + 1 once written, 0 while being written
+    int64_t time;                           // Units: nanoseconds since Unix epoch
+    int64_t value;                          // Meaning depends on type
+    int64_t duration;                       // Units: nanoseconds  (0 if not timed)
+    uint32_t thread;                        // Kernel thread id
+    FlightEventType type;
+    Stage stage;                            // Stage of the recording thread
+    char detail[90];                        // Null terminated, cut short if too long
+};
+
+class StageScope {
+public:
+    explicit StageScope(Stage stage, const std::string & detail = "");  // Enter a stage on this thread
+    ~StageScope();                                                      // Return to the previous stage
+    StageScope(const StageScope &) = delete;
+    StageScope & operator=(const StageScope &) = delete;
+private:
+    Stage previous;
+    int64_t start;                          // Units: nanoseconds since Unix epoch
+    int exceptions;                         // Exceptions in flight when the stage started
+};
+
+void record_event(FlightEventType type, int64_t value, const char *detail, int64_t duration = 0);
+Stage get_current_stage();
+const char *get_stage_name(Stage stage);
+void install_flight_recorder(const std::string & filepath);     // Dump on fatal signals, SIGUSR1 and terminate
+bool dump_flight_recorder();                                    // Write every event still in the ring
+
+#endif //NOOK_WEATHER_FLIGHTRECORDER_H
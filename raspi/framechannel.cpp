@@ -0,0 +1,264 @@
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "framechannel.h"
+
+// Segment layout: FrameSegment, then two buffers of capacity bytes each, starting on a cache line
+static const uint64_t frame_magic = 0x454d4152464b4f4f;  // "NOOKFRAME" cut to 8 bytes
+static const uint32_t frame_version = 1;
+static const size_t buffers_offset = (sizeof(FrameSegment) + 63) / 64 * 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "sequence must be lock free to be shared between processes");
+
+/**
+ * Gets the POSIX shared memory name for a display profile
+ *
+ * @param [in] name display profile name
+ * @return shared memory name, e.g. "/nook-weather-kindle"
+ */
+std::string FrameChannel::get_segment_name(const std::string & name) {
+    std::string segment_name = "/nook-weather-" + name;
+    for (size_t i = 1; i < segment_name.size(); i++) {
+        if (segment_name[i] == '/') {
+            segment_name[i] = '_';
+        }
+    }
+    return segment_name;
+}
+
+/**
+ * Creates a profile's shared memory segment, or reuses it if it already has the same layout so readers see frame
+ * numbers keep counting up across restarts
+ *
+ * @param [in] name display profile name
+ * @param [in] capacity largest frame in bytes
+ */
+FrameChannel::FrameChannel(const std::string & name, const uint32_t capacity) {
+    std::string segment_name = get_segment_name(name);
+    int fd = shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open shared memory " + segment_name);
+    }
+    mapped_size = buffers_offset + 2 * (size_t) capacity;
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, (off_t) mapped_size) == 0) {
+        memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("Failed to map shared memory " + segment_name);
+    }
+    segment = (FrameSegment *) memory;
+    buffers = (char *) memory + buffers_offset;
+
+    if (segment->magic != frame_magic || segment->version != frame_version || segment->capacity != capacity) {
+        segment->magic = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        segment->sequence.store(0, std::memory_order_relaxed);
+        memset(segment->slots, 0, sizeof(segment->slots));
+        segment->version = frame_version;
+        segment->capacity = capacity;
+        std::atomic_thread_fence(std::memory_order_release);
+        segment->magic = frame_magic;
+    }
+}
+
+FrameChannel::~FrameChannel() {
+    if (segment) {
+        munmap(segment, mapped_size);
+    }
+}
+
+/**
+ * Gets the shared channel for a display profile, creating its segment on first use
+ *
+ * @param [in] name display profile name
+ * @param [in] capacity largest frame in bytes
+ * @return channel
+ */
+std::shared_ptr<FrameChannel> FrameChannel::get_instance(const std::string & name, const uint32_t capacity) {
+    static std::mutex instances_mutex;
+    static std::map<std::string, std::shared_ptr<FrameChannel>> instances;
+
+    std::lock_guard<std::mutex> lock(instances_mutex);
+    std::shared_ptr<FrameChannel> & instance = instances[name];
+    if (!instance) {
+        instance = std::make_shared<FrameChannel>(name, capacity);
+    }
+    return instance;
+}
+
+/**
+ * Works out which parts of the frame changed by comparing each top-level group of the svg with the last frame's
+ * Groups are matched by their data-bounds attribute ("x y width height"), which is also the rect they damage;
+ * the whole frame is damaged if a group without bounds changed, or groups were added or removed
+ *
+ * @param [in] svg_file path to the svg the frame was rendered from
+ * @return rects that changed, or none if the whole frame did
+ */
+std::vector<DamageRect> FrameChannel::get_damage(const std::string & svg_file) {
+    xmlDocPtr doc = xmlReadFile(svg_file.c_str(), nullptr, XML_PARSE_NOBLANKS | XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+    xmlNodePtr root = doc ? xmlDocGetRootElement(doc) : nullptr;
+    if (root == nullptr) {
+        xmlFreeDoc(doc);
+        groups.clear();
+        return {};
+    }
+
+    std::map<std::string, size_t> hashes;
+    xmlBufferPtr buffer = xmlBufferCreate();
+    size_t position = 0;
+    for (xmlNodePtr node = root->children; node; node = node->next, position++) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        xmlChar *bounds = xmlGetProp(node, (xmlChar *) "data-bounds");
+        std::string key = bounds ? (char *) bounds : "#" + std::to_string(position);
+        xmlFree(bounds);
+
+        xmlBufferEmpty(buffer);
+        xmlNodeDump(buffer, doc, node, 0, 0);
+        hashes[key] = std::hash<std::string>()(std::string((char *) xmlBufferContent(buffer),
+                                                           (size_t) xmlBufferLength(buffer)));
+    }
+    xmlBufferFree(buffer);
+    xmlFreeDoc(doc);
+
+    std::vector<DamageRect> damage;
+    bool whole = hashes.size() != groups.size();
+    for (auto group = hashes.begin(); group != hashes.end() && !whole; group++) {
+        auto previous = groups.find(group->first);
+        if (previous == groups.end()) {
+            whole = true;
+        } else if (previous->second != group->second) {
+            DamageRect rect{};
+            std::stringstream bounds(group->first);
+            whole = group->first[0] == '#' || !(bounds >> rect.x >> rect.y >> rect.width >> rect.height)
+                    || damage.size() == max_damage_rects;
+            damage.push_back(rect);
+        }
+    }
+    groups = std::move(hashes);
+    if (whole) {
+        damage.clear();
+    }
+    return damage;
+}
+
+/**
+ * Publishes a frame to readers
+ * The frame is written into the buffer readers aren't using, then the sequence moves on to point them at it;
+ * the sequence is odd while the buffer is written, and frames that are the same as the latest are skipped
+ *
+ * @param [in] image frame contents (the png or svg displays are sent)
+ * @param [in] svg_file path to the svg the frame was rendered from, to work out damage
+ * @return false if the frame is larger than the buffers
+ */
+bool FrameChannel::publish(const std::string & image, const std::string & svg_file) {
+    if (image.size() > segment->capacity) {
+        return false;
+    }
+    uint64_t fingerprint = std::hash<std::string>()(image);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t sequence = segment->sequence.load(std::memory_order_relaxed);
+    if (sequence >= 2 && sequence % 2 == 0 && segment->slots[sequence / 2 % 2].fingerprint == fingerprint) {
+        return true;
+    }
+    std::vector<DamageRect> damage = get_damage(svg_file);
+
+    uint64_t number = sequence / 2 + 1;
+    segment->sequence.store(number * 2 - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    FrameSlot & slot = segment->slots[number % 2];
+    slot.timestamp = std::time(nullptr);
+    slot.fingerprint = fingerprint;
+    slot.number = number;
+    slot.size = (uint32_t) image.size();
+    slot.damage_count = (uint32_t) damage.size();
+    std::copy(damage.begin(), damage.end(), slot.damage);
+    memcpy(buffers + number % 2 * segment->capacity, image.data(), image.size());
+
+    segment->sequence.store(number * 2, std::memory_order_release);
+    return true;
+}
+
+/**
+ * Maps a display profile's frames read only
+ *
+ * @param [in] name display profile name
+ */
+FrameReader::FrameReader(const std::string & name) {
+    std::string segment_name = FrameChannel::get_segment_name(name);
+    int fd = shm_open(segment_name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("No frames published for " + name);
+    }
+    struct stat status{};
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && (size_t) status.st_size >= buffers_offset) {
+        mapped_size = (size_t) status.st_size;
+        memory = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("Failed to map shared memory " + segment_name);
+    }
+    segment = (const FrameSegment *) memory;
+    buffers = (const char *) memory + buffers_offset;
+}
+
+FrameReader::~FrameReader() {
+    if (segment) {
+        munmap((void *) segment, mapped_size);
+    }
+}
+
+/**
+ * Gets the latest frame without copying its contents
+ * The contents stay in place until two more frames are published; check is_valid after using them
+ *
+ * @param [out] view latest frame
+ * @return false if there is no frame yet, or the segment was recreated with a different layout
+ */
+bool FrameReader::read(FrameView & view) const {
+    while (true) {
+        if (segment->magic != frame_magic || segment->version != frame_version
+            || buffers_offset + 2 * (size_t) segment->capacity > mapped_size) {
+            return false;
+        }
+        uint64_t sequence = segment->sequence.load(std::memory_order_acquire);
+        uint64_t number = sequence / 2;
+        if (number == 0) {
+            return false;
+        }
+        view.slot = segment->slots[number % 2];
+        view.data = buffers + number % 2 * segment->capacity;
+        if (view.slot.number == number && is_valid(view)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * Checks that a frame's contents weren't overwritten while they were being used
+ * A frame's buffer is next written when the frame two after it is, which makes the sequence 2 * number + 3
+ *
+ * @param [in] view frame from read
+ * @return true if everything read from the frame so far is intact
+ */
+bool FrameReader::is_valid(const FrameView & view) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return segment->sequence.load(std::memory_order_relaxed) <= 2 * view.slot.number + 2;
+}
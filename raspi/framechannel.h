@@ -0,0 +1,76 @@
+#ifndef NOOK_WEATHER_FRAMECHANNEL_H
+#define NOOK_WEATHER_FRAMECHANNEL_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static const uint32_t max_damage_rects = 16;
+
+struct DamageRect {
+    int32_t x;                              // Units: svg user units
+    int32_t y;                              // Units: svg user units
+    int32_t width;                          // Units: svg user units
+    int32_t height;                         // Units: svg user units
+};
+
+// Everything in shared memory is fixed size and has no pointers, so any process can map it anywhere
+struct FrameSlot {
+    int64_t timestamp;                      // Units: Unix time  (when the frame was published)
+    uint64_t fingerprint;                   // Hash of frame contents
+    uint64_t number;                        // Frames published before and including this one
+    uint32_t size;                          // Units: bytes
+    uint32_t damage_count;                  // Rects that changed since the last frame (0 if the whole frame did)
+    DamageRect damage[max_damage_rects];
+};
+
+struct FrameSegment {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t capacity;                      // Units: bytes of each buffer
+    std::atomic<uint64_t> sequence;         // Twice the latest frame number, plus one while the next is written
+    FrameSlot slots[2];                     // Frame n is in slot and buffer n % 2
+};
+
+struct FrameView {
+    FrameSlot slot;                         // Copy of the frame's metadata
+    const char *data;                       // Frame contents, in the shared mapping
+};
+
+class FrameChannel {
+public:
+    FrameChannel(const std::string & name, uint32_t capacity);     // Create or reuse a segment
+    ~FrameChannel();
+    FrameChannel(const FrameChannel &) = delete;
+    FrameChannel & operator=(const FrameChannel &) = delete;
+    static std::shared_ptr<FrameChannel> get_instance(const std::string & name, uint32_t capacity);
+    static std::string get_segment_name(const std::string & name);  // POSIX shm name for a display profile
+    bool publish(const std::string & image, const std::string & svg_file);  // Publish a frame, false if too big
+private:
+    FrameSegment *segment = nullptr;
+    char *buffers = nullptr;                // Start of the two frame buffers
+    size_t mapped_size = 0;
+    std::mutex mutex;
+    std::map<std::string, size_t> groups;   // Hash of each top-level group in the last frame, keyed by its bounds
+    std::vector<DamageRect> get_damage(const std::string & svg_file);
+};
+
+class FrameReader {
+public:
+    explicit FrameReader(const std::string & name);                 // Map a profile's segment read only
+    ~FrameReader();
+    FrameReader(const FrameReader &) = delete;
+    FrameReader & operator=(const FrameReader &) = delete;
+    bool read(FrameView & view) const;      // Latest frame, false if there is none yet
+    bool is_valid(const FrameView & view) const;  // Whether a frame's contents haven't been overwritten since
+private:
+    const FrameSegment *segment = nullptr;
+    const char *buffers = nullptr;
+    size_t mapped_size = 0;
+};
+
+#endif //NOOK_WEATHER_FRAMECHANNEL_H
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gazetteer.h"
+
+// Index layout: header, places sorted by latitude, keys sorted by normalized name, then the strings they point to
+static const uint64_t gazetteer_magic = 0x5a4147454b4f4f4e;  // "NOOKEGAZ"
+static const uint32_t gazetteer_version = 1;
+
+/**
+ * Normalizes a place name for matching: lower case, single spaces, no leading or trailing spaces
+ *
+ * @param [in] name place name
+ * @return normalized name
+ */
+static std::string normalize(const std::string & name) {
+    std::string normalized;
+    for (const char c : name) {
+        if (std::isspace((unsigned char) c)) {
+            if (!normalized.empty() && normalized.back() != ' ') {
+                normalized += ' ';
+            }
+        } else {
+            normalized += (char) std::tolower((unsigned char) c);
+        }
+    }
+    if (!normalized.empty() && normalized.back() == ' ') {
+        normalized.pop_back();
+    }
+    return normalized;
+}
+
+/**
+ * Gets the edit distance between two strings, giving up once it is over a limit
+ *
+ * @param [in] a first string
+ * @param [in] b second string
+ * @param [in] limit largest distance of interest
+ * @return edit distance, or limit + 1 if it is over the limit
+ */
+static size_t edit_distance(const std::string_view a, const std::string_view b, const size_t limit) {
+    if ((a.size() > b.size() ? a.size() - b.size() : b.size() - a.size()) > limit) {
+        return limit + 1;
+    }
+    std::vector<size_t> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        size_t diagonal = row[0];
+        row[0] = i;
+        size_t row_min = row[0];
+        for (size_t j = 1; j <= b.size(); j++) {
+            size_t above = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+            diagonal = above;
+            row_min = std::min(row_min, row[j]);
+        }
+        if (row_min > limit) {
+            return limit + 1;
+        }
+    }
+    return row[b.size()];
+}
+
+/**
+ * Maps a gazetteer index file, checking every record points inside the file
+ *
+ * @param [in] filepath path to index built by Gazetteer::build
+ */
+Gazetteer::Gazetteer(const std::string & filepath) {
+    fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open gazetteer file");
+    }
+    struct stat file_stat{};
+    fstat(fd, &file_stat);
+    mapped_size = file_stat.st_size;
+    if (mapped_size < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error("Invalid gazetteer file");
+    }
+
+    void *mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map gazetteer file");
+    }
+    header = (const Header *) mapped;
+    places = (const PlaceRecord *) ((const char *) mapped + sizeof(Header));
+    keys = (const KeyRecord *) (places + header->place_count);
+    strings = (const char *) (keys + header->key_count);
+
+    bool valid = header->magic == gazetteer_magic && header->version == gazetteer_version
+                 && mapped_size == sizeof(Header) + (size_t) header->place_count * sizeof(PlaceRecord)
+                                   + (size_t) header->key_count * sizeof(KeyRecord) + header->string_size;
+    for (uint32_t i = 0; valid && i < header->place_count; i++) {
+        valid = (size_t) places[i].name + places[i].name_length <= header->string_size;
+    }
+    for (uint32_t i = 0; valid && i < header->key_count; i++) {
+        valid = (size_t) keys[i].key + keys[i].key_length <= header->string_size && keys[i].place < header->place_count;
+    }
+    if (!valid) {
+        munmap(mapped, mapped_size);
+        close(fd);
+        throw std::runtime_error("Invalid gazetteer file");
+    }
+}
+
+Gazetteer::~Gazetteer() {
+    munmap((void *) header, mapped_size);
+    close(fd);
+}
+
+/**
+ * Gets the normalized name of a key
+ *
+ * @param [in] key key record
+ * @return view into the mapped file
+ */
+std::string_view Gazetteer::get_key(const KeyRecord & key) const {
+    return std::string_view(strings + key.key, key.key_length);
+}
+
+/**
+ * Gets a place by its index
+ *
+ * @param [in] index index into places
+ * @return place
+ */
+Place Gazetteer::get_place(const uint32_t index) const {
+    const PlaceRecord & record = places[index];
+    return Place{std::string(strings + record.name, record.name_length), std::string(record.country, 2),
+                 record.lat, record.lon, record.population};
+}
+
+/**
+ * Picks the largest place in a range of keys, only counting places in a country if one is given
+ *
+ * @param [in] begin first key
+ * @param [in] end one past last key
+ * @param [in] country country code, or an empty string for any country
+ * @return best key, or nullptr if none match
+ */
+const Gazetteer::KeyRecord *Gazetteer::find_best(const KeyRecord *begin, const KeyRecord *end,
+                                                  const std::string & country) const {
+    const KeyRecord *best = nullptr;
+    for (const KeyRecord *key = begin; key != end; key++) {
+        const PlaceRecord & place = places[key->place];
+        if (!country.empty() && std::strncmp(place.country, country.c_str(), 2) != 0) {
+            continue;
+        }
+        if (best == nullptr || place.population > places[best->place].population) {
+            best = key;
+        }
+    }
+    return best;
+}
+
+/**
+ * Resolves a place name, trying an exact match, then a prefix, then names with a typo or two
+ * Ties go to the place with the largest population
+ *
+ * @param [in] query place name, optionally followed by a comma and a country code, e.g. "Portland, US"
+ * @return place
+ */
+Place Gazetteer::lookup(const std::string & query) const {
+    std::string name = query;
+    std::string country;
+    size_t comma = query.rfind(',');
+    if (comma != std::string::npos) {
+        name = query.substr(0, comma);
+        country = normalize(query.substr(comma + 1));
+        std::transform(country.begin(), country.end(), country.begin(), ::toupper);
+        if (country.size() != 2) {
+            throw std::runtime_error("Country in " + query + " should be a two letter code");
+        }
+    }
+    std::string key = normalize(name);
+    if (key.empty()) {
+        throw std::runtime_error("Empty place name");
+    }
+
+    auto less = [this](const KeyRecord & record, const std::string_view value) { return get_key(record) < value; };
+    const KeyRecord *keys_end = keys + header->key_count;
+
+    // Exact match
+    const KeyRecord *begin = std::lower_bound(keys, keys_end, key, less);
+    const KeyRecord *end = begin;
+    while (end != keys_end && get_key(*end) == key) {
+        end++;
+    }
+    const KeyRecord *best = find_best(begin, end, country);
+
+    // Names starting with query
+    if (best == nullptr) {
+        end = std::lower_bound(begin, keys_end, key + '\xff', less);
+        best = find_best(begin, end, country);
+    }
+
+    // Names a typo or two away, checking ones with the same first letter before the rest
+    if (best == nullptr) {
+        const size_t limit = key.size() < 5 ? 1 : 2;
+        size_t best_distance = limit + 1;
+        const KeyRecord *letter_begin = std::lower_bound(keys, keys_end, key.substr(0, 1), less);
+        const KeyRecord *letter_end = std::lower_bound(letter_begin, keys_end, key.substr(0, 1) + '\xff', less);
+        for (int pass = 0; pass < 2 && best == nullptr; pass++) {
+            const KeyRecord *from = pass == 0 ? letter_begin : keys;
+            const KeyRecord *to = pass == 0 ? letter_end : keys_end;
+            for (const KeyRecord *record = from; record != to; record++) {
+                const PlaceRecord & place = places[record->place];
+                if (!country.empty() && std::strncmp(place.country, country.c_str(), 2) != 0) {
+                    continue;
+                }
+                size_t distance = edit_distance(get_key(*record), key, limit);
+                if (distance < best_distance
+                    || (distance == best_distance && best && place.population > places[best->place].population)) {
+                    best = record;
+                    best_distance = distance;
+                }
+            }
+        }
+    }
+
+    if (best == nullptr) {
+        throw std::runtime_error("Unknown place " + query);
+    }
+    return get_place(best->place);
+}
+
+/**
+ * Gets the largest places whose names start with a prefix, for suggesting completions
+ *
+ * @param [in] prefix start of place name
+ * @param [in] limit most places to return
+ * @return places, largest population first
+ */
+std::vector<Place> Gazetteer::complete(const std::string & prefix, const size_t limit) const {
+    std::string key = normalize(prefix);
+    auto less = [this](const KeyRecord & record, const std::string_view value) { return get_key(record) < value; };
+    const KeyRecord *begin = std::lower_bound(keys, keys + header->key_count, key, less);
+    const KeyRecord *end = std::lower_bound(begin, keys + header->key_count, key + '\xff', less);
+
+    std::vector<uint32_t> matches;
+    for (const KeyRecord *record = begin; record != end; record++) {
+        matches.push_back(record->place);
+    }
+    std::sort(matches.begin(), matches.end(), [this](const uint32_t a, const uint32_t b) {
+        return places[a].population != places[b].population ? places[a].population > places[b].population : a < b;
+    });
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
+    std::vector<Place> completions;
+    for (size_t i = 0; i < std::min(limit, matches.size()); i++) {
+        completions.push_back(get_place(matches[i]));
+    }
+    return completions;
+}
+
+/**
+ * Finds the nearest place to a point, for naming a location given by coordinates
+ *
+ * @param [in] lat latitude of point
+ * @param [in] lon longitude of point
+ * @param [in] max_distance furthest place to consider, in km
+ * @return nearest place, or a place with an empty name if there are none in range
+ */
+Place Gazetteer::find_nearest(const double lat, const double lon, const double max_distance) const {
+    const double km_per_degree = 111.2;
+    const double band = max_distance / km_per_degree;
+    auto less = [](const PlaceRecord & record, const double value) { return record.lat < value; };
+    const PlaceRecord *begin = std::lower_bound(places, places + header->place_count, lat - band, less);
+
+    // Equirectangular distance is accurate enough over tens of km
+    double best_distance = max_distance * max_distance;
+    const PlaceRecord *best = nullptr;
+    for (const PlaceRecord *place = begin; place != places + header->place_count && place->lat <= lat + band; place++) {
+        double dlon = std::remainder(place->lon - lon, 360.0) * std::cos(lat * M_PI / 180);
+        double dlat = place->lat - lat;
+        double distance = (dlat * dlat + dlon * dlon) * km_per_degree * km_per_degree;
+        if (distance <= best_distance) {
+            best_distance = distance;
+            best = place;
+        }
+    }
+    if (best == nullptr) {
+        return Place{"", "", lat, lon, 0};
+    }
+    return get_place((uint32_t) (best - places));
+}
+
+/**
+ * Builds an index from a GeoNames dump (e.g. cities15000.txt from download.geonames.org)
+ * Each place is indexed by its name and its ASCII name
+ *
+ * @param [in] tsv_filepath path to tab-separated GeoNames file
+ * @param [in] filepath path to write index to
+ */
+void Gazetteer::build(const std::string & tsv_filepath, const std::string & filepath) {
+    std::ifstream tsv(tsv_filepath);
+    if (!tsv) {
+        throw std::runtime_error("Failed to read GeoNames file");
+    }
+
+    struct Entry {
+        std::string name;
+        std::string ascii_name;
+        std::string country;
+        float lat;
+        float lon;
+        uint32_t population;
+    };
+    std::vector<Entry> entries;
+    std::string line;
+    while (std::getline(tsv, line)) {
+        // Columns: geonameid, name, asciiname, alternatenames, latitude, longitude, feature class, feature code,
+        // country code, cc2, admin1-4, population, ...
+        std::vector<std::string> fields;
+        std::stringstream line_stream(line);
+        std::string field;
+        while (std::getline(line_stream, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 15 || fields[8].size() != 2 || fields[1].empty() || fields[1].size() > UINT16_MAX) {
+            continue;
+        }
+        try {
+            entries.push_back(Entry{fields[1], fields[2], fields[8], std::stof(fields[4]), std::stof(fields[5]),
+                                    (uint32_t) std::stoul(fields[14].empty() ? "0" : fields[14])});
+        } catch (std::logic_error &e) {
+            continue;
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) { return a.lat < b.lat; });
+
+    // Lay out strings and records
+    std::string string_data;
+    std::vector<PlaceRecord> place_records;
+    std::vector<std::pair<std::string, uint32_t>> key_entries;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        const Entry & entry = entries[i];
+        PlaceRecord record{entry.lat, entry.lon, entry.population, (uint32_t) string_data.size(),
+                           (uint16_t) entry.name.size(), {entry.country[0], entry.country[1]}};
+        string_data += entry.name;
+        place_records.push_back(record);
+
+        key_entries.emplace_back(normalize(entry.name), i);
+        std::string ascii_key = normalize(entry.ascii_name);
+        if (!ascii_key.empty() && ascii_key != key_entries.back().first) {
+            key_entries.emplace_back(ascii_key, i);
+        }
+    }
+    std::sort(key_entries.begin(), key_entries.end(), [&entries](const auto & a, const auto & b) {
+        return a.first != b.first ? a.first < b.first : entries[a.second].population > entries[b.second].population;
+    });
+    std::vector<KeyRecord> key_records;
+    for (const auto & key : key_entries) {
+        key_records.push_back(KeyRecord{(uint32_t) string_data.size(), (uint16_t) key.first.size(), 0, key.second});
+        string_data += key.first;
+    }
+
+    // Write to a temporary file and move it into place so readers never see a partial index
+    Header header{gazetteer_magic, gazetteer_version, (uint32_t) place_records.size(),
+                  (uint32_t) key_records.size(), (uint32_t) string_data.size()};
+    std::string tmp_filepath = filepath + ".tmp";
+    std::ofstream file(tmp_filepath, std::ios::binary | std::ios::trunc);
+    file.write((const char *) &header, sizeof(header));
+    file.write((const char *) place_records.data(), (std::streamsize) (place_records.size() * sizeof(PlaceRecord)));
+    file.write((const char *) key_records.data(), (std::streamsize) (key_records.size() * sizeof(KeyRecord)));
+    file.write(string_data.data(), (std::streamsize) string_data.size());
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write gazetteer file");
+    }
+    std::filesystem::rename(tmp_filepath, filepath);
+}
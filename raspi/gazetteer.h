@@ -0,0 +1,60 @@
+#ifndef NOOK_WEATHER_GAZETTEER_H
+#define NOOK_WEATHER_GAZETTEER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Place {
+    std::string name;           // Display name, e.g. "Portland"
+    std::string country;        // ISO 3166 country code, e.g. "US"
+    double lat;                 // Units: degrees
+    double lon;                 // Units: degrees
+    uint32_t population;
+};
+
+class Gazetteer {
+public:
+    explicit Gazetteer(const std::string & filepath);                   // Map index file
+    ~Gazetteer();
+    Gazetteer(const Gazetteer &) = delete;
+    Gazetteer & operator=(const Gazetteer &) = delete;
+    Place lookup(const std::string & query) const;                      // Resolve "City" or "City, CC"
+    std::vector<Place> complete(const std::string & prefix, size_t limit) const;    // Largest places starting with prefix
+    Place find_nearest(double lat, double lon, double max_distance = 50) const;     // Nearest place within max_distance km
+    static void build(const std::string & tsv_filepath, const std::string & filepath);  // Build index from GeoNames dump
+private:
+    struct Header {
+        uint64_t magic;                         // Identifies file as a gazetteer index
+        uint32_t version;                       // File format version
+        uint32_t place_count;
+        uint32_t key_count;
+        uint32_t string_size;                   // Units: bytes
+    };
+    struct PlaceRecord {
+        float lat;                              // Units: degrees
+        float lon;                              // Units: degrees
+        uint32_t population;
+        uint32_t name;                          // Offset of name in strings
+        uint16_t name_length;                   // Units: bytes
+        char country[2];
+    };
+    struct KeyRecord {
+        uint32_t key;                           // Offset of normalized name in strings
+        uint16_t key_length;                    // Units: bytes
+        uint16_t reserved;
+        uint32_t place;                         // Index into places
+    };
+    int fd;
+    size_t mapped_size;                         // Units: bytes
+    const Header *header;
+    const PlaceRecord *places;                  // Sorted by latitude, for reverse lookup
+    const KeyRecord *keys;                      // Sorted by key, then largest population first
+    const char *strings;
+    std::string_view get_key(const KeyRecord & key) const;
+    Place get_place(uint32_t index) const;
+    const KeyRecord *find_best(const KeyRecord *begin, const KeyRecord *end, const std::string & country) const;
+};
+
+#endif //NOOK_WEATHER_GAZETTEER_H
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+
+static const uint64_t history_magic = 0x54534948574b4f4e;  // "NOKWHIST"
+static const uint32_t history_version = 1;
+static const size_t header_size = 64;  // Keeps records aligned and leaves room for new header fields
+
+/**
+ * Opens a history file, creating it if needed
+ * The file is a fixed-size ring of records, so it never grows past its initial size
+ * The ring has one more slot than the records it keeps, so the slot being written is never one a reader can see
+ *
+ * @param [in] filepath path to the history file
+ * @param [in] capacity number of records to keep when creating a new file (ignored for existing files)
+ */
+HistoryStore::HistoryStore(const std::string & filepath, const uint32_t capacity) {
+    static_assert(sizeof(Header) <= header_size, "history header too large");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "history counter must be lock free");
+
+    fd = open(filepath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open history file");
+    }
+
+    // Size new files, otherwise use the capacity they were created with
+    struct stat file_stat{};
+    fstat(fd, &file_stat);
+    bool created = file_stat.st_size == 0;
+    uint32_t file_capacity = capacity + 1;
+    if (created) {
+        if (capacity == 0 || capacity == UINT32_MAX
+            || ftruncate(fd, (off_t) (header_size + (size_t) file_capacity * sizeof(HistoryRecord))) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to create history file");
+        }
+    } else {
+        // Header is magic (2 words), version, record size, capacity
+        uint32_t fields[5];
+        if ((size_t) file_stat.st_size < header_size || pread(fd, fields, sizeof(fields), 0) != sizeof(fields)
+            || fields[4] < 2) {
+            close(fd);
+            throw std::runtime_error("Invalid history file");
+        }
+        file_capacity = fields[4];
+    }
+    mapped_size = header_size + (size_t) file_capacity * sizeof(HistoryRecord);
+
+    // Map file
+    void *mapped = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map history file");
+    }
+    header = (Header *) mapped;
+    records = (HistoryRecord *) ((char *) mapped + header_size);
+
+    // Write header for new files, validate old ones
+    if (created) {
+        header->magic = history_magic;
+        header->version = history_version;
+        header->record_size = sizeof(HistoryRecord);
+        header->capacity = file_capacity;
+        header->written.store(0);
+        msync(mapped, header_size, MS_SYNC);
+    } else if (header->magic != history_magic || header->version != history_version
+               || header->record_size != sizeof(HistoryRecord) || (size_t) file_stat.st_size < mapped_size) {
+        munmap(mapped, mapped_size);
+        close(fd);
+        throw std::runtime_error("Invalid history file");
+    }
+}
+
+HistoryStore::~HistoryStore() {
+    munmap(header, mapped_size);
+    close(fd);
+}
+
+/**
+ * Gets a record by its position counting from the oldest stored record
+ *
+ * @param [in] written value of the written counter the query started from
+ * @param [in] index position of record
+ * @return stored record
+ */
+const HistoryRecord & HistoryStore::get_record(const uint64_t written, const uint64_t index) const {
+    uint64_t oldest = written - std::min(written, (uint64_t) header->capacity - 1);
+    return records[(oldest + index) % header->capacity];
+}
+
+/**
+ * Gets number of stored records
+ *
+ * @return number of records, at most the capacity the file was created with
+ */
+size_t HistoryStore::size() const {
+    return std::min(header->written.load(std::memory_order_acquire), (uint64_t) header->capacity - 1);
+}
+
+/**
+ * Records observed conditions
+ *
+ * @param [in] current current weather conditions
+ * @return true if recorded, false if it is not newer than the last record
+ */
+bool HistoryStore::append(const CurrentWeather & current) {
+    return append(HistoryRecord{current.timestamp, (float) current.temp, (float) current.feels_like,
+                                (float) current.humidity, (float) current.wind.get_wind_speed(),
+                                (float) current.uvi.get_number(), current.aqi.get_number()});
+}
+
+/**
+ * Records a single record
+ * The record goes in the spare slot past the newest and is flushed before the counter that makes it visible, so
+ * neither a reader nor a crash ever sees a torn record
+ *
+ * @param [in] record record to append
+ * @return true if recorded, false if it is not newer than the last record
+ */
+bool HistoryStore::append(const HistoryRecord & record) {
+    // Keep records in time order so range queries can binary search
+    uint64_t written = header->written.load(std::memory_order_relaxed);
+    if (written > 0 && get_record(written, std::min(written, (uint64_t) header->capacity - 1) - 1).timestamp
+                       >= record.timestamp) {
+        return false;
+    }
+
+    // Write record into the spare slot; publishing it hides the oldest, whose slot becomes the spare
+    HistoryRecord *slot = &records[written % header->capacity];
+    *slot = record;
+
+    // Flush record, then publish it
+    long page_size = sysconf(_SC_PAGESIZE);
+    auto page_start = (uintptr_t) slot & ~(uintptr_t) (page_size - 1);
+    msync((void *) page_start, (uintptr_t) (slot + 1) - page_start, MS_SYNC);
+    header->written.store(written + 1, std::memory_order_release);
+    msync(header, header_size, MS_ASYNC);
+    return true;
+}
+
+/**
+ * Gets records in a time range
+ *
+ * @param [in] start start of range (inclusive) as unix time
+ * @param [in] end end of range (exclusive) as unix time
+ * @return records in range, oldest first
+ */
+std::vector<HistoryRecord> HistoryStore::get_range(const int64_t start, const int64_t end) const {
+    std::vector<HistoryRecord> range;
+    while (true) {
+        // Every read indexes from the same count, so an append part way through can't shift the records seen
+        uint64_t written = header->written.load(std::memory_order_acquire);
+        size_t count = std::min(written, (uint64_t) header->capacity - 1);
+
+        // Binary search for first record in range
+        size_t low = 0;
+        size_t high = count;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (get_record(written, mid).timestamp < start) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        // Copy until end of range
+        range.clear();
+        for (size_t i = low; i < count && get_record(written, i).timestamp < end; i++) {
+            range.push_back(get_record(written, i));
+        }
+
+        // An append only writes the spare slot, but one published during the copy means the next may already be
+        // overwriting the oldest record, so start again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->written.load(std::memory_order_relaxed) == written) {
+            return range;
+        }
+    }
+}
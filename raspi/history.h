@@ -0,0 +1,46 @@
+#ifndef NOOK_WEATHER_HISTORY_H
+#define NOOK_WEATHER_HISTORY_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "weathertypes.h"
+
+struct HistoryRecord {
+    int64_t timestamp;      // Units: Unix time
+    float temp;             // Units: degrees Celsius
+    float feels_like;       // Units: degrees Celsius
+    float humidity;         // Units: 0 (0%) - 1 (100%)
+    float wind_speed;       // Units: m/s
+    float uvi;              // Units: UV index
+    int32_t aqi;            // Units: AQI (not standardized)
+};
+
+class HistoryStore {
+public:
+    explicit HistoryStore(const std::string & filepath, uint32_t capacity = 8760);  // Open or create history file
+    ~HistoryStore();
+    HistoryStore(const HistoryStore &) = delete;
+    HistoryStore & operator=(const HistoryStore &) = delete;
+    bool append(const CurrentWeather & current);                                    // Record observed conditions
+    bool append(const HistoryRecord & record);                                      // Record a single record
+    std::vector<HistoryRecord> get_range(int64_t start, int64_t end) const;         // Get records in [start, end)
+    size_t size() const;                                                            // Number of stored records
+private:
+    struct Header {
+        uint64_t magic;                         // Identifies file as a history store
+        uint32_t version;                       // File format version
+        uint32_t record_size;                   // Units: bytes
+        uint32_t capacity;                      // Units: records (one more than are kept)
+        uint32_t reserved;
+        std::atomic<uint64_t> written;          // Total records ever appended, published after the record itself
+    };
+    int fd;
+    size_t mapped_size;                         // Units: bytes
+    Header *header;
+    HistoryRecord *records;
+    const HistoryRecord & get_record(uint64_t written, uint64_t index) const;
+};
+
+#endif //NOOK_WEATHER_HISTORY_H
@@ -0,0 +1,99 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+#include "location.h"
+
+/**
+ * Loads locations from a JSON file
+ * File is a list of objects with key "name" and either "lat" and "lon", or "place" (e.g. "Portland, US") to look
+ * up in the gazetteer, and optionally "sensor" for a local sensor
+ *
+ * @param [in] filepath path to locations file
+ * @param [in] gazetteer gazetteer to look up places in (nullptr if there isn't one)
+ * @return locations, in file order
+ */
+std::vector<Location> load_locations(const std::string & filepath, const Gazetteer *gazetteer) {
+    std::ifstream file(filepath);
+    if (!file) {
+        throw std::runtime_error("Failed to read locations file");
+    }
+    nlohmann::json locations_json = nlohmann::json::parse(file);
+
+    std::vector<Location> locations;
+    for (const nlohmann::json & location_json : locations_json) {
+        Location location;
+        location.name = location_json.at("name");
+        if (location_json.contains("place")) {
+            if (gazetteer == nullptr) {
+                throw std::runtime_error("Looking up places needs a gazetteer file");
+            }
+            Place place = gazetteer->lookup(location_json["place"]);
+            location.lat = place.lat;
+            location.lon = place.lon;
+            location.place = place.name;
+        } else {
+            location.lat = location_json.at("lat");
+            location.lon = location_json.at("lon");
+        }
+        location.sensor = location_json.value("sensor", "");
+
+        // Names end up in filenames
+        if (location.name.empty() || location.name.find('/') != std::string::npos) {
+            throw std::runtime_error("Invalid location name " + location.name);
+        }
+        locations.push_back(location);
+    }
+    return locations;
+}
+
+/**
+ * Names locations that don't have a place name after the nearest place in the gazetteer
+ *
+ * @param [in,out] locations locations to name
+ * @param [in] gazetteer gazetteer to look up coordinates in
+ */
+void name_locations(std::vector<Location> & locations, const Gazetteer & gazetteer) {
+    for (Location & location : locations) {
+        if (location.place.empty()) {
+            location.place = gazetteer.find_nearest(location.lat, location.lon).name;
+        }
+    }
+}
+
+/**
+ * Gets the per-location version of a file by prefixing its name with the location's
+ *
+ * @param [in] filepath path to file
+ * @param [in] location location the file is for
+ * @return path to file for location, unchanged if location has no name
+ */
+std::string get_location_file(const std::string & filepath, const Location & location) {
+    if (location.name.empty() || filepath.empty()) {
+        return filepath;
+    }
+    std::filesystem::path path(filepath);
+    return (path.parent_path() / (location.name + "-" + path.filename().string())).string();
+}
+
+/**
+ * Gets display profiles for a location, renamed so each location's output files are kept apart
+ *
+ * @param [in] profiles display profiles
+ * @param [in] location location to render
+ * @return display profiles for location
+ */
+std::vector<DisplayProfile> get_location_profiles(const std::vector<DisplayProfile> & profiles,
+                                                  const Location & location) {
+    std::vector<DisplayProfile> location_profiles = profiles;
+    for (DisplayProfile & profile : location_profiles) {
+        if (!location.name.empty()) {
+            profile.name = location.name + "-" + profile.name;
+            profile.output_svg = get_location_file(profile.output_svg, location);
+        }
+        profile.place = location.place;
+    }
+    return location_profiles;
+}
@@ -0,0 +1,24 @@
+#ifndef NOOK_WEATHER_LOCATION_H
+#define NOOK_WEATHER_LOCATION_H
+
+#include <string>
+#include <vector>
+
+#include "gazetteer.h"
+#include "profile.h"
+
+struct Location {
+    std::string name;                   // Location name, prefixed to its output files (empty for no prefix)
+    double lat;                         // Units: degrees
+    double lon;                         // Units: degrees
+    std::string place;                  // Place name shown after the date (empty for none)
+    std::string sensor;                 // Local sensor for current conditions, e.g. "iio:<device dir>" (empty for none)
+};
+
+std::vector<Location> load_locations(const std::string & filepath, const Gazetteer *gazetteer);
+void name_locations(std::vector<Location> & locations, const Gazetteer & gazetteer);
+std::string get_location_file(const std::string & filepath, const Location & location);
+std::vector<DisplayProfile> get_location_profiles(const std::vector<DisplayProfile> & profiles,
+                                                  const Location & location);
+
+#endif //NOOK_WEATHER_LOCATION_H
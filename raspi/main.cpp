@@ -1,10 +1,23 @@
+#include <algorithm>
 #include <fstream>
 #include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <thread>
 
+#include <curl/curl.h>
+#include <libxml/parser.h>
 #include <tclap/CmdLine.h>
 
-#include "api-openweathermap.h"
-#include "modifysvg.h"
+#include "arena.h"
+#include "assets.h"
+#include "fetch.h"
+#include "flightrecorder.h"
+#include "pipeline.h"
+#include "prerender.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "soak.h"
 
 // todo rework precipitation icon
 // todo differentiate between rain and snow
@@ -25,7 +38,55 @@ std::string get_apikey(const std::string & filepath) {
     return key;
 }
 
+// Peak memory of each stage of the last refresh
+MemoryReport memory_report;
 
+/**
+ * Fetches weather data and generates the svgs for every location, and works out when to do it again
+ *
+ * @param [in] settings program settings
+ * @param [in] policy refresh policy
+ * @param [in] queue_report print depth of pipeline queues
+ * @return earliest next refresh and every failure
+ */
+PipelineResult refresh(const Settings & settings, const RefreshPolicy & policy, const bool queue_report) {
+    memory_report.start(settings.workers == 1);
+    Pipeline pipeline(settings, policy, memory_report);
+    PipelineResult result = pipeline.run();
+    if (queue_report) {
+        pipeline.print_stats(std::cerr);
+    }
+    return result;
+}
+
+/**
+ * Renders every location from its last snapshot, for the hour it is now, with the latest local sensor readings
+ *
+ * @param [in] settings program settings
+ * @param [in] policy refresh policy
+ */
+void rerender(const Settings & settings, const RefreshPolicy & policy) {
+    for (const Location & location : settings.locations) {
+        std::string snapshot_file = get_location_file(settings.snapshot_file, location);
+        if (!std::filesystem::exists(snapshot_file)) {
+            continue;
+        }
+        try {
+            Forecast forecast = load_snapshot(snapshot_file);
+            Observation observation = read_observation(location.sensor, std::time(nullptr));
+            for (const DisplayProfile & profile : get_location_profiles(settings.profiles, location)) {
+                StageScope stage(Stage::render, profile.name);
+                render_profile(settings, profile, forecast, get_frame_hour(forecast, std::time(nullptr)), observation,
+                               policy);
+                notify_published(settings, profile);
+            }
+        } catch (std::exception &e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            record_event(FlightEventType::error, 0, e.what());
+            dump_flight_recorder();
+        }
+    }
+}
 
 int main(int argc, char *argv[]) {
     try {
@@ -36,34 +97,242 @@ int main(int argc, char *argv[]) {
         TCLAP::CmdLine cmd("Gathers weather information from openweathermap and generates an svg image for use on a Nook Simple Touch",
                            '=',
                            "0.2");
-        TCLAP::ValueArg<double> arg_lat("", "lat", "location latitude", true, 0, "double/float", cmd);
-        TCLAP::ValueArg<double> arg_lon("", "lon", "location longitude", true, 0, "double/float", cmd);
+        TCLAP::ValueArg<double> arg_lat("", "lat", "location latitude", false, 0, "double/float", cmd);
+        TCLAP::ValueArg<double> arg_lon("", "lon", "location longitude", false, 0, "double/float", cmd);
+        TCLAP::ValueArg<std::string> arg_place("", "place", "place to look up in the gazetteer, e.g. \"Portland, US\"", false, "", "string", cmd);
+        TCLAP::ValueArg<std::string> arg_gazetteer("", "gazetteer", "gazetteer index for place lookups", false, path + "gazetteer.bin", "string", cmd);
+        TCLAP::ValueArg<std::string> arg_build_gazetteer("", "build-gazetteer", "build gazetteer index from a GeoNames file and exit", false, "", "string", cmd);
+        TCLAP::ValueArg<std::string> arg_locations("", "locations", "JSON file of named locations to render", false, "", "string", cmd);
         TCLAP::ValueArg<std::string> arg_key("", "key", "api key", false, "", "string", cmd);
+        TCLAP::ValueArg<std::string> arg_refresh_file("", "refresh-file", "file to write next refresh time (unix time) to", false, "", "string", cmd);
+        TCLAP::ValueArg<int> arg_min_interval("", "min-interval", "shortest time between refreshes in seconds", false, 300, "int", cmd);
+        TCLAP::ValueArg<int> arg_max_interval("", "max-interval", "longest time between refreshes in seconds", false, 3600, "int", cmd);
+        TCLAP::ValueArg<int> arg_prerender("", "prerender", "number of hourly frames to pre-render from each fetch", false, 0, "int", cmd);
+        TCLAP::ValueArg<std::string> arg_history_dir("", "history-dir", "directory to keep observed conditions in", false, "", "string", cmd);
+        TCLAP::ValueArg<std::string> arg_snapshot("", "snapshot", "file to save decoded forecast to after each fetch", false, "", "string", cmd);
+        TCLAP::SwitchArg arg_offline("", "offline", "render from the snapshot file instead of fetching", cmd);
+        TCLAP::ValueArg<std::string> arg_profiles("", "profiles", "JSON file of display profiles to render", false, "", "string", cmd);
+        TCLAP::SwitchArg arg_optimize("", "optimize", "shrink generated svg before saving", cmd);
+        TCLAP::SwitchArg arg_low_memory("", "low-memory", "use less memory on small devices", cmd);
+        TCLAP::SwitchArg arg_memory_report("", "memory-report", "print peak memory of each stage", cmd);
+        TCLAP::ValueArg<int> arg_memory_ceiling("", "memory-ceiling", "fail if a refresh peaks above this many MiB", false, 0, "int", cmd);
+        TCLAP::ValueArg<std::string> arg_rasterize("", "rasterize", "shell command to turn $1 (svg) into $2 (png)", false, "", "string", cmd);
+        TCLAP::ValueArg<int> arg_workers("", "workers", "threads for each rendering stage", false, (int) std::max(1u, std::thread::hardware_concurrency()), "int", cmd);
+        TCLAP::SwitchArg arg_queue_report("", "queue-report", "print depth of each pipeline queue", cmd);
+        TCLAP::ValueArg<std::string> arg_sensor("", "sensor", "local sensor for current conditions (file:<path> or iio:<device dir>)", false, "", "string", cmd);
+        TCLAP::ValueArg<double> arg_sensor_blend("", "sensor-blend", "weight of sensor readings against the API, from 0 to 1", false, 1, "double/float", cmd);
+        TCLAP::ValueArg<int> arg_sensor_interval("", "sensor-interval", "seconds between sensor updates in daemon mode", false, 60, "int", cmd);
+        TCLAP::ValueArg<int> arg_soak("", "soak", "render this many times from the snapshot, checking for leaks and slowdowns", false, 0, "int", cmd);
+        TCLAP::ValueArg<int> arg_soak_locations("", "soak-locations", "number of synthetic locations to soak test", false, 1000, "int", cmd);
+        TCLAP::ValueArg<int> arg_soak_window("", "soak-window", "renders between soak test measurements", false, 1000, "int", cmd);
+        TCLAP::ValueArg<int> arg_soak_max_rss("", "soak-max-rss", "fail soak test if rss grows by more than this many MiB", false, 16, "int", cmd);
+        TCLAP::ValueArg<int> arg_soak_max_allocations("", "soak-max-allocations", "fail soak test if this many more libxml2 allocations are live", false, 1000, "int", cmd);
+        TCLAP::ValueArg<double> arg_soak_max_slowdown("", "soak-max-slowdown", "fail soak test if render latency grows by more than this factor", false, 2, "double/float", cmd);
+        TCLAP::ValueArg<int> arg_soak_max_fds("", "soak-max-fds", "fail soak test if this many more files are open", false, 0, "int", cmd);
+        TCLAP::ValueArg<std::string> arg_flight_recorder("", "flight-recorder", "file to dump recent events to on errors, crashes and SIGUSR1 (empty to disable)", false, path + "flight-recorder.txt", "string", cmd);
+        TCLAP::ValueArg<std::string> arg_profile_output("", "profile-output", "file to write folded stacks to when profiling with SIGUSR2 (empty to disable)", false, path + "profile.folded", "string", cmd);
+        TCLAP::SwitchArg arg_profile("", "profile", "profile from start up, as if sent SIGUSR2", cmd);
+        TCLAP::ValueArg<int> arg_profile_seconds("", "profile-seconds", "longest a profile runs before it is written", false, 30, "int", cmd);
+        TCLAP::ValueArg<int> arg_profile_hz("", "profile-hz", "stack samples per second of CPU time when profiling", false, 99, "int", cmd);
+        TCLAP::SwitchArg arg_daemon("", "daemon", "keep running and refresh on the adaptive schedule", cmd);
+        TCLAP::ValueArg<int> arg_notify_port("", "notify-port", "port to serve long-poll requests for new images on in daemon mode", false, 0, "int", cmd);
+        TCLAP::ValueArg<int> arg_notify_timeout("", "notify-timeout", "longest a long-poll request waits for a new image in seconds", false, 300, "int", cmd);
+        TCLAP::SwitchArg arg_shm_frames("", "shm-frames", "also publish each image to shared memory for processes on this machine", cmd);
+        TCLAP::ValueArg<int> arg_shm_frame_size("", "shm-frame-size", "largest image published to shared memory in KiB", false, 2048, "int", cmd);
         // TCLAP::ValueArg<std::string> arg_output("", "output-file", "name of generated svg file", false, "generated.svg", "string", cmd);
 
         // Get variables from user
         cmd.parse(argc, argv);
-        double lat = arg_lat.getValue();
-        double lon = arg_lon.getValue();
-        std::string apikey = arg_key.getValue().empty() ? get_apikey(path + "apikey.txt") : arg_key.getValue();
-        std::string img_dir = path + "img/";
-        std::string template_file = "template.svg";
-        std::string output_file = "generated.svg";
-
-        // Get information from OpenWeatherMap
-        OpenWeatherMap weather_data(lat, lon, apikey);
-        CurrentWeather current_weather = weather_data.get_current();
-        Precipitation precipitation = weather_data.get_precipitation();
-        std::vector<HourlyWeather> hourly = weather_data.get_hourly(12);
-        std::vector<DailyWeather> daily = weather_data.get_daily(5);
-        std::vector<WeatherAlert> alerts = weather_data.get_alerts();
-
-        // Use extracted information to create a svg
-        modify_svg(current_weather, precipitation, hourly, daily, alerts, img_dir, template_file, output_file);
+        install_flight_recorder(arg_flight_recorder.getValue());
+        install_profiler(arg_profile_output.getValue(), arg_profile_hz.getValue(), arg_profile_seconds.getValue());
+        if (arg_profile.getValue()) {
+            start_profiling();
+        }
+
+        // Index a GeoNames dump for offline place lookups
+        if (!arg_build_gazetteer.getValue().empty()) {
+            Gazetteer::build(arg_build_gazetteer.getValue(), arg_gazetteer.getValue());
+            return 0;
+        }
+        std::unique_ptr<Gazetteer> gazetteer;
+        if (std::filesystem::exists(arg_gazetteer.getValue())) {
+            gazetteer = std::make_unique<Gazetteer>(arg_gazetteer.getValue());
+        }
+
+        Settings settings;
+        if (!arg_locations.getValue().empty()) {
+            settings.locations = load_locations(arg_locations.getValue(), gazetteer.get());
+        } else if (!arg_place.getValue().empty()) {
+            if (!gazetteer) {
+                throw TCLAP::ArgException("needs a gazetteer file (see --build-gazetteer)", "place");
+            }
+            Place place = gazetteer->lookup(arg_place.getValue());
+            settings.locations.push_back(Location{"", place.lat, place.lon, place.name, ""});
+        } else if (arg_lat.isSet() && arg_lon.isSet()) {
+            settings.locations.push_back(Location{"", arg_lat.getValue(), arg_lon.getValue(), "", ""});
+        } else if (arg_soak.getValue() == 0) {
+            throw TCLAP::ArgException("needs --lat and --lon, --place, or --locations", "lat");
+        }
+
+        if (!arg_sensor.getValue().empty()) {
+            for (Location & location : settings.locations) {
+                location.sensor = arg_sensor.getValue();
+            }
+        }
+        settings.sensor_blend = std::clamp(arg_sensor_blend.getValue(), 0.0, 1.0);
+        bool has_sensor = std::any_of(settings.locations.begin(), settings.locations.end(),
+                                      [](const Location & location) { return !location.sensor.empty(); });
+
+        // Name locations given by coordinates for the date header
+        if (gazetteer) {
+            name_locations(settings.locations, *gazetteer);
+            gazetteer.reset();
+        }
+        settings.offline = arg_offline.getValue() || arg_soak.getValue() > 0;
+        settings.apikey = arg_key.getValue().empty() && !settings.offline ? get_apikey(path + "apikey.txt") : arg_key.getValue();
+        settings.img_dir = path + "img/";
+        if (arg_profiles.getValue().empty()) {
+            DisplayProfile profile = get_default_profile();
+            profile.optimize = arg_optimize.getValue();
+            settings.profiles.push_back(profile);
+        } else {
+            settings.profiles = load_profiles(arg_profiles.getValue(), arg_optimize.getValue());
+        }
+        settings.frames = arg_prerender.getValue();
+        settings.history_dir = arg_history_dir.getValue();
+        settings.snapshot_file = arg_snapshot.getValue();
+        if (settings.offline && settings.snapshot_file.empty()) {
+            throw TCLAP::ArgException("offline mode needs a snapshot file", "offline");
+        }
+        settings.rasterize = arg_rasterize.getValue();
+        settings.shm_frame_size = arg_shm_frames.getValue() ? (uint32_t) std::max(1, arg_shm_frame_size.getValue()) * 1024 : 0;
+        settings.workers = std::max(1, arg_workers.getValue());
+        settings.low_memory = arg_low_memory.getValue();
+        if (settings.low_memory && arg_soak.getValue() > 0) {
+            throw TCLAP::ArgException("can't count allocations in low-memory mode", "soak");
+        }
+        if (settings.low_memory) {
+            install_xml_arena();
+            Fetcher::set_max_response_size(1024 * 1024);
+
+            // One job at a time keeps only one forecast and document in memory
+            settings.workers = 1;
+        } else if (arg_soak.getValue() > 0) {
+            // Arena memory is freed without libxml2 knowing, so allocations are only counted without one
+            install_xml_counters();
+
+            // Workers sharing caches and the heap is part of what is soaked
+            settings.workers = std::max(2, settings.workers);
+        }
+        xmlInitParser();
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        const size_t memory_ceiling = (size_t) std::max(0, arg_memory_ceiling.getValue()) * 1024 * 1024;
+        RefreshPolicy policy(arg_min_interval.getValue(), arg_max_interval.getValue());
+
+        // Drive the renderer from the snapshot instead of refreshing
+        if (arg_soak.getValue() > 0) {
+            if (arg_notify_port.getValue() > 0) {
+                settings.notify = std::make_shared<NotifyServer>(arg_notify_port.getValue(),
+                                                                 arg_notify_timeout.getValue());
+                settings.notify->start();
+            }
+            SoakLimits limits{(size_t) std::max(0, arg_soak_max_rss.getValue()) * 1024 * 1024,
+                              arg_soak_max_allocations.getValue(), arg_soak_max_slowdown.getValue(),
+                              arg_soak_max_fds.getValue()};
+            const size_t window = (size_t) std::max(1, arg_soak_window.getValue());
+            if ((size_t) arg_soak.getValue() < SoakTest::get_min_renders(window)) {
+                throw TCLAP::ArgException("needs at least " + std::to_string(SoakTest::get_min_renders(window))
+                                          + " renders to compare windows of --soak-window", "soak");
+            }
+            SoakTest soak(settings, policy, load_snapshot(settings.snapshot_file), arg_soak_locations.getValue(),
+                          limits);
+            bool passed = soak.run(arg_soak.getValue(), window, std::cerr);
+            stop_profiling();
+            return passed ? 0 : 1;
+        }
+
+        // Show the last snapshot straight away instead of waiting on the network
+        std::shared_ptr<AssetStore> assets = AssetStore::get_instance(settings.img_dir);
+        if (arg_daemon.getValue()) {
+            if (arg_notify_port.getValue() > 0) {
+                settings.notify = std::make_shared<NotifyServer>(arg_notify_port.getValue(),
+                                                                 arg_notify_timeout.getValue());
+                settings.notify->start();
+            }
+            if (!settings.offline) {
+                rerender(settings, policy);
+            }
+            assets->watch();
+        } else if (arg_notify_port.getValue() > 0) {
+            throw TCLAP::ArgException("only works in daemon mode", "notify-port");
+        }
+
+        do {
+            PipelineResult result = refresh(settings, policy, arg_queue_report.getValue());
+            int64_t next_refresh = result.next_refresh;
+            if (!result.errors.empty()) {
+                dump_flight_recorder();
+                if (!arg_daemon.getValue()) {
+                    throw std::runtime_error(result.errors.front());
+                }
+                // Keep the daemon alive through network and API errors
+                for (const std::string & error : result.errors) {
+                    std::cerr << "error: " << error << std::endl;
+                }
+                next_refresh = std::min(next_refresh, std::time(nullptr) + arg_min_interval.getValue());
+
+                // Keep displays current with frames rendered from the last good fetch
+                for (const DisplayProfile & profile : result.failed) {
+                    std::string frame = find_frame(settings.img_dir, get_frame_queue(profile), std::time(nullptr));
+                    if (!frame.empty()) {
+                        std::filesystem::copy_file(settings.img_dir + frame, settings.img_dir + profile.output_svg,
+                                                   std::filesystem::copy_options::overwrite_existing);
+                        notify_published(settings, profile);
+                    }
+                }
+            }
+
+            if (arg_memory_report.getValue()) {
+                memory_report.print(std::cerr);
+            }
+            if (memory_ceiling > 0 && memory_report.get_max_peak() > memory_ceiling) {
+                std::cerr << "error: peak memory of " << memory_report.get_max_peak() / 1024 / 1024
+                          << " MiB is over the ceiling of " << arg_memory_ceiling.getValue() << " MiB" << std::endl;
+                if (!arg_daemon.getValue()) {
+                    return 1;
+                }
+            }
+
+            // Let an external scheduler know when to run next
+            if (!arg_refresh_file.getValue().empty()) {
+                std::ofstream refresh_file(arg_refresh_file.getValue());
+                refresh_file << next_refresh << std::endl;
+            }
+
+            if (arg_daemon.getValue()) {
+                // Until the next fetch, re-render from the snapshot to show template and icon edits straight away,
+                // and new sensor readings every sensor interval
+                uint64_t generation = assets->get_generation();
+                while (true) {
+                    int64_t wake = next_refresh;
+                    if (has_sensor) {
+                        wake = std::min(wake, (int64_t) std::time(nullptr) + std::max(1, arg_sensor_interval.getValue()));
+                    }
+                    if (assets->wait_for_change(generation, std::chrono::system_clock::from_time_t(wake))) {
+                        generation = assets->get_generation();
+                    } else if (wake >= next_refresh) {
+                        break;
+                    }
+                    rerender(settings, policy);
+                }
+            }
+        } while (arg_daemon.getValue());
 
         // Post-processing handled by bash script
+        stop_profiling();
         return 0;
     } catch (TCLAP::ArgException &e) {
         std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return 1;
     }
 }
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include <libxml/parser.h>
+#include <libxml/xmlmemory.h>
+
+#include "memstats.h"
+
+// Allocations libxml2 has made and not yet freed, once the counters are installed
+static std::atomic<long> xml_allocations(0);
+
+/**
+ * Gets a memory figure from /proc/self/status
+ *
+ * @param [in] field name of field, including the colon
+ * @return value in bytes, or 0 if unavailable
+ */
+static size_t read_status(const std::string & field) {
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    while (status >> key) {
+        if (key == field) {
+            size_t kilobytes;
+            status >> kilobytes;
+            return kilobytes * 1024;
+        }
+        status.ignore(256, '\n');
+    }
+    return 0;
+}
+
+/**
+ * Gets the peak resident set size since start or since the last reset
+ *
+ * @return peak resident memory in bytes, or 0 if unavailable
+ */
+size_t get_peak_rss() {
+    return read_status("VmHWM:");
+}
+
+/**
+ * Gets the current resident set size
+ *
+ * @return resident memory in bytes, or 0 if unavailable
+ */
+size_t get_rss() {
+    return read_status("VmRSS:");
+}
+
+static void *counting_malloc(const size_t size) {
+    void *ptr = std::malloc(size);
+    if (ptr) {
+        xml_allocations++;
+    }
+    return ptr;
+}
+
+static void counting_free(void *ptr) {
+    if (ptr) {
+        xml_allocations--;
+    }
+    std::free(ptr);
+}
+
+static void *counting_realloc(void *ptr, const size_t size) {
+    void *moved = std::realloc(ptr, size);
+    if (moved && !ptr) {
+        xml_allocations++;
+    }
+    return moved;
+}
+
+static char *counting_strdup(const char *str) {
+    size_t length = std::strlen(str) + 1;
+    auto *copy = (char *) counting_malloc(length);
+    if (copy) {
+        std::memcpy(copy, str, length);
+    }
+    return copy;
+}
+
+/**
+ * Counts libxml2's allocations and frees, to spot nodes that are never freed
+ * Must be called before libxml2 is used for anything else, and can't be combined with install_xml_arena
+ */
+void install_xml_counters() {
+    xmlMemSetup(counting_free, counting_malloc, counting_realloc, counting_strdup);
+    xmlInitParser();
+}
+
+/**
+ * Gets the number of libxml2 allocations that haven't been freed
+ *
+ * @return live allocations, or 0 if install_xml_counters hasn't been called
+ */
+long get_xml_allocations() {
+    return xml_allocations;
+}
+
+/**
+ * Resets the peak resident set size to the current one
+ */
+static void reset_peak_rss() {
+    // Writing 5 resets the peak to the current resident set size (Linux 4.0+)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5" << std::endl;
+}
+
+/**
+ * Starts measuring a refresh, forgetting the last one's stages and resetting the process peak
+ * The peak is process-wide, so it can only be split by stage when each stage has a single worker; with more, stages
+ * of different jobs overlap all the time and only the peak of the whole refresh is measured
+ *
+ * @param [in] per_stage record the peak of each stage (only meaningful with one worker per stage)
+ */
+void MemoryReport::start(const bool per_stage) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peaks.clear();
+    stages = per_stage;
+    running = 0;
+    refresh_peak = 0;
+    reset_peak_rss();
+}
+
+/**
+ * Starts measuring a stage, resetting the peak so earlier stages don't count towards it
+ * A decode and a render can still overlap with one worker each, so each stage's peak is an upper bound for that stage
+ */
+void MemoryReport::start_stage() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stages && running++ == 0) {
+        // Keep the peak so far for the refresh total before it is reset
+        refresh_peak = std::max(refresh_peak, get_peak_rss());
+        reset_peak_rss();
+    }
+}
+
+/**
+ * Finishes measuring a stage
+ *
+ * @param [in] name name of stage to show in report
+ */
+void MemoryReport::end_stage(const std::string & name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stages) {
+        running--;
+        peaks.emplace_back(name, get_peak_rss());
+    }
+}
+
+/**
+ * Gets the peak resident memory of the refresh, which is also the highest peak of any recorded stage
+ *
+ * @return peak resident memory in bytes
+ */
+size_t MemoryReport::get_max_peak() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t max_peak = std::max(refresh_peak, get_peak_rss());
+    for (const std::pair<std::string, size_t> & peak : peaks) {
+        max_peak = std::max(max_peak, peak.second);
+    }
+    return max_peak;
+}
+
+/**
+ * Writes the peak resident memory of each stage, one per line, then the peak of the whole refresh
+ *
+ * @param [in,out] out stream to write to
+ */
+void MemoryReport::print(std::ostream & out) {
+    size_t max_peak = get_max_peak();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::pair<std::string, size_t> & peak : peaks) {
+        out << "peak rss " << peak.first << ": " << peak.second / 1024 << " KiB" << std::endl;
+    }
+    out << "peak rss: " << max_peak / 1024 << " KiB"
+        << (stages ? "" : " (stages overlap with more than one worker; use --workers=1 for each stage's peak)")
+        << std::endl;
+}
@@ -0,0 +1,30 @@
+#ifndef NOOK_WEATHER_MEMSTATS_H
+#define NOOK_WEATHER_MEMSTATS_H
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+size_t get_peak_rss();
+size_t get_rss();
+void install_xml_counters();
+long get_xml_allocations();
+
+class MemoryReport {
+public:
+    void start(bool per_stage);                                 // Begin measuring a refresh, forgetting the last one
+    void start_stage();                                         // Begin measuring a stage, resetting peak if none are running
+    void end_stage(const std::string & name);                   // Record peak of a finished stage
+    size_t get_max_peak();                                      // Units: bytes  (peak of the whole refresh)
+    void print(std::ostream & out);                             // Write peak of each stage and of the refresh
+private:
+    std::mutex mutex;
+    bool stages = false;                                        // Record each stage's peak (one worker per stage)
+    int running = 0;                                            // Stages started but not ended
+    size_t refresh_peak = 0;                                    // Units: bytes  (peak before the latest reset)
+    std::vector<std::pair<std::string, size_t>> peaks;          // Units: bytes
+};
+
+#endif //NOOK_WEATHER_MEMSTATS_H
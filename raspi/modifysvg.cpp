@@ -1,11 +1,23 @@
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <cmath>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
+#include "arena.h"
+#include "assets.h"
+#include "astronomy.h"
+#include "downsample.h"
+#include "flightrecorder.h"
 #include "modifysvg.h"
+#include "optimizesvg.h"
+#include "textlayout.h"
+
+static const double text_margin = 20;       // Units: px  (between text and the edge of its group)
+static const double min_font_scale = 0.7;   // Smallest fitted text as a fraction of its size in the template
 
 /**
  * Converts a decimal number to a percentage string rounded to the nearest percent
@@ -28,16 +40,175 @@ std::string double_to_degree(const double temperature) {
 }
 
 /**
- * Modifies template svg to add in the current date
+ * Overrides the font size of a text or tspan node
+ *
+ * @param [in,out] node node to resize
+ * @param [in] size font size in px
+ */
+static void set_font_size(xmlNodePtr node, const double size) {
+    xmlChar *style = xmlGetProp(node, (xmlChar *) "style");
+    std::stringstream strstm;
+    if (style) {
+        strstm << (char *) style << ";";
+    }
+    xmlFree(style);
+    strstm << "font-size:" << size << "px";  // later declarations win
+    xmlSetProp(node, (xmlChar *) "style", (xmlChar *) strstm.str().c_str());
+}
+
+/**
+ * Gets the width text in a group has to fit in
+ *
+ * @param [in] group_ptr pointer to the <g> node (its data-bounds are checked when the template is loaded)
+ * @return width of the group less margins, in px
+ */
+static double get_text_width(xmlNodePtr group_ptr) {
+    double bounds[4];
+    if (!read_group_bounds(group_ptr, bounds)) {
+        throw std::runtime_error("Template group is missing data-bounds");
+    }
+    return bounds[2] - 2 * text_margin;
+}
+
+/**
+ * Sets the text of a node, shrinking or ellipsizing it to fit on one line
+ *
+ * @param [in,out] node text or tspan node
+ * @param [in] text text to show
+ * @param [in] svg_template template the node was copied from, for its font size
+ * @param [in,out] font metrics of the template's font
+ * @param [in] width width of the box the text has to fit in, in px
+ */
+static void set_fitted_text(xmlNodePtr node, const std::string & text, const Template & svg_template,
+                            FontMetrics & font, const double width) {
+    const double size = svg_template.get_font_size(node);
+    TextFit fitted = font.fit(text, size, size * min_font_scale, width);
+    xmlNodeSetContent(node, (xmlChar *) fitted.lines[0].c_str());
+    if (fitted.size != size) {
+        set_font_size(node, fitted.size);
+    }
+}
+
+/**
+ * Describes the sun and moon for a day, e.g. "Dawn 06:24 · Sunrise 06:52 · Sunset 18:31 · Dusk 18:59 · Full moon"
+ *
+ * @param [in] timestamp a time during the day as unix time
+ * @param [in] lat latitude in degrees
+ * @param [in] lon longitude in degrees east
+ * @param [in] time_format formatter for the location's time zone
+ * @return summary of the day's sun and moon
+ */
+static std::string get_sun_summary(const int64_t timestamp, const double lat, const double lon,
+                                   const TimeFormatter & time_format) {
+    SunTimes sun = get_sun_times(lat, lon, time_format.get_next_midnight(timestamp) - 43200);
+    std::string summary;
+    if (sun.dawn) {
+        summary += "Dawn " + time_format.format_time(sun.dawn) + " · ";
+    }
+    if (sun.sunrise) {
+        summary += "Sunrise " + time_format.format_time(sun.sunrise) + " · Sunset "
+                   + time_format.format_time(sun.sunset) + " · ";
+    } else {
+        summary += sun.midnight_sun ? "Midnight sun · " : "Polar night · ";
+    }
+    if (sun.dusk) {
+        summary += "Dusk " + time_format.format_time(sun.dusk) + " · ";
+    }
+    return summary + get_moon_phase_name(get_moon_phase(timestamp));
+}
+
+/**
+ * Modifies template svg to add in the current date, and the sun and moon if the location is known
  *
  * @param [in,out] group_ptr pointer to the group-date <g> node
  * @param [in] timestamp current timestamp as unix time
+ * @param [in] lat latitude in degrees (NaN if unknown)
+ * @param [in] lon longitude in degrees east (NaN if unknown)
+ * @param [in] time_format formatter for the location's time zone
+ * @param [in] place place name to show after the date (empty for none)
+ * @param [in] svg_template template the svg was copied from
+ * @param [in,out] font metrics of the template's font
  */
-void modify_svg_date(xmlNodePtr & group_ptr, const uint64_t timestamp) {
+void modify_svg_date(xmlNodePtr & group_ptr, const int64_t timestamp, const double lat, const double lon,
+                     const TimeFormatter & time_format, const std::string & place, const Template & svg_template,
+                     FontMetrics & font) {
+    StageScope stage(Stage::modify_svg_date);
+    const double width = get_text_width(group_ptr);
     xmlNodePtr curr_node = group_ptr->children;
-    char datetime_buf[64];
-    strftime(datetime_buf, 64, "%A, %B %e, %Y", localtime((time_t *) &(timestamp)));
-    xmlNodeSetContent(curr_node, (xmlChar *) datetime_buf);
+    std::string date = time_format.format_date(timestamp);
+    if (!place.empty()) {
+        date += " · " + place;
+    }
+    set_fitted_text(curr_node, date, svg_template, font, width);
+    curr_node = curr_node->next;
+
+    // Sun and moon (older templates don't have a line for them)
+    if (curr_node && !std::isnan(lat) && !std::isnan(lon)) {
+        set_fitted_text(curr_node, get_sun_summary(timestamp, lat, lon, time_format), svg_template, font, width);
+    }
+}
+
+/**
+ * Draws a bar for each of the next 24 hours' air quality, with the worst hour in black and its pollutant above it
+ * Bars are the worst pollutant's CAQI sub-index, which shows trends within an AQI band; all but the worst hour share
+ * one path, so the strip is three elements however many hours it shows
+ *
+ * @param [in,out] trend_ptr pointer to the <g> node to draw in
+ * @param [in] airquality air quality of the coming hours, from the current one
+ * @param [in] bounds strip area  index 0: x (0) or y (1)  index 1: start (0) or end (1)
+ * @param [in] svg_template template the svg was copied from
+ * @param [in,out] font metrics of the template's font
+ */
+static void draw_aqi_trend(xmlNodePtr trend_ptr, const std::vector<HourlyAirQuality> & airquality,
+                           const int (&bounds)[2][2], const Template & svg_template, FontMetrics & font) {
+    const size_t hours = std::min(airquality.size(), (size_t) 24);
+    const double bar_width = (double) (bounds[0][1] - bounds[0][0]) / (double) hours;
+    const double height = bounds[1][1] - bounds[1][0];
+    size_t peak = 0;
+    for (size_t i = 1; i < hours; i++) {
+        if (airquality[i].severity > airquality[peak].severity) {
+            peak = i;
+        }
+    }
+
+    // Heights are out of the top of the CAQI scale, with a sliver left for clean air
+    std::string bars;
+    bars.reserve(hours * 48);
+    char bar[64];
+    double peak_top = bounds[1][1];
+    for (size_t i = 0; i < hours; i++) {
+        double top = bounds[1][1] - std::max(1.0, height * std::min(airquality[i].severity, 5.0) / 5);
+        if (i == peak) {
+            peak_top = top;
+            continue;
+        }
+        snprintf(bar, sizeof(bar), "M%.1f %.1fh%.1fV%dh%.1fz", bounds[0][0] + (double) i * bar_width, top,
+                 bar_width * 0.75, bounds[1][1], -bar_width * 0.75);
+        bars += bar;
+    }
+    xmlNodePtr bars_node = xmlNewChild(trend_ptr, nullptr, (xmlChar *) "path", nullptr);
+    xmlNewProp(bars_node, (xmlChar *) "class", (xmlChar *) "aqitrendbar");
+    xmlNewProp(bars_node, (xmlChar *) "d", (xmlChar *) bars.c_str());
+
+    const double peak_x = bounds[0][0] + (double) peak * bar_width;
+    xmlNodePtr peak_node = xmlNewChild(trend_ptr, nullptr, (xmlChar *) "rect", nullptr);
+    xmlNewProp(peak_node, (xmlChar *) "class", (xmlChar *) "aqitrendpeak");
+    xmlNewProp(peak_node, (xmlChar *) "x", (xmlChar *) std::to_string(peak_x).c_str());
+    xmlNewProp(peak_node, (xmlChar *) "y", (xmlChar *) std::to_string(peak_top).c_str());
+    xmlNewProp(peak_node, (xmlChar *) "width", (xmlChar *) std::to_string(bar_width * 0.75).c_str());
+    xmlNewProp(peak_node, (xmlChar *) "height", (xmlChar *) std::to_string(bounds[1][1] - peak_top).c_str());
+
+    // Like the current summary, there's no pollutant worth naming when air quality is good
+    if (airquality[peak].aqi > 1) {
+        const char *pollutant = get_pollutant_name(airquality[peak].pollutant);
+        xmlNodePtr label_node = xmlNewChild(trend_ptr, nullptr, (xmlChar *) "text", (xmlChar *) pollutant);
+        xmlNewProp(label_node, (xmlChar *) "class", (xmlChar *) "aqitrendlabel");
+        double label_width = font.measure(pollutant, svg_template.get_font_size(label_node));
+        double label_x = std::clamp(peak_x + bar_width * 0.375, bounds[0][0] + label_width / 2,
+                                    std::max(bounds[0][1] - label_width / 2, bounds[0][0] + label_width / 2));
+        xmlNewProp(label_node, (xmlChar *) "x", (xmlChar *) std::to_string(label_x).c_str());
+        xmlNewProp(label_node, (xmlChar *) "y", (xmlChar *) std::to_string(peak_top - 2).c_str());
+    }
 }
 
 /**
@@ -45,8 +216,20 @@ void modify_svg_date(xmlNodePtr & group_ptr, const uint64_t timestamp) {
  *
  * @param [in,out] group_ptr pointer to the group-current <g> node
  * @param [in] current current weather conditions
+ * @param [in] airquality air quality of the coming hours, from the current one (empty if not fetched)
+ * @param [in] time_format formatter for the location's time zone
+ * @param [in] profile display profile with air quality strip geometry
+ * @param [in,out] assets store to get icons from
+ * @param [in] svg_template template the svg was copied from
+ * @param [in,out] font metrics of the template's font
  */
-void modify_svg_current(xmlNodePtr & group_ptr, const CurrentWeather & current) {
+void modify_svg_current(xmlNodePtr & group_ptr, const CurrentWeather & current,
+                        const std::vector<HourlyAirQuality> & airquality, const TimeFormatter & time_format,
+                        const DisplayProfile & profile, AssetStore & assets, const Template & svg_template,
+                        FontMetrics & font) {
+    StageScope stage(Stage::modify_svg_current);
+    const double width = get_text_width(group_ptr);
+    const bool aqi_trend = profile.aqi_trend && airquality.size() >= 2;
     xmlNodePtr curr_node = group_ptr->children;
     xmlAttr *curr_attr;
     std::stringstream strstm;
@@ -55,13 +238,20 @@ void modify_svg_current(xmlNodePtr & group_ptr, const CurrentWeather & current)
     curr_node = curr_node->next;
 
     // Updated at
-    strstm = std::stringstream();
-    strstm << std::put_time(localtime((time_t *) &(current.timestamp)), "%R");
-    xmlNodeAddContent(curr_node->children, (xmlChar *) strstm.str().c_str());
+    xmlNodeAddContent(curr_node->children, (xmlChar *) time_format.format_time(current.timestamp).c_str());
     curr_node = curr_node->next;
 
-    // Air quality
-    xmlNodeAddContent(curr_node->children, (xmlChar *) current.aqi.get_summary().c_str());
+    // Air quality, shrunk if needed to leave room for its trend strip
+    if (aqi_trend) {
+        xmlChar *label = xmlNodeGetContent(curr_node);
+        xmlChar *x = xmlGetProp(curr_node, (xmlChar *) "x");
+        double available = profile.aqi_trend_bounds[0][0] - 10 - (x ? strtod((char *) x, nullptr) : 0);
+        set_fitted_text(curr_node, (char *) label + current.aqi.get_summary(), svg_template, font, available);
+        xmlFree(label);
+        xmlFree(x);
+    } else {
+        xmlNodeAddContent(curr_node->children, (xmlChar *) current.aqi.get_summary().c_str());
+    }
     curr_node = curr_node->next;
 
     // Wind conditions
@@ -85,12 +275,97 @@ void modify_svg_current(xmlNodePtr & group_ptr, const CurrentWeather & current)
     curr_node = curr_node->next;
 
     // Weather description
-    xmlNodeSetContent(curr_node, (xmlChar *) current.weather.c_str());
+    set_fitted_text(curr_node, current.weather, svg_template, font, width);
     curr_node = curr_node->next;
 
     // Icon
-    xmlSetProp(curr_node, (xmlChar *) "href", (xmlChar *) (current.icon + ".svg").c_str());
-    xmlSetProp(curr_node, (xmlChar *) "xlink:href", (xmlChar *) (current.icon + ".svg").c_str());
+    std::string icon = assets.get_icon(current.icon);
+    xmlSetProp(curr_node, (xmlChar *) "href", (xmlChar *) icon.c_str());
+    xmlSetProp(curr_node, (xmlChar *) "xlink:href", (xmlChar *) icon.c_str());
+    curr_node = curr_node->next;
+
+    // Air quality strip (older templates don't have one)
+    if (curr_node && aqi_trend) {
+        draw_aqi_trend(curr_node, airquality, profile.aqi_trend_bounds, svg_template, font);
+    } else if (curr_node) {
+        xmlUnlinkNode(curr_node);
+        xmlFreeNode(curr_node);
+    }
+}
+
+/**
+ * Formats a coordinate, leaving off the decimals of whole numbers
+ *
+ * @param [in] value coordinate
+ * @return coordinate as a string
+ */
+static std::string format_coordinate(const double value) {
+    if (value == std::floor(value)) {
+        return std::to_string((long) value);
+    }
+    return std::to_string(value);
+}
+
+/**
+ * Finds every element in a group with a class
+ *
+ * @param [in] group_ptr pointer to the <g> node
+ * @param [in] class_name class to look for
+ * @return matching child nodes, in document order
+ */
+static std::vector<xmlNodePtr> find_class(xmlNodePtr group_ptr, const char *class_name) {
+    std::vector<xmlNodePtr> nodes;
+    for (xmlNodePtr node = group_ptr->children; node; node = node->next) {
+        xmlChar *value = xmlGetProp(node, (xmlChar *) "class");
+        if (value && xmlStrcmp(value, (xmlChar *) class_name) == 0) {
+            nodes.push_back(node);
+        }
+        xmlFree(value);
+    }
+    return nodes;
+}
+
+/**
+ * Creates an element with the same name and attributes as another, but no content
+ * Unlike xmlCopyNode, the copy doesn't redeclare the svg namespace
+ *
+ * @param [in] node element to copy
+ * @return new element, not yet in the document
+ */
+static xmlNodePtr copy_element(xmlNodePtr node) {
+    xmlNodePtr copy = xmlNewNode(nullptr, node->name);
+    for (xmlAttr *attr = node->properties; attr; attr = attr->next) {
+        xmlChar *value = xmlNodeGetContent((xmlNodePtr) attr);
+        xmlNewProp(copy, attr->name, value);
+        xmlFree(value);
+    }
+    return copy;
+}
+
+/**
+ * Removes a node from the document and frees it
+ *
+ * @param [in] node node to delete
+ */
+static void delete_node(xmlNodePtr node) {
+    xmlUnlinkNode(node);
+    xmlFreeNode(node);
+}
+
+/**
+ * Gets the points of a polygon that fills the area under a chart line
+ *
+ * @param [in] points chart line, ordered by x
+ * @param [in] bottom y coordinate of the bottom of the chart
+ * @return value for the polygon's points attribute
+ */
+static std::string get_area_points(const std::vector<ChartPoint> & points, const double bottom) {
+    std::stringstream strstm;
+    for (const ChartPoint & point : points) {
+        strstm << point.x << "," << point.y << " ";
+    }
+    strstm << points.back().x << "," << bottom << " " << points.front().x << "," << bottom;
+    return strstm.str();
 }
 
 /**
@@ -98,8 +373,14 @@ void modify_svg_current(xmlNodePtr & group_ptr, const CurrentWeather & current)
  *
  * @param [in,out] group_ptr pointer to the group-precipitation <g> node
  * @param [in] precipitation precipitation data
+ * @param [in] minutely precipitation for each minute of the next hour (empty if not fetched)
+ * @param [in] profile display profile with nowcast chart geometry
+ * @param [in,out] assets store to get icons from
  */
-void modify_svg_precipitation(xmlNodePtr & group_ptr, const Precipitation & precipitation) {
+void modify_svg_precipitation(xmlNodePtr & group_ptr, const Precipitation & precipitation,
+                              const std::vector<MinutelyPrecipitation> & minutely, const DisplayProfile & profile,
+                              AssetStore & assets) {
+    StageScope stage(Stage::modify_svg_precipitation);
     xmlNodePtr curr_node = group_ptr->children;
     std::stringstream strstm;
 
@@ -116,19 +397,77 @@ void modify_svg_precipitation(xmlNodePtr & group_ptr, const Precipitation & prec
 
     // Icon
     xmlSetProp(curr_node, (xmlChar *) "opacity", (xmlChar *) std::to_string(std::max(precipitation.hour, precipitation.today)).c_str());
-    xmlSetProp(curr_node, (xmlChar *) "href", (xmlChar *) "umbrella.svg");
-    xmlSetProp(curr_node, (xmlChar *) "xlink:href", (xmlChar *) "umbrella.svg");
+    std::string icon = assets.get_icon("umbrella");
+    xmlSetProp(curr_node, (xmlChar *) "href", (xmlChar *) icon.c_str());
+    xmlSetProp(curr_node, (xmlChar *) "xlink:href", (xmlChar *) icon.c_str());
+
+    // Nowcast chart of the next hour, if the template has one
+    const int (&bounds)[2][2] = profile.nowcast_bounds;  // index 0: x (0) or y (1)  index 1: start (0) or end (1)
+    const double heavy_rain = 8;  // Units: mm/h  (drawn at full height)
+    for (xmlNodePtr nowcast : find_class(group_ptr, "nowcastrain")) {
+        if (!profile.nowcast || minutely.size() < 2) {
+            delete_node(nowcast);
+            continue;
+        }
+
+        // Square root scale keeps drizzle visible next to heavy rain
+        const double width = bounds[0][1] - bounds[0][0];
+        const double height = bounds[1][1] - bounds[1][0];
+        const auto duration = (double) (minutely.back().timestamp - minutely.front().timestamp);
+        std::vector<ChartPoint> points;
+        for (const MinutelyPrecipitation & minute : minutely) {
+            double rate = std::clamp(minute.precipitation, 0.0, heavy_rain);
+            points.push_back(ChartPoint{bounds[0][0] + width * (double) (minute.timestamp - minutely.front().timestamp) / duration,
+                                        bounds[1][1] - height * std::sqrt(rate / heavy_rain)});
+        }
+        points = downsample_lttb(points, get_point_budget(width));
+        xmlSetProp(nowcast, (xmlChar *) "points", (xmlChar *) get_area_points(points, bounds[1][1]).c_str());
+    }
 }
 
 /**
  * Modifies template svg to add in hourly data
+ * The template has one of each per-hour element, which is copied for as many hours as the profile shows
+ * Graphs are downsampled to the graph's width, so showing more hours doesn't mean more geometry than can be seen
  *
  * @param [in, out] group_ptr pointer to the group-hourly <g> node
  * @param [in] hourly hourly forecast data
+ * @param [in] time_format formatter for the location's time zone
+ * @param [in] profile display profile with graph geometry
  */
-void modify_svg_hourly(xmlNodePtr & group_ptr, const std::vector<HourlyWeather> & hourly) {
-    xmlNodePtr curr_node = group_ptr->children;
-    std::stringstream strstm;
+void modify_svg_hourly(xmlNodePtr & group_ptr, const std::vector<HourlyWeather> & hourly, const TimeFormatter & time_format,
+                       const DisplayProfile & profile) {
+    StageScope stage(Stage::modify_svg_hourly);
+    // Find elements to fill in or copy
+    std::vector<xmlNodePtr> rain = find_class(group_ptr, "hourlyrain");
+    std::vector<xmlNodePtr> gridlines = find_class(group_ptr, "hourlygrid");
+    std::vector<xmlNodePtr> hour_labels = find_class(group_ptr, "hourlyhour");
+    std::vector<xmlNodePtr> temp_labels = find_class(group_ptr, "hourlytemp");
+    std::vector<xmlNodePtr> graph_lines = find_class(group_ptr, "hourlygraph");
+    std::vector<xmlNodePtr> verticals;
+    for (xmlNodePtr gridline : gridlines) {
+        xmlChar *x1 = xmlGetProp(gridline, (xmlChar *) "x1");
+        xmlChar *x2 = xmlGetProp(gridline, (xmlChar *) "x2");
+        if (x1 && x2 && xmlStrcmp(x1, x2) == 0) {
+            verticals.push_back(gridline);
+        }
+        xmlFree(x1);
+        xmlFree(x2);
+    }
+    if (rain.empty() || verticals.empty() || hour_labels.empty() || temp_labels.size() < 2 || graph_lines.empty()) {
+        throw std::runtime_error("Template is missing parts of the hourly graph");
+    }
+
+    // A graph needs two hours to span its width, so leave just the header without them
+    const int hours = std::min(profile.hours, (int) hourly.size());
+    if (hours < 2) {
+        for (const std::vector<xmlNodePtr> & nodes : {rain, gridlines, hour_labels, temp_labels, graph_lines}) {
+            for (xmlNodePtr node : nodes) {
+                delete_node(node);
+            }
+        }
+        return;
+    }
 
     // Gather metadata about hourly forecast
     const int round_to = 5;  // Round to multiples of 5
@@ -146,47 +485,41 @@ void modify_svg_hourly(xmlNodePtr & group_ptr, const std::vector<HourlyWeather>
     if (temp_min_rounded % round_to != 0) {
         temp_min_rounded -= temp_min_rounded % round_to;
     }
+    if (temp_max_rounded == temp_min_rounded) {
+        temp_max_rounded += round_to;
+    }
 
     // Set up constants for drawing components
-    const unsigned int hours = 12;
-    const unsigned int graph_bounds[2][2] = {{550, 770}, {360, 460}};  // index 0: x (0) or y (1)  index 1: start (0) or end (1)
+    const int (&graph_bounds)[2][2] = profile.graph_bounds;  // index 0: x (0) or y (1)  index 1: start (0) or end (1)
     enum dimension {X, Y};
     enum limit {START, END};
-    const unsigned int padding_lines = 10;  // amount lines extend past graph
-    const unsigned int colwidth = (graph_bounds[X][END] - graph_bounds[X][START]) / (hours - 1);  // width of each column
-    const unsigned int graph_height = graph_bounds[Y][END] - graph_bounds[Y][START];
-    const unsigned int padding_text = 4;  // padding of text around graph
-
-    // Skip header
-    curr_node = curr_node->next;
+    const int padding_lines = 10;  // amount lines extend past graph
+    const double colwidth = (double) (graph_bounds[X][END] - graph_bounds[X][START]) / (hours - 1);  // width of each column
+    const int graph_height = graph_bounds[Y][END] - graph_bounds[Y][START];
+    const int padding_text = 4;  // padding of text around graph
+    const int label_step = 3 * ((hours + 11) / 12);  // label every third hour, or fewer when showing more than 12
+    const size_t budget = get_point_budget(graph_bounds[X][END] - graph_bounds[X][START]);
 
     // Probability of precipitation graph
-    strstm = std::stringstream();
+    std::vector<ChartPoint> pop_points;
     for (int i = 0; i < hours; i++) {
-        strstm << graph_bounds[X][START] + i * colwidth << "," << graph_bounds[Y][END] - graph_height * hourly[i].pop << " ";
+        pop_points.push_back(ChartPoint{graph_bounds[X][START] + i * colwidth, graph_bounds[Y][END] - graph_height * hourly[i].pop});
     }
-    strstm << graph_bounds[X][END] << "," << graph_bounds[Y][END] << " " << graph_bounds[X][START] << "," << graph_bounds[Y][END];
-    xmlSetProp(curr_node, (xmlChar *) "points", (xmlChar *) strstm.str().c_str());
-    curr_node = curr_node->next;
+    pop_points = downsample_lttb(pop_points, budget);
+    xmlSetProp(rain[0], (xmlChar *) "points", (xmlChar *) get_area_points(pop_points, graph_bounds[Y][END]).c_str());
 
-    // Show vertical gridlines every third hour
-    curr_node = curr_node->next;
-    int hour = localtime((time_t *) &(hourly[1].timestamp))->tm_hour;
-    for (int i = 1; i < hours - 1; i++) {
-        if (hour % 3 != 0) {
-            xmlNodePtr delete_node = curr_node;
-            curr_node = curr_node->prev;
-            xmlUnlinkNode(delete_node);
-            xmlFreeNode(delete_node);
+    // Show vertical gridlines at both ends and on labelled hours
+    for (int i = 0; i < hours; i++) {
+        if (i == 0 || i == hours - 1 || time_format.get_local(hourly[i].timestamp).hour % label_step == 0) {
+            xmlNodePtr new_line = copy_element(verticals[0]);
+            std::string x = format_coordinate(graph_bounds[X][START] + i * colwidth);
+            xmlSetProp(new_line, (xmlChar *) "x1", (xmlChar *) x.c_str());
+            xmlSetProp(new_line, (xmlChar *) "x2", (xmlChar *) x.c_str());
+            xmlAddPrevSibling(verticals[0], new_line);
         }
-        hour += 1;
-        curr_node = curr_node->next;
     }
-    curr_node = curr_node->next;
-
-    // Skip default horizontal gridlines
-    for (int i = 0; i < 2; i++) {
-        curr_node = curr_node->next;
+    for (xmlNodePtr vertical : verticals) {
+        delete_node(vertical);
     }
 
     // Generate other horizontal gridlines
@@ -198,29 +531,26 @@ void modify_svg_hourly(xmlNodePtr & group_ptr, const std::vector<HourlyWeather>
         xmlNewProp(new_line, (xmlChar *) "y1", (xmlChar *) std::to_string(graph_bounds[Y][START] + (i + 1) * graph_height / divisions).c_str());
         xmlNewProp(new_line, (xmlChar *) "x2", (xmlChar *) std::to_string(graph_bounds[X][END] + padding_lines).c_str());
         xmlNewProp(new_line, (xmlChar *) "y2", (xmlChar *) std::to_string(graph_bounds[Y][START] + (i + 1) * graph_height / divisions).c_str());
-        xmlAddPrevSibling(curr_node, new_line);
+        xmlAddPrevSibling(hour_labels[0], new_line);
     }
 
     // Show hour on drawn gridlines
     for (int i = 0; i < hours; i++) {
-        tm *timestamp = localtime((time_t *) &(hourly[i].timestamp));
-        if (timestamp->tm_hour % 3 == 0) {
-            xmlNodeSetContent(curr_node, (xmlChar *) std::to_string(timestamp->tm_hour).c_str());
-        } else {
-            xmlNodePtr delete_node = curr_node;
-            curr_node = curr_node->prev;
-            xmlUnlinkNode(delete_node);
-            xmlFreeNode(delete_node);
+        int local_hour = time_format.get_local(hourly[i].timestamp).hour;
+        if (local_hour % label_step == 0) {
+            xmlNodePtr new_label = copy_element(hour_labels[0]);
+            xmlSetProp(new_label, (xmlChar *) "x", (xmlChar *) format_coordinate(graph_bounds[X][START] + i * colwidth).c_str());
+            xmlNodeSetContent(new_label, (xmlChar *) std::to_string(local_hour).c_str());
+            xmlAddPrevSibling(hour_labels[0], new_label);
         }
-        curr_node = curr_node->next;
+    }
+    for (xmlNodePtr hour_label : hour_labels) {
+        delete_node(hour_label);
     }
 
     // Show temps on drawn gridlines
-    xmlNodeSetContent(curr_node, (xmlChar *) double_to_degree(temp_max_rounded).c_str());
-    curr_node = curr_node->next;
-
-    xmlNodeSetContent(curr_node, (xmlChar *) double_to_degree(temp_min_rounded).c_str());
-    curr_node = curr_node->next;
+    xmlNodeSetContent(temp_labels[0], (xmlChar *) double_to_degree(temp_max_rounded).c_str());
+    xmlNodeSetContent(temp_labels[1], (xmlChar *) double_to_degree(temp_min_rounded).c_str());
 
     for (int i = 0; i < divisions - 1; i++) {
         xmlNodePtr new_temp = xmlNewNode(nullptr, (xmlChar *) "text");
@@ -228,36 +558,52 @@ void modify_svg_hourly(xmlNodePtr & group_ptr, const std::vector<HourlyWeather>
         xmlNewProp(new_temp, (xmlChar *) "x", (xmlChar *) &(std::to_string(graph_bounds[X][START] - padding_lines - padding_text))[0]);
         xmlNewProp(new_temp, (xmlChar *) "y", (xmlChar *) &(std::to_string(graph_bounds[Y][START] + (i + 1) * graph_height / divisions))[0]);
         xmlNodeSetContent(new_temp, (xmlChar *) double_to_degree(temp_max_rounded - (i + 1) * round_to).c_str());
-        xmlAddPrevSibling(curr_node, new_temp);
+        xmlAddPrevSibling(graph_lines[0], new_temp);
     }
 
     // Show temperature graph
-    for (int i = 0; i < hours - 1; i++) {
-        double start_y = graph_bounds[Y][END] - graph_height * (hourly[i].temp - temp_min_rounded) / (temp_max_rounded - temp_min_rounded);
-        double end_y = graph_bounds[Y][END] - graph_height * (hourly[i + 1].temp - temp_min_rounded) / (temp_max_rounded - temp_min_rounded);
-        xmlSetProp(curr_node, (xmlChar *) "y1", (xmlChar *) std::to_string(start_y).c_str());
-        xmlSetProp(curr_node, (xmlChar *) "y2", (xmlChar *) std::to_string(end_y).c_str());
-        curr_node = curr_node->next ? curr_node-> next : curr_node;
+    std::vector<ChartPoint> temp_points;
+    for (int i = 0; i < hours; i++) {
+        temp_points.push_back(ChartPoint{graph_bounds[X][START] + i * colwidth,
+                                         graph_bounds[Y][END] - graph_height * (hourly[i].temp - temp_min_rounded) / (temp_max_rounded - temp_min_rounded)});
+    }
+    temp_points = downsample_lttb(temp_points, budget);
+    for (size_t i = 0; i + 1 < temp_points.size(); i++) {
+        xmlNodePtr new_line = copy_element(graph_lines[0]);
+        xmlSetProp(new_line, (xmlChar *) "x1", (xmlChar *) format_coordinate(temp_points[i].x).c_str());
+        xmlSetProp(new_line, (xmlChar *) "y1", (xmlChar *) std::to_string(temp_points[i].y).c_str());
+        xmlSetProp(new_line, (xmlChar *) "x2", (xmlChar *) format_coordinate(temp_points[i + 1].x).c_str());
+        xmlSetProp(new_line, (xmlChar *) "y2", (xmlChar *) std::to_string(temp_points[i + 1].y).c_str());
+        xmlAddPrevSibling(graph_lines[0], new_line);
+    }
+    for (xmlNodePtr graph_line : graph_lines) {
+        delete_node(graph_line);
     }
 }
 
-
 /**
  * Modifies template svg to add in daily forecast
  *
  * @param [in, out] group_ptr pointer to the group-hourly <g> node
  * @param [in] daily daily forecast data
+ * @param [in] time_format formatter for the location's time zone
+ * @param [in] days number of boxes in template
+ * @param [in,out] assets store to get icons from
  */
-void modify_svg_daily(xmlNodePtr & group_ptr, const std::vector<DailyWeather> & daily) {
+void modify_svg_daily(xmlNodePtr & group_ptr, const std::vector<DailyWeather> & daily, const TimeFormatter & time_format,
+                      const int days, AssetStore & assets) {
+    StageScope stage(Stage::modify_svg_daily);
     xmlNodePtr curr_node = group_ptr->children;
     std::stringstream strstm = std::stringstream();
 
-    // Fill out as many boxes as possible, up to 5 (max)
-    for (int i = 0; i < std::min(5, (int) daily.size()); i++) {
+    // Fill out as many boxes as possible, up to the number in the template
+    for (int i = 0; i < std::min(days, (int) daily.size()); i++) {
+        if (!curr_node || !curr_node->next || !curr_node->next->next) {
+            throw std::runtime_error("Template has fewer daily boxes than the profile's " + std::to_string(days));
+        }
+
         // day of week
-        strstm = std::stringstream();
-        strstm << std::put_time(localtime((time_t *) &(daily[i].timestamp)), "%a");
-        xmlNodeSetContent(curr_node, (xmlChar *) strstm.str().c_str());
+        xmlNodeSetContent(curr_node, (xmlChar *) time_format.format_weekday(daily[i].timestamp).c_str());
         curr_node = curr_node->next;
 
         // High / low
@@ -265,8 +611,9 @@ void modify_svg_daily(xmlNodePtr & group_ptr, const std::vector<DailyWeather> &
         curr_node = curr_node->next;
 
         // Icon
-        xmlSetProp(curr_node, (xmlChar *) "href", (xmlChar *) (daily[i].icon + ".svg").c_str());
-        xmlSetProp(curr_node, (xmlChar *) "xlink:href", (xmlChar *) (daily[i].icon + ".svg").c_str());
+        std::string icon = assets.get_icon(daily[i].icon);
+        xmlSetProp(curr_node, (xmlChar *) "href", (xmlChar *) icon.c_str());
+        xmlSetProp(curr_node, (xmlChar *) "xlink:href", (xmlChar *) icon.c_str());
         curr_node = curr_node->next;
     }
 }
@@ -277,8 +624,15 @@ void modify_svg_daily(xmlNodePtr & group_ptr, const std::vector<DailyWeather> &
  *
  * @param [in,out] group_ptr pointer to the group-alerts <g> node
  * @param [in] alerts alerts to display
+ * @param [in] now time the frame is shown at, as unix time
+ * @param [in] time_format formatter for the location's time zone
+ * @param [in] svg_template template the svg was copied from
+ * @param [in,out] font metrics of the template's font
  */
-void modify_svg_alerts(xmlNodePtr & group_ptr, const std::vector<WeatherAlert> & alerts) {
+void modify_svg_alerts(xmlNodePtr & group_ptr, const std::vector<WeatherAlert> & alerts, const int64_t now,
+                       const TimeFormatter & time_format, const Template & svg_template, FontMetrics & font) {
+    StageScope stage(Stage::modify_svg_alerts);
+    const double width = get_text_width(group_ptr);
     xmlNodePtr curr_node = group_ptr->children;
 
     // Hide alerts if not needed
@@ -302,23 +656,33 @@ void modify_svg_alerts(xmlNodePtr & group_ptr, const std::vector<WeatherAlert> &
 
         curr_node = curr_node->children;
 
-        // Show 1 alert (show name and time)
+        // Show 1 alert (show name and time, or just the name over both lines if it is too long for one)
         if (alerts.size() == 1) {
-            xmlNodeSetContent(curr_node, (xmlChar *) alerts[0].get_name().c_str());
-            std::stringstream strstm = std::stringstream();
-            strstm << "(" << alerts[0].get_time() << ")";
-            xmlNodeSetContent(curr_node->next, (xmlChar *) strstm.str().c_str());
+            const double size = svg_template.get_font_size(curr_node);
+            TextFit fitted = font.fit(alerts[0].get_name(), size, size * min_font_scale, width, 2);
+            xmlNodeSetContent(curr_node, (xmlChar *) fitted.lines[0].c_str());
+            if (fitted.lines.size() > 1) {
+                xmlNodeSetContent(curr_node->next, (xmlChar *) fitted.lines[1].c_str());
+                set_font_size(curr_node->next, fitted.size);
+            } else {
+                std::stringstream strstm = std::stringstream();
+                strstm << "(" << alerts[0].get_time(now, time_format) << ")";
+                xmlNodeSetContent(curr_node->next, (xmlChar *) strstm.str().c_str());
+            }
+            if (fitted.size != size) {
+                set_font_size(curr_node, fitted.size);
+            }
         }
 
         // or show 2 alerts (show both names)
         else if (alerts.size() == 2) {
-            xmlNodeSetContent(curr_node, (xmlChar *) alerts[0].get_name().c_str());
-            xmlNodeSetContent(curr_node->next, (xmlChar *) alerts[1].get_name().c_str());
+            set_fitted_text(curr_node, alerts[0].get_name(), svg_template, font, width);
+            set_fitted_text(curr_node->next, alerts[1].get_name(), svg_template, font, width);
         }
 
         // or show many alerts (show name and how many others there are)
         else {
-            xmlNodeSetContent(curr_node, (xmlChar *) alerts[0].get_name().c_str());
+            set_fitted_text(curr_node, alerts[0].get_name(), svg_template, font, width);
             std::stringstream strstm = std::stringstream();
             strstm << "(" << alerts.size() - 1 << " more alerts)";
             xmlNodeSetContent(curr_node->next, (xmlChar *) strstm.str().c_str());
@@ -329,55 +693,62 @@ void modify_svg_alerts(xmlNodePtr & group_ptr, const std::vector<WeatherAlert> &
 /**
  * Modifies template svg and adds in weather data
  *
- * @param [in] current data about current weather
- * @param [in] precipitation data about precipitation
- * @param [in] hourly hourly forecast
- * @param [in] daily daily forecast
- * @param [in] alerts alerts to show
+ * @param [in] frame forecast to show, already cut to the profile's hours and days
+ * @param [in] time_format formatter for the location's time zone
+ * @param [in] profile display profile with template, output and layout
  * @param [in] img_dir directory of images
- * @param [in] template_svg filename of template svg
- * @param [in] output_svg filename of modified svg
+ * @param [in] output_svg filename of modified svg, or an empty string to use the profile's
  */
-void modify_svg(const CurrentWeather & current, const Precipitation & precipitation,
-                const std::vector<HourlyWeather> & hourly, const std::vector<DailyWeather> & daily,
-                const std::vector<WeatherAlert> & alerts,
-                const std::string & img_dir, const std::string & template_svg, const std::string & output_svg) {
-    // Read template svg
-    xmlKeepBlanksDefault(0);  // this gets rid of whitespace text elements
-    xmlDocPtr doc = xmlReadFile((img_dir + template_svg).c_str(), nullptr, 0);
-    if (doc == nullptr) {
-        throw std::runtime_error("Failed to read template file");
-    }
+void modify_svg(const Forecast & frame, const TimeFormatter & time_format, const DisplayProfile & profile,
+                const std::string & img_dir, const std::string & output_svg) {
+    // In low-memory mode the whole document tree is freed at once when the render finishes
+    static thread_local Arena render_arena;
+    ArenaScope scope(xml_arena_installed() ? &render_arena : nullptr);
+
+    // Copy current version of template
+    std::shared_ptr<AssetStore> assets = AssetStore::get_instance(img_dir);
+    std::shared_ptr<const Template> svg_template = assets->get_template(profile.template_svg);
+    std::shared_ptr<FontMetrics> font = FontMetrics::get_instance(svg_template->get_font_family());
+
+    // Freed however the render ends, including by exceptions from the standard library
+    std::unique_ptr<xmlDoc, decltype(&xmlFreeDoc)> doc(svg_template->copy(), xmlFreeDoc);
 
     // Set up variables
-    xmlNodePtr root_element = xmlDocGetRootElement(doc);
-    xmlNodePtr group_ptr = root_element->children->next->next;
+    xmlNodePtr group_ptr;
 
     // Add current date
-    modify_svg_date(group_ptr, current.timestamp);
-    group_ptr = group_ptr->next;
+    group_ptr = svg_template->get_group(doc.get(), "group-date");
+    modify_svg_date(group_ptr, frame.current.timestamp, frame.lat, frame.lon, time_format, profile.place, *svg_template,
+                    *font);
 
     // Add current conditions
-    modify_svg_current(group_ptr, current);
-    group_ptr = group_ptr->next;
+    group_ptr = svg_template->get_group(doc.get(), "group-current");
+    modify_svg_current(group_ptr, frame.current, frame.airquality, time_format, profile, *assets, *svg_template,
+                       *font);
 
     // Add precipitation data
-    modify_svg_precipitation(group_ptr, precipitation);
-    group_ptr = group_ptr->next;
+    group_ptr = svg_template->get_group(doc.get(), "group-precipitation");
+    modify_svg_precipitation(group_ptr, frame.precipitation, frame.minutely, profile, *assets);
 
     // Add hourly forecast
-    modify_svg_hourly(group_ptr, hourly);
-    group_ptr = group_ptr->next;
+    group_ptr = svg_template->get_group(doc.get(), "group-hourly");
+    modify_svg_hourly(group_ptr, frame.hourly, time_format, profile);
 
     // Add daily forecast
-    modify_svg_daily(group_ptr, daily);
-    group_ptr = group_ptr->next;
+    group_ptr = svg_template->get_group(doc.get(), "group-daily");
+    modify_svg_daily(group_ptr, frame.daily, time_format, profile.days, *assets);
 
     // Add alerts
-    modify_svg_alerts(group_ptr, alerts);
-    group_ptr = group_ptr->next;
+    group_ptr = svg_template->get_group(doc.get(), "group-alerts");
+    modify_svg_alerts(group_ptr, frame.alerts, frame.current.timestamp, time_format, *svg_template, *font);
+
+    // Shrink svg for faster serialization and rasterization
+    if (profile.optimize) {
+        StageScope stage(Stage::optimize_svg);
+        optimize_svg(doc.get());
+    }
 
     // Save changes to a new svg file
-    xmlSaveFileEnc((img_dir + output_svg).c_str(), doc, "UTF-8");
-    xmlFreeDoc(doc);
-}
\ No newline at end of file
+    StageScope stage(Stage::serialize);
+    xmlSaveFileEnc((img_dir + (output_svg.empty() ? profile.output_svg : output_svg)).c_str(), doc.get(), "UTF-8");
+}
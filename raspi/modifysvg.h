@@ -2,11 +2,11 @@
 #define NOOK_WEATHER_MODIFYSVG_H
 
 #include <vector>
+#include "profile.h"
+#include "timeformat.h"
 #include "weathertypes.h"
 
-void modify_svg(const CurrentWeather & current, const Precipitation & precipitation,
-                const std::vector<HourlyWeather> & hourly, const std::vector<DailyWeather> & daily,
-                const std::vector<WeatherAlert> & alerts,
-                const std::string & img_dir, const std::string & template_svg, const std::string & output_svg);
+void modify_svg(const Forecast & frame, const TimeFormatter & time_format, const DisplayProfile & profile,
+                const std::string & img_dir, const std::string & output_svg = "");
 
 #endif //NOOK_WEATHER_MODIFYSVG_H
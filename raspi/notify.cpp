@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "notify.h"
+
+static const size_t max_request_size = 4096;                 // Units: bytes
+static const std::chrono::seconds request_timeout(10);      // Time a client gets to send its request
+
+/**
+ * Builds an epoll event for a file descriptor
+ *
+ * @param [in] events events to wait for
+ * @param [in] fd file descriptor
+ * @return event
+ */
+static epoll_event get_event(const uint32_t events, const int fd) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    return event;
+}
+
+/**
+ * Gets the value of a query parameter
+ *
+ * @param [in] query query string, without the "?"
+ * @param [in] name parameter name
+ * @param [out] value value of parameter
+ * @return true if the parameter is present
+ */
+static bool get_parameter(const std::string & query, const std::string & name, std::string & value) {
+    std::stringstream params(query);
+    std::string param;
+    while (std::getline(params, param, '&')) {
+        if (param.compare(0, name.size() + 1, name + "=") == 0) {
+            value = param.substr(name.size() + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Creates a server that lets displays wait for a new image instead of polling for one
+ *
+ * @param [in] port TCP port to listen on
+ * @param [in] max_wait longest a client may wait for a change, in seconds
+ */
+NotifyServer::NotifyServer(const int port, const int max_wait)
+        : port(port), max_wait(std::max(1, max_wait)), epoch((uint64_t) std::time(nullptr)) {}
+
+NotifyServer::~NotifyServer() {
+    if (server.joinable()) {
+        stopping = true;
+        uint64_t stop = 1;
+        write(wake_fd, &stop, sizeof(stop));
+        server.join();
+    }
+    for (auto & connection : connections) {
+        close(connection.first);
+    }
+    for (int fd : {listen_fd, epoll_fd, wake_fd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+/**
+ * Starts listening, and serves every connection from one event loop on its own thread
+ * Each waiting display holds a file descriptor, so the limit on them is raised as far as allowed
+ */
+void NotifyServer::start() {
+    if (server.joinable()) {
+        return;
+    }
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int on = 1;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t) port);
+    epoll_event listen_event = get_event(EPOLLIN, listen_fd);
+    epoll_event wake_event = get_event(EPOLLIN, wake_fd);
+    if (listen_fd < 0 || epoll_fd < 0 || wake_fd < 0
+        || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+        || bind(listen_fd, (sockaddr *) &address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) < 0
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake_event) < 0) {
+        throw std::runtime_error("Failed to listen for notify requests on port " + std::to_string(port));
+    }
+    server = std::thread(&NotifyServer::serve, this);
+}
+
+/**
+ * Records that a device's image was written, waking its waiting clients if the image is different
+ * Re-renders often write the same image again, and those don't count as a change
+ *
+ * @param [in] device name of display profile
+ * @param [in] image contents of the image the device fetches
+ * @return true if the image changed
+ */
+bool NotifyServer::publish(const std::string & device, const std::string & image) {
+    size_t hash = std::hash<std::string>()(image);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = devices.find(device);
+    if (found == devices.end()) {
+        found = devices.emplace(device, Device{epoch, 0}).first;
+    } else if (found->second.hash == hash) {
+        return false;
+    }
+    found->second.sequence++;
+    found->second.hash = hash;
+    changed.insert(device);
+    if (wake_fd >= 0) {
+        uint64_t wake = 1;
+        write(wake_fd, &wake, sizeof(wake));
+    }
+    return true;
+}
+
+/**
+ * Gets the latest sequence of a device
+ * Sequences start from the time the server started, so a client holding one from an earlier run sees a change
+ *
+ * @param [in] device name of display profile
+ * @return sequence
+ */
+uint64_t NotifyServer::get_sequence(const std::string & device) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = devices.find(device);
+    return found == devices.end() ? epoch : found->second.sequence;
+}
+
+/**
+ * Runs the event loop until the server is destroyed
+ * The loop sleeps until a socket is ready, an image is published, or the earliest deadline passes
+ */
+void NotifyServer::serve() {
+    epoll_event events[64];
+    while (!stopping) {
+        int count = epoll_wait(epoll_fd, events, 64, expire());
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                uint64_t wakes;
+                read(wake_fd, &wakes, sizeof(wakes));
+                wake_devices();
+                continue;
+            } else if (fd == listen_fd) {
+                accept_connections();
+                continue;
+            }
+
+            auto connection = connections.find(fd);
+            if (connection == connections.end()) {
+                continue;
+            }
+            // A client that hangs up shows up as a read of nothing
+            if (events[i].events & EPOLLOUT) {
+                write_response(fd, connection->second);
+            } else if (events[i].events & EPOLLIN) {
+                read_request(fd, connection->second);
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(fd);
+            }
+        }
+    }
+}
+
+/**
+ * Accepts every pending connection
+ * When out of file descriptors, stops listening until a connection closes rather than spinning on the backlog
+ */
+void NotifyServer::accept_connections() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                epoll_event event = get_event(0, listen_fd);
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &event);
+                accepting = false;
+            }
+            return;
+        }
+        epoll_event event = get_event(EPOLLIN, fd);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            continue;
+        }
+        Connection & connection = connections[fd];
+        connection.deadline = deadlines.emplace(std::chrono::steady_clock::now() + request_timeout, fd);
+    }
+}
+
+/**
+ * Reads as much of a request as has arrived, handling it once the headers are complete
+ *
+ * @param [in] fd socket
+ * @param [in,out] connection connection state
+ */
+void NotifyServer::read_request(const int fd, Connection & connection) {
+    char buffer[1024];
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR)) {
+        close_connection(fd);
+        return;
+    }
+    if (length < 0 || !connection.device.empty() || !connection.response.empty()) {
+        // Anything sent after the request is ignored
+        return;
+    }
+    connection.request.append(buffer, (size_t) length);
+    if (connection.request.find("\r\n\r\n") != std::string::npos) {
+        handle_request(fd, connection);
+    } else if (connection.request.size() > max_request_size) {
+        respond(fd, connection, "431 Request Header Fields Too Large", 0, false);
+    }
+}
+
+/**
+ * Answers a request, or parks it until its device changes
+ * GET /sequence/<device> answers with the device's sequence straight away
+ * GET /wait/<device>?seq=<sequence>&timeout=<seconds> answers as soon as the sequence differs from the one given,
+ * or with 304 Not Modified once the timeout passes
+ *
+ * @param [in] fd socket
+ * @param [in,out] connection connection state
+ */
+void NotifyServer::handle_request(const int fd, Connection & connection) {
+    std::stringstream request_line(connection.request.substr(0, connection.request.find("\r\n")));
+    std::string method;
+    std::string target;
+    request_line >> method >> target;
+    connection.request.clear();
+    if (method != "GET") {
+        respond(fd, connection, "405 Method Not Allowed", 0, false);
+        return;
+    }
+
+    size_t query_start = target.find('?');
+    std::string path = target.substr(0, query_start);
+    std::string query = query_start == std::string::npos ? "" : target.substr(query_start + 1);
+    bool wait = path.compare(0, 6, "/wait/") == 0;
+    bool sequence = path.compare(0, 10, "/sequence/") == 0;
+    if (!wait && !sequence) {
+        respond(fd, connection, "404 Not Found", 0, false);
+        return;
+    }
+    std::string device = path.substr(wait ? 6 : 10);
+    uint64_t current = get_sequence(device);
+
+    // Clients without a sequence haven't seen anything yet
+    std::string seen;
+    std::string timeout;
+    if (sequence || !get_parameter(query, "seq", seen) || seen != std::to_string(current)) {
+        respond(fd, connection, "200 OK", current, true);
+        return;
+    }
+    int seconds = max_wait;
+    if (get_parameter(query, "timeout", timeout)) {
+        seconds = std::min(max_wait, std::max(1, std::atoi(timeout.c_str())));
+    }
+
+    connection.device = device;
+    connection.seen = current;
+    waiting[device].insert(fd);
+    deadlines.erase(connection.deadline);
+    connection.deadline = deadlines.emplace(std::chrono::steady_clock::now() + std::chrono::seconds(seconds), fd);
+}
+
+/**
+ * Starts sending a response; the connection closes once it is sent
+ *
+ * @param [in] fd socket
+ * @param [in,out] connection connection state
+ * @param [in] status HTTP status line, e.g. "200 OK"
+ * @param [in] sequence sequence to send back
+ * @param [in] body include the sequence as the body as well as a header
+ */
+void NotifyServer::respond(const int fd, Connection & connection, const char *status, const uint64_t sequence,
+                           const bool body) {
+    std::string content = body ? std::to_string(sequence) + "\n" : "";
+    std::stringstream response;
+    response << "HTTP/1.1 " << status << "\r\nContent-Type: text/plain\r\nCache-Control: no-store\r\n";
+    if (sequence > 0) {
+        response << "X-Sequence: " << sequence << "\r\n";
+    }
+    if (status[0] != '3') {
+        response << "Content-Length: " << content.size() << "\r\n";
+    }
+    response << "Connection: close\r\n\r\n" << content;
+    connection.response = response.str();
+    connection.sent = 0;
+
+    stop_waiting(fd, connection);
+    write_response(fd, connection);
+}
+
+/**
+ * Sends as much of a response as the socket takes, closing the connection once it is all sent
+ *
+ * @param [in] fd socket
+ * @param [in,out] connection connection state
+ */
+void NotifyServer::write_response(const int fd, Connection & connection) {
+    while (connection.sent < connection.response.size()) {
+        ssize_t length = send(fd, connection.response.data() + connection.sent,
+                              connection.response.size() - connection.sent, MSG_NOSIGNAL);
+        if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+            // Finish when the socket has room
+            epoll_event event = get_event(EPOLLOUT, fd);
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+            return;
+        } else if (length < 0) {
+            break;
+        }
+        connection.sent += (size_t) length;
+    }
+    close_connection(fd);
+}
+
+/**
+ * Stops a connection waiting on its device
+ *
+ * @param [in] fd socket
+ * @param [in,out] connection connection state
+ */
+void NotifyServer::stop_waiting(const int fd, Connection & connection) {
+    if (connection.device.empty()) {
+        return;
+    }
+    auto device = waiting.find(connection.device);
+    device->second.erase(fd);
+    if (device->second.empty()) {
+        waiting.erase(device);
+    }
+    connection.device.clear();
+}
+
+/**
+ * Closes a connection and forgets it
+ *
+ * @param [in] fd socket
+ */
+void NotifyServer::close_connection(const int fd) {
+    auto connection = connections.find(fd);
+    if (connection == connections.end()) {
+        return;
+    }
+    stop_waiting(fd, connection->second);
+    deadlines.erase(connection->second.deadline);
+    connections.erase(connection);
+    close(fd);
+
+    if (!accepting) {
+        epoll_event event = get_event(EPOLLIN, listen_fd);
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &event);
+        accepting = true;
+    }
+}
+
+/**
+ * Answers every client waiting on a device that was published since the last look
+ */
+void NotifyServer::wake_devices() {
+    std::set<std::string> devices_changed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        devices_changed.swap(changed);
+    }
+    for (const std::string & device : devices_changed) {
+        auto found = waiting.find(device);
+        if (found == waiting.end()) {
+            continue;
+        }
+        uint64_t current = get_sequence(device);
+        std::set<int> fds = found->second;
+        for (int fd : fds) {
+            Connection & connection = connections[fd];
+            if (connection.seen != current) {
+                respond(fd, connection, "200 OK", current, true);
+            }
+        }
+    }
+}
+
+/**
+ * Gives up on requests that took too long to arrive, and answers waits that timed out
+ *
+ * @return milliseconds until the next deadline, or -1 if there is none
+ */
+int NotifyServer::expire() {
+    TimePoint now = std::chrono::steady_clock::now();
+    while (!deadlines.empty() && deadlines.begin()->first <= now) {
+        int fd = deadlines.begin()->second;
+        Connection & connection = connections[fd];
+        if (connection.device.empty()) {
+            close_connection(fd);
+        } else {
+            respond(fd, connection, "304 Not Modified", connection.seen, false);
+        }
+    }
+    if (deadlines.empty()) {
+        return -1;
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadlines.begin()->first - now);
+    return (int) wait.count() + 1;
+}
@@ -0,0 +1,67 @@
+#ifndef NOOK_WEATHER_NOTIFY_H
+#define NOOK_WEATHER_NOTIFY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+class NotifyServer {
+public:
+    NotifyServer(int port, int max_wait);
+    ~NotifyServer();
+    NotifyServer(const NotifyServer &) = delete;
+    NotifyServer & operator=(const NotifyServer &) = delete;
+    void start();                                           // Start serving on a thread
+    bool publish(const std::string & device, const std::string & image);     // Bump sequence if image changed
+    uint64_t get_sequence(const std::string & device);      // Latest sequence published for a device
+private:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    typedef std::multimap<TimePoint, int>::iterator Deadline;
+    struct Device {
+        uint64_t sequence;                                  // Changes every time a different image is published
+        size_t hash;                                        // Hash of the last image published
+    };
+    struct Connection {
+        std::string request;                                // Request read so far
+        std::string response;                               // Response to send (empty until there is one)
+        size_t sent = 0;                                    // Units: bytes of response already sent
+        std::string device;                                 // Device waited on (empty if not waiting)
+        uint64_t seen = 0;                                  // Sequence the client already has
+        Deadline deadline;                                  // When to give up reading or waiting
+    };
+    int port;
+    int max_wait;                                           // Units: seconds
+    uint64_t epoch;                                         // Sequence every device starts at
+    std::mutex mutex;
+    std::map<std::string, Device> devices;
+    std::set<std::string> changed;                          // Devices published since the server last looked
+    std::atomic<bool> stopping{false};
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    bool accepting = true;                                  // False while out of file descriptors
+    std::thread server;
+
+    // Only touched by the server thread
+    std::unordered_map<int, Connection> connections;
+    std::multimap<TimePoint, int> deadlines;
+    std::map<std::string, std::set<int>> waiting;           // Connections waiting on each device
+    void serve();
+    void accept_connections();
+    void read_request(int fd, Connection & connection);
+    void handle_request(int fd, Connection & connection);
+    void respond(int fd, Connection & connection, const char *status, uint64_t sequence, bool body);
+    void write_response(int fd, Connection & connection);
+    void stop_waiting(int fd, Connection & connection);
+    void close_connection(int fd);
+    void wake_devices();
+    int expire();
+};
+
+#endif //NOOK_WEATHER_NOTIFY_H
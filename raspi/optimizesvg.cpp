@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "optimizesvg.h"
+
+typedef std::vector<std::pair<std::string, std::string>> Declarations;
+
+struct StyleRule {
+    std::string element;        // Element name to match, or empty for class rules
+    std::string class_name;     // Class name to match, or empty for element rules
+    Declarations declarations;
+};
+
+/**
+ * Removes whitespace from both ends of a string
+ *
+ * @param [in] str string to trim
+ * @return trimmed string
+ */
+static std::string trim(const std::string & str) {
+    size_t start = str.find_first_not_of(" \t\r\n");
+    size_t end = str.find_last_not_of(" \t\r\n");
+    return start == std::string::npos ? std::string() : str.substr(start, end - start + 1);
+}
+
+/**
+ * Gets an attribute of a node as a string
+ *
+ * @param [in] node node to get attribute from
+ * @param [in] name attribute name
+ * @return attribute value, or an empty string if not present
+ */
+static std::string get_prop(xmlNodePtr node, const char *name) {
+    xmlChar *value = xmlGetProp(node, (xmlChar *) name);
+    if (value == nullptr) {
+        return std::string();
+    }
+    std::string result((char *) value);
+    xmlFree(value);
+    return result;
+}
+
+/**
+ * Gets a coordinate attribute of a node, which defaults to 0 when not present
+ *
+ * @param [in] node node to get attribute from
+ * @param [in] name attribute name
+ * @return coordinate as written in the attribute
+ */
+static std::string get_coordinate(xmlNodePtr node, const char *name) {
+    std::string value = get_prop(node, name);
+    return value.empty() ? "0" : value;
+}
+
+/**
+ * Checks if a node is an element with a given name
+ *
+ * @param [in] node node to check
+ * @param [in] name element name
+ * @return true if node is a matching element
+ */
+static bool is_element(xmlNodePtr node, const char *name) {
+    return node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, (xmlChar *) name) == 0;
+}
+
+/**
+ * Formats a number with at most a given number of decimal places, dropping trailing zeros
+ *
+ * @param [in] value number to format
+ * @param [in] precision maximum number of decimal places
+ * @return formatted number
+ */
+static std::string format_number(const double value, const int precision) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", precision, value);
+    std::string result(buf);
+    if (result.find('.') != std::string::npos) {
+        result.erase(result.find_last_not_of('0') + 1);
+        if (result.back() == '.') {
+            result.pop_back();
+        }
+    }
+    return result == "-0" ? "0" : result;
+}
+
+/**
+ * Rounds every number in an attribute value (coordinates, point lists, path data)
+ *
+ * @param [in] value attribute value
+ * @param [in] precision maximum number of decimal places
+ * @return attribute value with numbers rounded
+ */
+static std::string round_numbers(const std::string & value, const int precision) {
+    std::string result;
+    const char *pos = value.c_str();
+    while (*pos) {
+        // Copy anything that can't start a number
+        if (!(isdigit(*pos) || ((*pos == '-' || *pos == '.') && (isdigit(pos[1]) || pos[1] == '.')))) {
+            result += *pos++;
+            continue;
+        }
+        char *end;
+        double number = strtod(pos, &end);
+        result += format_number(number, precision);
+        pos = end;
+    }
+    return result;
+}
+
+/**
+ * Parses style declarations ("prop:value;prop:value")
+ *
+ * @param [in] style declaration block
+ * @param [in,out] declarations declarations to add to, replacing earlier values of the same property
+ */
+static void parse_declarations(const std::string & style, Declarations & declarations) {
+    std::stringstream stream(style);
+    std::string declaration;
+    while (std::getline(stream, declaration, ';')) {
+        size_t colon = declaration.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string property = trim(declaration.substr(0, colon));
+        std::string value = trim(declaration.substr(colon + 1));
+        bool replaced = false;
+        for (auto & existing : declarations) {
+            if (existing.first == property) {
+                existing.second = value;
+                replaced = true;
+            }
+        }
+        if (!replaced) {
+            declarations.emplace_back(property, value);
+        }
+    }
+}
+
+/**
+ * Parses a stylesheet made of element and class selectors
+ *
+ * @param [in] css stylesheet text
+ * @param [out] rules parsed rules, in stylesheet order
+ * @return false if the stylesheet uses selectors that can't be inlined
+ */
+static bool parse_stylesheet(std::string css, std::vector<StyleRule> & rules) {
+    // Strip comments
+    size_t comment;
+    while ((comment = css.find("/*")) != std::string::npos) {
+        size_t comment_end = css.find("*/", comment);
+        css.erase(comment, comment_end == std::string::npos ? std::string::npos : comment_end + 2 - comment);
+    }
+
+    std::stringstream stream(css);
+    std::string block;
+    while (std::getline(stream, block, '}')) {
+        size_t brace = block.find('{');
+        if (brace == std::string::npos) {
+            if (!trim(block).empty()) {
+                return false;
+            }
+            continue;
+        }
+
+        Declarations declarations;
+        parse_declarations(block.substr(brace + 1), declarations);
+
+        // One rule per selector in a selector list
+        std::stringstream selectors(block.substr(0, brace));
+        std::string selector;
+        while (std::getline(selectors, selector, ',')) {
+            selector = trim(selector);
+            if (selector.empty() || selector.find_first_of(" >+~:[#*@") != std::string::npos
+                || selector.find('.', 1) != std::string::npos) {
+                return false;
+            }
+            if (selector[0] == '.') {
+                rules.push_back(StyleRule{"", selector.substr(1), declarations});
+            } else {
+                rules.push_back(StyleRule{selector, "", declarations});
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes resolved stylesheet declarations into each element's style attribute
+ * Element rules apply first, then class rules, then the element's own style attribute, matching CSS specificity
+ *
+ * @param [in,out] node subtree to inline styles in
+ * @param [in] rules parsed stylesheet
+ */
+static void inline_styles(xmlNodePtr node, const std::vector<StyleRule> & rules) {
+    for (xmlNodePtr child = node; child; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+
+        // Split class list
+        std::vector<std::string> classes;
+        std::stringstream class_stream(get_prop(child, "class"));
+        std::string class_name;
+        while (class_stream >> class_name) {
+            classes.push_back(class_name);
+        }
+
+        Declarations declarations;
+        for (const StyleRule & rule : rules) {
+            if (rule.class_name.empty() && xmlStrcmp(child->name, (xmlChar *) rule.element.c_str()) == 0) {
+                for (const auto & declaration : rule.declarations) {
+                    parse_declarations(declaration.first + ":" + declaration.second, declarations);
+                }
+            }
+        }
+        for (const StyleRule & rule : rules) {
+            if (!rule.class_name.empty() && std::find(classes.begin(), classes.end(), rule.class_name) != classes.end()) {
+                for (const auto & declaration : rule.declarations) {
+                    parse_declarations(declaration.first + ":" + declaration.second, declarations);
+                }
+            }
+        }
+        parse_declarations(get_prop(child, "style"), declarations);
+
+        // Replace class with resolved style
+        if (!declarations.empty()) {
+            std::string style;
+            for (const auto & declaration : declarations) {
+                style += (style.empty() ? "" : ";") + declaration.first + ":" + declaration.second;
+            }
+            xmlSetProp(child, (xmlChar *) "style", (xmlChar *) style.c_str());
+        }
+        xmlUnsetProp(child, (xmlChar *) "class");
+
+        inline_styles(child->children, rules);
+    }
+}
+
+/**
+ * Checks if any element in a subtree sets a presentation attribute
+ *
+ * @param [in] node first node of sibling list to check
+ * @param [in] name attribute name
+ * @return true if any element has the attribute
+ */
+static bool has_attribute(xmlNodePtr node, const char *name) {
+    for (; node; node = node->next) {
+        if (node->type == XML_ELEMENT_NODE && (xmlHasProp(node, (xmlChar *) name) || has_attribute(node->children, name))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Moves font declarations from element rules to the root element, where they are inherited once
+ * instead of being repeated on every text element; fonts don't affect anything that isn't text
+ *
+ * @param [in,out] root root <svg> node
+ * @param [in,out] rules parsed stylesheet
+ */
+static void hoist_font_declarations(xmlNodePtr root, std::vector<StyleRule> & rules) {
+    static const char *font_properties[] = {"font-family", "font-style", "font-weight", "font-variant"};
+    Declarations hoisted;
+    for (StyleRule & rule : rules) {
+        if (!rule.class_name.empty()) {
+            continue;
+        }
+        for (auto it = rule.declarations.begin(); it != rule.declarations.end();) {
+            bool is_font = std::find_if(std::begin(font_properties), std::end(font_properties), [&](const char *name) {
+                return it->first == name;
+            }) != std::end(font_properties);
+
+            // Presentation attributes would win over an inherited value but lose to the stylesheet
+            if (is_font && !has_attribute(root, it->first.c_str())) {
+                parse_declarations(it->first + ":" + it->second, hoisted);
+                it = rule.declarations.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    if (!hoisted.empty()) {
+        parse_declarations(get_prop(root, "style"), hoisted);
+        std::string style;
+        for (const auto & declaration : hoisted) {
+            style += (style.empty() ? "" : ";") + declaration.first + ":" + declaration.second;
+        }
+        xmlSetProp(root, (xmlChar *) "style", (xmlChar *) style.c_str());
+    }
+}
+
+/**
+ * Finds the <style> element, inlines it into every element, and removes it
+ *
+ * @param [in,out] root root <svg> node
+ */
+static void inline_stylesheet(xmlNodePtr root) {
+    for (xmlNodePtr defs = root->children; defs; defs = defs->next) {
+        if (!is_element(defs, "defs")) {
+            continue;
+        }
+        for (xmlNodePtr style = defs->children; style; style = style->next) {
+            if (!is_element(style, "style")) {
+                continue;
+            }
+
+            // Leave stylesheets we can't fully resolve alone
+            xmlChar *content = xmlNodeGetContent(style);
+            std::vector<StyleRule> rules;
+            bool parsed = parse_stylesheet((char *) content, rules);
+            xmlFree(content);
+            if (!parsed) {
+                return;
+            }
+
+            hoist_font_declarations(root, rules);
+            inline_styles(root->children, rules);
+            xmlUnlinkNode(style);
+            xmlFreeNode(style);
+            break;
+        }
+
+        // Drop <defs> if nothing else is in it
+        if (xmlFirstElementChild(defs) == nullptr) {
+            xmlUnlinkNode(defs);
+            xmlFreeNode(defs);
+        }
+        return;
+    }
+}
+
+/**
+ * Removes groups that are hidden or have nothing in them
+ *
+ * @param [in,out] node first node of sibling list to clean up
+ */
+static void remove_hidden_groups(xmlNodePtr node) {
+    while (node) {
+        xmlNodePtr next = node->next;
+        if (node->type == XML_ELEMENT_NODE) {
+            remove_hidden_groups(node->children);
+
+            std::string style = get_prop(node, "style");
+            bool hidden = get_prop(node, "visibility") == "hidden" || get_prop(node, "display") == "none"
+                          || style.find("visibility:hidden") != std::string::npos
+                          || style.find("display:none") != std::string::npos;
+            bool empty = is_element(node, "g") && xmlFirstElementChild(node) == nullptr;
+            if (hidden || empty) {
+                xmlUnlinkNode(node);
+                xmlFreeNode(node);
+            }
+        }
+        node = next;
+    }
+}
+
+/**
+ * Merges runs of connected <line> elements with the same class into a single <path>
+ *
+ * @param [in,out] node first node of sibling list to merge lines in
+ */
+static void merge_lines(xmlNodePtr node) {
+    for (; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        merge_lines(node->children);
+        if (!is_element(node, "line")) {
+            continue;
+        }
+
+        // Follow the run of lines that continue from where the previous one ended
+        std::string line_class = get_prop(node, "class");
+        std::string d = "M" + get_coordinate(node, "x1") + " " + get_coordinate(node, "y1")
+                        + "L" + get_coordinate(node, "x2") + " " + get_coordinate(node, "y2");
+        int merged = 0;
+        xmlNodePtr next;
+        while ((next = xmlNextElementSibling(node)) && is_element(next, "line")
+               && get_prop(next, "class") == line_class && get_prop(next, "style") == get_prop(node, "style")
+               && strtod(get_coordinate(next, "x1").c_str(), nullptr) == strtod(get_coordinate(node, "x2").c_str(), nullptr)
+               && strtod(get_coordinate(next, "y1").c_str(), nullptr) == strtod(get_coordinate(node, "y2").c_str(), nullptr)) {
+            d += "L" + get_coordinate(next, "x2") + " " + get_coordinate(next, "y2");
+            xmlSetProp(node, (xmlChar *) "x2", (xmlChar *) get_coordinate(next, "x2").c_str());
+            xmlSetProp(node, (xmlChar *) "y2", (xmlChar *) get_coordinate(next, "y2").c_str());
+            xmlUnlinkNode(next);
+            xmlFreeNode(next);
+            merged++;
+        }
+        if (merged == 0) {
+            continue;
+        }
+
+        // Turn first line into a path; lines are never filled but paths are by default
+        xmlNodeSetName(node, (xmlChar *) "path");
+        for (const char *name : {"x1", "y1", "x2", "y2"}) {
+            xmlUnsetProp(node, (xmlChar *) name);
+        }
+        xmlSetProp(node, (xmlChar *) "d", (xmlChar *) d.c_str());
+        std::string style = get_prop(node, "style");
+        xmlSetProp(node, (xmlChar *) "style", (xmlChar *) ("fill:none" + (style.empty() ? "" : ";" + style)).c_str());
+    }
+}
+
+/**
+ * Collects every "#id" reference in a subtree (href="#id", url(#id))
+ *
+ * @param [in] node first node of sibling list to search
+ * @param [in,out] references text of every attribute that contains a reference
+ */
+static void collect_references(xmlNodePtr node, std::string & references) {
+    for (; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+            std::string value = get_prop(node, (const char *) attr->name);
+            if (value.find('#') != std::string::npos) {
+                references += value + " ";
+            }
+        }
+        collect_references(node->children, references);
+    }
+}
+
+/**
+ * Removes ids that nothing refers to, keeping group ids so consumers can still find each section
+ *
+ * @param [in,out] node first node of sibling list to remove ids from
+ * @param [in] references text of every attribute that contains a reference
+ */
+static void remove_unused_ids(xmlNodePtr node, const std::string & references) {
+    for (; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        std::string id = get_prop(node, "id");
+        if (!id.empty() && !is_element(node, "g") && references.find("#" + id) == std::string::npos) {
+            xmlUnsetProp(node, (xmlChar *) "id");
+        }
+        remove_unused_ids(node->children, references);
+    }
+}
+
+/**
+ * Rounds coordinates in the subtree to display precision
+ *
+ * @param [in,out] node first node of sibling list to round coordinates in
+ * @param [in] precision maximum number of decimal places
+ */
+static void round_coordinates(xmlNodePtr node, const int precision) {
+    static const char *coordinate_attrs[] = {"x", "y", "x1", "y1", "x2", "y2", "cx", "cy", "r",
+                                             "width", "height", "points", "d"};
+    for (; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        for (const char *name : coordinate_attrs) {
+            std::string value = get_prop(node, name);
+            if (!value.empty()) {
+                xmlSetProp(node, (xmlChar *) name, (xmlChar *) round_numbers(value, precision).c_str());
+            }
+        }
+
+        // Opacity only needs enough precision for grey levels
+        std::string opacity = get_prop(node, "opacity");
+        if (!opacity.empty()) {
+            xmlSetProp(node, (xmlChar *) "opacity", (xmlChar *) round_numbers(opacity, 2).c_str());
+        }
+
+        round_coordinates(node->children, precision);
+    }
+}
+
+/**
+ * Shrinks a rendered svg before it is saved and rasterized
+ * Connected lines become one path, coordinates are rounded, hidden and empty groups are dropped,
+ * unreferenced ids are removed, and the stylesheet is resolved into style attributes
+ *
+ * @param [in,out] doc rendered svg document
+ * @param [in] precision maximum number of decimal places in coordinates
+ */
+void optimize_svg(xmlDocPtr doc, const int precision) {
+    xmlNodePtr root = xmlDocGetRootElement(doc);
+    if (root == nullptr) {
+        return;
+    }
+
+    round_coordinates(root, precision);
+    merge_lines(root->children);
+    remove_hidden_groups(root->children);
+    std::string references;
+    collect_references(root, references);
+    remove_unused_ids(root, references);
+    inline_stylesheet(root);
+}
@@ -0,0 +1,8 @@
+#ifndef NOOK_WEATHER_OPTIMIZESVG_H
+#define NOOK_WEATHER_OPTIMIZESVG_H
+
+#include <libxml/tree.h>
+
+void optimize_svg(xmlDocPtr doc, int precision = 1);
+
+#endif //NOOK_WEATHER_OPTIMIZESVG_H
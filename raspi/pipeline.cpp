@@ -0,0 +1,431 @@
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "api-openweathermap.h"
+#include "arena.h"
+#include "fetch.h"
+#include "flightrecorder.h"
+#include "framechannel.h"
+#include "history.h"
+#include "modifysvg.h"
+#include "pipeline.h"
+#include "prerender.h"
+#include "snapshot.h"
+
+extern char **environ;
+
+/**
+ * Generates the svg for one display profile and works out when to refresh
+ *
+ * @param [in] settings program settings
+ * @param [in] profile display profile to render
+ * @param [in] forecast decoded forecast
+ * @param [in] hour index into the hourly forecast of the hour to show (0 is now)
+ * @param [in] observation local sensor reading to show as current conditions (pre-rendered frames don't use it)
+ * @param [in] policy refresh policy
+ * @return next refresh as unix time
+ */
+int64_t render_profile(const Settings & settings, const DisplayProfile & profile, const Forecast & forecast,
+                       const size_t hour, const Observation & observation, const RefreshPolicy & policy) {
+    std::shared_ptr<TimeFormatter> time_format = TimeFormatter::get_instance(forecast.timezone, forecast.timezone_offset);
+
+    // Every frame needs a full hourly graph
+    size_t hours = std::min(forecast.hourly.size(), (size_t) profile.hours);
+    Forecast shown = get_frame_forecast(forecast, std::min(hour, forecast.hourly.size() - hours),
+                                        profile.hours, profile.days);
+    apply_observation(shown.current, observation, settings.sensor_blend);
+
+    // Use extracted information to create a svg
+    modify_svg(shown, *time_format, profile, settings.img_dir);
+
+    // Hourly data past the graph is still useful for spotting upcoming changes
+    Forecast now = get_frame_forecast(forecast, hour, 0, 0);
+    return policy.get_next_refresh(std::time(nullptr), now.precipitation, forecast.hourly, now.alerts, *time_format);
+}
+
+/**
+ * Runs the rasterize command on a profile's generated svg, writing to a temporary png
+ *
+ * @param [in] settings program settings
+ * @param [in] profile display profile whose svg was generated
+ */
+void rasterize_profile(const Settings & settings, const DisplayProfile & profile) {
+    if (settings.rasterize.empty()) {
+        return;
+    }
+    std::string svg = settings.img_dir + profile.output_svg;
+    std::string png = std::filesystem::path(svg).replace_extension(".png").string() + ".tmp";
+
+    // Pass filenames as arguments so they are never parsed by the shell
+    const char *argv[] = {"sh", "-c", settings.rasterize.c_str(), "sh", svg.c_str(), png.c_str(), nullptr};
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, "/bin/sh", nullptr, nullptr, (char **) argv, environ) != 0
+        || waitpid(pid, &status, 0) != pid) {
+        throw std::runtime_error("Unable to run rasterize command");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Rasterize command failed for " + profile.output_svg);
+    }
+}
+
+/**
+ * Moves a profile's rasterized png into place, then lets anything waiting on the profile know
+ *
+ * @param [in] settings program settings
+ * @param [in] profile display profile whose image was written
+ */
+void publish_profile(const Settings & settings, const DisplayProfile & profile) {
+    if (!settings.rasterize.empty()) {
+        std::string png = std::filesystem::path(settings.img_dir + profile.output_svg).replace_extension(".png");
+        std::error_code error;
+        std::filesystem::rename(png + ".tmp", png, error);
+        if (error) {
+            throw std::runtime_error("Unable to publish " + png);
+        }
+    }
+    notify_published(settings, profile);
+}
+
+/**
+ * Lets displays waiting on a profile, and processes reading its frames from shared memory, know its image was written
+ * Displays are sent the png when there is a rasterize command, otherwise the svg
+ *
+ * @param [in] settings program settings
+ * @param [in] profile display profile whose image was written
+ */
+void notify_published(const Settings & settings, const DisplayProfile & profile) {
+    if (!settings.notify && settings.shm_frame_size == 0) {
+        return;
+    }
+    std::string svg = settings.img_dir + profile.output_svg;
+    std::string image_file = svg;
+    if (!settings.rasterize.empty()) {
+        image_file = std::filesystem::path(svg).replace_extension(".png").string();
+    }
+    std::ifstream file(image_file, std::ios::binary);
+    if (!file) {
+        return;
+    }
+    std::stringstream image;
+    image << file.rdbuf();
+
+    if (settings.notify) {
+        settings.notify->publish(profile.name, image.str());
+    }
+    if (settings.shm_frame_size > 0) {
+        try {
+            if (!FrameChannel::get_instance(profile.name, settings.shm_frame_size)->publish(image.str(), svg)) {
+                std::cerr << "error: " << image_file << " is too large for shared memory frames" << std::endl;
+                record_event(FlightEventType::anomaly, (int64_t) image.str().size(), "frame too large for shm");
+            }
+        } catch (std::runtime_error &e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            record_event(FlightEventType::error, 0, e.what());
+        }
+    }
+}
+
+/**
+ * Creates a pipeline to refresh every location in settings
+ * Each CPU-bound stage gets settings.workers threads and a queue twice that deep
+ *
+ * @param [in] settings program settings
+ * @param [in] policy refresh policy
+ * @param [in,out] memory_report report to record peak memory of each stage in
+ */
+Pipeline::Pipeline(const Settings & settings, const RefreshPolicy & policy, MemoryReport & memory_report)
+        : settings(settings), policy(policy), memory_report(memory_report),
+          decode_queue(2 * settings.workers), render_queue(2 * settings.workers),
+          rasterize_queue(2 * settings.workers), publish_queue(2 * settings.workers) {}
+
+/**
+ * Fetch stage: downloads every location at once on one thread, queueing each as soon as it arrives
+ * Transfer callbacks never wait for room in the decode queue, since that would stall every other transfer; jobs
+ * that don't fit wait in a backlog that is retried on each callback and flushed once the transfers finish
+ */
+void Pipeline::fetch() {
+    StageScope stage(Stage::fetch);
+
+    // Offline jobs are decoded from their snapshots
+    if (settings.offline) {
+        for (const Location & location : settings.locations) {
+            PipelineJob job;
+            job.location = location;
+            decode_queue.push(std::move(job));
+        }
+        return;
+    }
+
+    std::vector<PipelineJob> jobs(settings.locations.size());
+    const bool minutely = std::any_of(settings.profiles.begin(), settings.profiles.end(),
+                                      [](const DisplayProfile & profile) { return profile.nowcast; });
+    const bool airquality = std::any_of(settings.profiles.begin(), settings.profiles.end(),
+                                        [](const DisplayProfile & profile) { return profile.aqi_trend; });
+    std::vector<int> pending(settings.locations.size(), airquality ? 3 : 2);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].location = settings.locations[i];
+    }
+    std::deque<PipelineJob> backlog;
+    auto drain_backlog = [this, &backlog]() {
+        while (!backlog.empty() && decode_queue.try_push(backlog.front())) {
+            backlog.pop_front();
+        }
+    };
+    try {
+        Fetcher fetcher;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const Location & location = jobs[i].location;
+
+            // Queue location once all of its responses are in
+            auto finish = [&jobs, &pending, &backlog, &drain_backlog, i](std::string & response,
+                                                                          const std::string & body,
+                                                                          const std::string & error) {
+                response = body;
+                if (!error.empty() && jobs[i].error.empty()) {
+                    jobs[i].error = "Unable to get weather data: " + error;
+                }
+                if (--pending[i] == 0) {
+                    backlog.push_back(std::move(jobs[i]));
+                }
+                drain_backlog();
+            };
+            fetcher.add(OpenWeatherMap::get_onecall_url(location.lat, location.lon, settings.apikey, minutely),
+                        [&jobs, finish, i](const std::string & body, const std::string & error) {
+                            finish(jobs[i].onecall, body, error);
+                        });
+            fetcher.add(OpenWeatherMap::get_airpollution_url(location.lat, location.lon, settings.apikey, false),
+                        [&jobs, finish, i](const std::string & body, const std::string & error) {
+                            finish(jobs[i].airpollution, body, error);
+                        });
+
+            // The air quality forecast is only for the trend strip, so the location is still rendered without it
+            if (airquality) {
+                fetcher.add(OpenWeatherMap::get_airpollution_url(location.lat, location.lon, settings.apikey, true),
+                            [&jobs, finish, i](const std::string & body, const std::string & error) {
+                                if (!error.empty()) {
+                                    record_event(FlightEventType::anomaly, 0, "no air pollution forecast");
+                                }
+                                finish(jobs[i].airpollution_forecast, error.empty() ? body : "", "");
+                            });
+            }
+        }
+        fetcher.run();
+    } catch (std::exception &e) {
+        record_event(FlightEventType::error, 0, e.what());
+
+        // Fail every location that didn't finish
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (pending[i] > 0) {
+                jobs[i].error = e.what();
+                backlog.push_back(std::move(jobs[i]));
+            }
+        }
+    }
+
+    // Nothing else is waiting on this thread now
+    for (PipelineJob & job : backlog) {
+        decode_queue.push(std::move(job));
+    }
+}
+
+/**
+ * Decode stage: turns responses into a forecast, saves it, and queues a render for every display profile
+ *
+ * @param [in,out] job job to process
+ * @param [in,out] out queue of the next stage
+ */
+void Pipeline::decode(PipelineJob & job, BoundedQueue<PipelineJob> & out) {
+    StageScope stage(Stage::decode, job.location.name);
+    job.decoded = std::chrono::steady_clock::now();
+    memory_report.start_stage();
+    std::string snapshot_file = get_location_file(settings.snapshot_file, job.location);
+    if (settings.offline) {
+        job.forecast = std::make_shared<const Forecast>(load_snapshot(snapshot_file));
+    } else {
+        // In low-memory mode the parsed JSON is freed all at once when decoding finishes
+        static thread_local Arena decode_arena;
+        {
+            ArenaScope scope(settings.low_memory ? &decode_arena : nullptr);
+            OpenWeatherMap weather_data(job.onecall, job.airpollution, job.airpollution_forecast);
+            job.forecast = std::make_shared<const Forecast>(weather_data.get_forecast(48, 8));
+        }
+        job.onecall.clear();
+        job.onecall.shrink_to_fit();
+        job.airpollution.clear();
+        job.airpollution.shrink_to_fit();
+        job.airpollution_forecast.clear();
+        job.airpollution_forecast.shrink_to_fit();
+
+        // Save decoded data for warm starts and offline re-rendering
+        if (!snapshot_file.empty()) {
+            save_snapshot(snapshot_file, *job.forecast);
+        }
+
+        // Keep observed conditions for trends, one history file per location
+        if (!settings.history_dir.empty()) {
+            std::stringstream history_file;
+            history_file << settings.history_dir << "/history_" << std::fixed << std::setprecision(4)
+                         << job.location.lat << "_" << job.location.lon << ".bin";
+            HistoryStore history(history_file.str());
+            history.append(job.forecast->current);
+        }
+    }
+    memory_report.end_stage("decode" + (job.location.name.empty() ? "" : " " + job.location.name));
+    job.observation = read_observation(job.location.sensor, std::time(nullptr));
+
+    for (const DisplayProfile & profile : get_location_profiles(settings.profiles, job.location)) {
+        PipelineJob render_job = job;
+        render_job.profile = std::make_shared<const DisplayProfile>(profile);
+        out.push(std::move(render_job));
+    }
+}
+
+/**
+ * Render stage: generates the svg and pre-rendered frames for one display profile
+ *
+ * @param [in,out] job job to process
+ * @param [in,out] out queue of the next stage
+ */
+void Pipeline::render(PipelineJob & job, BoundedQueue<PipelineJob> & out) {
+    StageScope stage(Stage::render, job.profile->name);
+    memory_report.start_stage();
+    job.next_refresh = render_profile(settings, *job.profile, *job.forecast, 0, job.observation, policy);
+
+    // Render the coming hours from the same data, once per fetch (rerenders between fetches reuse these frames)
+    if (settings.frames > 0) {
+        prerender_frames(*job.forecast, settings.frames, *job.profile, settings.img_dir);
+    }
+    memory_report.end_stage("render " + job.profile->name);
+
+    // Nothing later needs the forecast, so let it go as soon as every profile is done with it
+    job.forecast.reset();
+    out.push(std::move(job));
+}
+
+/**
+ * Rasterize stage: runs the rasterize command on the generated svg, writing to a temporary png
+ *
+ * @param [in,out] job job to process
+ * @param [in,out] out queue of the next stage
+ */
+void Pipeline::rasterize(PipelineJob & job, BoundedQueue<PipelineJob> & out) {
+    StageScope stage(Stage::rasterize, job.profile->name);
+    rasterize_profile(settings, *job.profile);
+    out.push(std::move(job));
+}
+
+/**
+ * Runs one thread of a stage, passing failed jobs straight through
+ * The last thread of a stage to finish closes its output queue
+ *
+ * @param [in] stage member function that processes a job
+ * @param [in,out] in queue to take jobs from
+ * @param [in,out] out queue of the next stage
+ * @param [in,out] running number of threads of this stage still running
+ */
+void Pipeline::run_stage(const StageMethod stage, BoundedQueue<PipelineJob> & in, BoundedQueue<PipelineJob> & out,
+                         std::atomic<int> & running) {
+    PipelineJob job;
+    while (in.pop(job)) {
+        if (job.error.empty()) {
+            try {
+                (this->*stage)(job, out);
+                continue;
+            } catch (std::exception &e) {
+                job.error = e.what();
+                record_event(FlightEventType::error, 0, e.what());
+            }
+        }
+        out.push(std::move(job));
+    }
+    if (--running == 0) {
+        out.close();
+    }
+}
+
+/**
+ * Refreshes every location: fetch, decode, render and rasterize run as separate stages connected by bounded
+ * queues, so one location's network wait overlaps with another's rendering
+ * Publishing happens on the calling thread
+ *
+ * @return earliest next refresh and every failure
+ */
+PipelineResult Pipeline::run() {
+    std::atomic<int> decoding(settings.workers);
+    std::atomic<int> rendering(settings.workers);
+    std::atomic<int> rasterizing(settings.workers);
+    std::vector<std::thread> threads;
+
+    threads.emplace_back([this] {
+        fetch();
+        decode_queue.close();
+    });
+    for (int i = 0; i < settings.workers; i++) {
+        threads.emplace_back(&Pipeline::run_stage, this, &Pipeline::decode, std::ref(decode_queue),
+                             std::ref(render_queue), std::ref(decoding));
+        threads.emplace_back(&Pipeline::run_stage, this, &Pipeline::render, std::ref(render_queue),
+                             std::ref(rasterize_queue), std::ref(rendering));
+        threads.emplace_back(&Pipeline::run_stage, this, &Pipeline::rasterize, std::ref(rasterize_queue),
+                             std::ref(publish_queue), std::ref(rasterizing));
+    }
+
+    // Publish stage: move finished images into place and collect results
+    PipelineResult result{std::numeric_limits<int64_t>::max(), {}, {}, {}};
+    PipelineJob job;
+    while (publish_queue.pop(job)) {
+        std::string name = job.profile ? job.profile->name : job.location.name;
+        StageScope stage(Stage::publish, name);
+        if (job.error.empty()) {
+            try {
+                publish_profile(settings, *job.profile);
+            } catch (std::runtime_error &e) {
+                job.error = e.what();
+            }
+        }
+
+        if (!job.error.empty()) {
+            result.errors.push_back(name.empty() ? job.error : name + ": " + job.error);
+            if (job.profile) {
+                result.failed.push_back(*job.profile);
+            } else {
+                for (const DisplayProfile & profile : get_location_profiles(settings.profiles, job.location)) {
+                    result.failed.push_back(profile);
+                }
+            }
+        } else {
+            result.next_refresh = std::min(result.next_refresh, job.next_refresh);
+            result.latencies.push_back(
+                    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - job.decoded).count());
+        }
+    }
+
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+/**
+ * Writes how deep each queue got and how often it pushed back on the stage before it
+ *
+ * @param [in,out] out stream to write to
+ */
+void Pipeline::print_stats(std::ostream & out) {
+    std::pair<const char *, BoundedQueue<PipelineJob> *> queues[] = {
+            {"decode", &decode_queue}, {"render", &render_queue},
+            {"rasterize", &rasterize_queue}, {"publish", &publish_queue}};
+    for (auto & queue : queues) {
+        QueueStats stats = queue.second->get_stats();
+        out << "queue " << queue.first << ": " << stats.pushed << " jobs, max depth " << stats.max_depth << "/"
+            << stats.capacity << ", blocked " << stats.blocked << " times" << std::endl;
+    }
+}
@@ -0,0 +1,187 @@
+#ifndef NOOK_WEATHER_PIPELINE_H
+#define NOOK_WEATHER_PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "location.h"
+#include "memstats.h"
+#include "notify.h"
+#include "profile.h"
+#include "refresh.h"
+#include "sensor.h"
+#include "weathertypes.h"
+
+struct Settings {
+    std::vector<Location> locations;        // Locations to render
+    std::string apikey;                     // API key
+    std::string img_dir;                    // Directory of images
+    std::vector<DisplayProfile> profiles;   // Displays to render for
+    int frames;                             // Number of frames to pre-render for the coming hours (0 to disable)
+    std::string history_dir;                // Directory of observation history files (empty to disable)
+    std::string snapshot_file;              // Path to decoded forecast snapshot (empty to disable)
+    bool offline;                           // Use snapshot instead of fetching
+    bool low_memory;                        // Free decode and render memory in one step
+    std::string rasterize;                  // Shell command run with $1 = svg and $2 = png to write (empty to disable)
+    int workers;                            // Number of threads for each CPU-bound stage
+    double sensor_blend;                    // Weight of local sensor readings, 0 (API only) - 1 (sensor only)
+    std::shared_ptr<NotifyServer> notify;   // Wakes displays waiting for a new image (null to disable)
+    uint32_t shm_frame_size;                // Units: bytes of each shared memory frame buffer (0 to disable)
+};
+
+struct QueueStats {
+    size_t capacity;                        // Most jobs the queue holds before pushes block
+    size_t pushed;                          // Jobs passed through queue
+    size_t max_depth;                       // Most jobs waiting at once
+    size_t blocked;                         // Pushes that had to wait for room (backpressure)
+};
+
+/**
+ * Thread-safe FIFO queue that blocks producers while full and consumers while empty
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(const size_t capacity) : capacity(capacity) {}
+
+    /**
+     * Adds an item, waiting for room if the queue is full
+     *
+     * @param [in] item item to add
+     */
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.size() >= capacity) {
+            blocked++;
+            not_full.wait(lock, [this] { return items.size() < capacity; });
+        }
+        items.push_back(std::move(item));
+        pushed++;
+        max_depth = std::max(max_depth, items.size());
+        not_empty.notify_one();
+    }
+
+    /**
+     * Adds an item if there is room, without waiting
+     *
+     * @param [in,out] item item to add (moved from only if added)
+     * @return false if the queue is full
+     */
+    bool try_push(T & item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.size() >= capacity) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        pushed++;
+        max_depth = std::max(max_depth, items.size());
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * Takes the oldest item, waiting for one if the queue is empty
+     *
+     * @param [out] item item taken
+     * @return false if the queue is closed and empty
+     */
+    bool pop(T & item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * Marks that nothing more will be pushed, waking consumers once the queue drains
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+    /**
+     * Gets how busy the queue has been
+     *
+     * @return queue statistics
+     */
+    QueueStats get_stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return QueueStats{capacity, pushed, max_depth, blocked};
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    size_t pushed = 0;
+    size_t max_depth = 0;
+    size_t blocked = 0;
+};
+
+struct PipelineJob {
+    Location location;                                  // Location being refreshed
+    std::string onecall;                                // Raw One Call response (fetch to decode)
+    std::string airpollution;                           // Raw air pollution response (fetch to decode)
+    std::string airpollution_forecast;                  // Raw air pollution forecast response (empty if not fetched)
+    std::shared_ptr<const Forecast> forecast;           // Decoded forecast, shared by every profile of the location
+    std::shared_ptr<const DisplayProfile> profile;      // Profile to render (null before decode fans out)
+    Observation observation{0, false, 0, false, 0};     // Local sensor reading for current conditions
+    int64_t next_refresh;                               // Units: Unix time
+    std::chrono::steady_clock::time_point decoded;      // When decoding began, for the job's latency
+    std::string error;                                  // Why the job failed (empty if it hasn't); later stages pass it on
+};
+
+struct PipelineResult {
+    int64_t next_refresh;                               // Units: Unix time  (earliest of all locations)
+    std::vector<std::string> errors;                    // Error of each failed job
+    std::vector<DisplayProfile> failed;                 // Profiles that weren't rendered
+    std::vector<double> latencies;                      // Units: microseconds from decode to publish of each profile
+};
+
+int64_t render_profile(const Settings & settings, const DisplayProfile & profile, const Forecast & forecast,
+                       size_t hour, const Observation & observation, const RefreshPolicy & policy);
+void rasterize_profile(const Settings & settings, const DisplayProfile & profile);
+void publish_profile(const Settings & settings, const DisplayProfile & profile);
+void notify_published(const Settings & settings, const DisplayProfile & profile);
+
+class Pipeline {
+public:
+    Pipeline(const Settings & settings, const RefreshPolicy & policy, MemoryReport & memory_report);
+    PipelineResult run();                               // Refresh every location, returning once all are published
+    void print_stats(std::ostream & out);               // Write depth and backpressure of each queue
+private:
+    typedef void (Pipeline::*StageMethod)(PipelineJob & job, BoundedQueue<PipelineJob> & out);
+    const Settings & settings;
+    const RefreshPolicy & policy;
+    MemoryReport & memory_report;
+    BoundedQueue<PipelineJob> decode_queue;
+    BoundedQueue<PipelineJob> render_queue;
+    BoundedQueue<PipelineJob> rasterize_queue;
+    BoundedQueue<PipelineJob> publish_queue;
+    void fetch();
+    void decode(PipelineJob & job, BoundedQueue<PipelineJob> & out);
+    void render(PipelineJob & job, BoundedQueue<PipelineJob> & out);
+    void rasterize(PipelineJob & job, BoundedQueue<PipelineJob> & out);
+    void run_stage(StageMethod stage, BoundedQueue<PipelineJob> & in, BoundedQueue<PipelineJob> & out,
+                   std::atomic<int> & running);
+};
+
+#endif //NOOK_WEATHER_PIPELINE_H
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <cstdint>
+#include <fstream>
+#include <filesystem>
+
+#include "astronomy.h"
+#include "modifysvg.h"
+#include "prerender.h"
+
+/**
+ * Gets which hour of a forecast should be showing at a given time
+ *
+ * @param [in] forecast full forecast
+ * @param [in] now current time as unix time
+ * @return index into the hourly forecast (0 if the forecast is not yet stale)
+ */
+size_t get_frame_hour(const Forecast & forecast, const int64_t now) {
+    size_t hour = 0;
+    while (hour + 1 < forecast.hourly.size() && forecast.hourly[hour + 1].timestamp <= now) {
+        hour++;
+    }
+    return hour;
+}
+
+/**
+ * Gets the air quality forecast from the hour a time is in
+ *
+ * @param [in] airquality hourly air quality forecast
+ * @param [in] timestamp time as unix time
+ * @return air quality of that hour and the ones after it
+ */
+static std::vector<HourlyAirQuality> get_airquality_from(const std::vector<HourlyAirQuality> & airquality,
+                                                         const int64_t timestamp) {
+    const int64_t hour_start = timestamp - timestamp % 3600;
+    auto start = std::find_if(airquality.begin(), airquality.end(),
+                              [hour_start](const HourlyAirQuality & hour) { return hour.timestamp >= hour_start; });
+    return std::vector<HourlyAirQuality>(start, airquality.end());
+}
+
+/**
+ * Builds the forecast as it will look at a later hour of the already fetched data
+ * The hourly window is shifted, past days are dropped, and expired alerts are removed
+ * Minutely precipitation only covers the hour after the fetch, so later frames have none
+ * Icons are switched between day and night versions by where the sun is, when the location is known
+ *
+ * @param [in] forecast full forecast, with as many hours and days as were fetched
+ * @param [in] hour index into the hourly forecast of the frame's hour (0 is now)
+ * @param [in] hours number of hours to keep in the frame
+ * @param [in] days number of days to keep in the frame
+ * @return forecast for the frame
+ */
+Forecast get_frame_forecast(const Forecast & forecast, const size_t hour, const int hours, const int days) {
+    // The first frame is the current conditions
+    if (hour == 0 || hour >= forecast.hourly.size()) {
+        Forecast frame = forecast;
+        frame.hourly.resize(std::min(forecast.hourly.size(), (size_t) std::max(hours, 0)));
+        frame.daily.resize(std::min(forecast.daily.size(), (size_t) std::max(days, 0)));
+        frame.airquality = get_airquality_from(forecast.airquality, forecast.current.timestamp);
+        set_day_night_icons(frame);
+        return frame;
+    }
+
+    // Later frames use that hour's forecast as current conditions
+    const HourlyWeather & now = forecast.hourly[hour];
+    CurrentWeather current{now.timestamp, now.temp, now.feels_like, now.weather, now.icon,
+                           forecast.current.aqi, Beaufort(now.wind_speed), UVIndex((int) now.uvi), now.humidity};
+
+    // Shift hourly window
+    auto hourly_end = forecast.hourly.begin() + (long) std::min(forecast.hourly.size(), hour + std::max(hours, 0));
+    std::vector<HourlyWeather> hourly(forecast.hourly.begin() + (long) hour, hourly_end);
+
+    // Drop days that are over by this frame
+    std::shared_ptr<TimeFormatter> time_format = TimeFormatter::get_instance(forecast.timezone, forecast.timezone_offset);
+    int64_t today = time_format->get_local(now.timestamp).day_number;
+    std::vector<DailyWeather> daily;
+    for (const DailyWeather & day : forecast.daily) {
+        if (time_format->get_local(day.timestamp).day_number >= today && daily.size() < (size_t) std::max(days, 0)) {
+            daily.push_back(day);
+        }
+    }
+
+    // Precipitation chances for this hour and the rest of its day
+    Precipitation precipitation{now.pop, forecast.precipitation.today};
+    if (!daily.empty() && time_format->get_local(daily[0].timestamp).day_number == today) {
+        precipitation.today = daily[0].pop;
+    }
+
+    // Drop alerts that are over by this frame
+    std::vector<WeatherAlert> alerts;
+    for (const WeatherAlert & alert : forecast.alerts) {
+        if (!alert.is_expired(now.timestamp)) {
+            alerts.push_back(alert);
+        }
+    }
+
+    // Air quality from this hour on
+    std::vector<HourlyAirQuality> airquality = get_airquality_from(forecast.airquality, now.timestamp);
+
+    Forecast frame{current, precipitation, hourly, daily, alerts, forecast.timezone, forecast.timezone_offset, {},
+                   forecast.lat, forecast.lon, airquality};
+    set_day_night_icons(frame);
+    return frame;
+}
+
+/**
+ * Renders frames for the coming hours from a single fetch and writes a queue listing when to show each one
+ * Queue file has one frame per line, "<unix time> <filename>", in order
+ *
+ * @param [in] forecast full forecast, with as many hours and days as were fetched
+ * @param [in] frames number of frames (hours) to render, including the current one
+ * @param [in] profile display profile to render frames for
+ * @param [in] img_dir directory of images
+ * @return rendered frames, in order
+ */
+std::vector<Frame> prerender_frames(const Forecast & forecast, const int frames, const DisplayProfile & profile,
+                                    const std::string & img_dir) {
+    // Every frame needs a full hourly graph
+    int renderable = std::min(frames, (int) forecast.hourly.size() - profile.hours + 1);
+    std::string prefix = profile.name + "-";
+    std::string queue_file = get_frame_queue(profile);
+
+    std::vector<Frame> rendered;
+    for (int i = 0; i < renderable; i++) {
+        Forecast frame = get_frame_forecast(forecast, i, profile.hours, profile.days);
+        std::string filename = prefix + std::to_string(frame.current.timestamp) + ".svg";
+        modify_svg(frame, *TimeFormatter::get_instance(frame.timezone, frame.timezone_offset), profile, img_dir, filename);
+        rendered.push_back(Frame{frame.current.timestamp, filename});
+    }
+
+    // Replace queue in one step so readers never see a partial file
+    std::string queue_tmp = img_dir + queue_file + ".tmp";
+    std::ofstream queue(queue_tmp);
+    for (const Frame & frame : rendered) {
+        queue << frame.timestamp << " " << frame.filename << "\n";
+    }
+    queue.close();
+    std::filesystem::rename(queue_tmp, img_dir + queue_file);
+
+    // Remove frames left over from earlier fetches
+    int64_t oldest = rendered.empty() ? INT64_MAX : rendered[0].timestamp;
+    for (const auto & entry : std::filesystem::directory_iterator(img_dir)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() + 4 || name.rfind(prefix, 0) != 0 || name.substr(name.size() - 4) != ".svg") {
+            continue;
+        }
+
+        // Only touch "<profile>-<digits>.svg", never other files sharing the prefix
+        std::string stamp = name.substr(prefix.size(), name.size() - prefix.size() - 4);
+        if (stamp.find_first_not_of("0123456789") == std::string::npos) {
+            int64_t timestamp = std::strtoll(stamp.c_str(), nullptr, 10);
+            if (timestamp < oldest) {
+                std::filesystem::remove(entry.path());
+            }
+        }
+    }
+
+    return rendered;
+}
+
+/**
+ * Gets filename of a profile's frame queue
+ *
+ * @param [in] profile display profile
+ * @return filename of frame queue, relative to image directory
+ */
+std::string get_frame_queue(const DisplayProfile & profile) {
+    return profile.name + "-frames.txt";
+}
+
+/**
+ * Finds the pre-rendered frame that should be showing at a given time
+ *
+ * @param [in] img_dir directory of images
+ * @param [in] queue_file filename of frame queue
+ * @param [in] now current time as unix time
+ * @return filename of frame, or an empty string if no frame covers the given time
+ */
+std::string find_frame(const std::string & img_dir, const std::string & queue_file, const int64_t now) {
+    std::ifstream queue(img_dir + queue_file);
+    std::string current;
+    int64_t timestamp;
+    std::string filename;
+
+    // Last frame that has started; frames after the end of the queue are too stale to show
+    int64_t last_timestamp = 0;
+    while (queue >> timestamp >> filename) {
+        if (timestamp > now) {
+            return current;
+        }
+        current = filename;
+        last_timestamp = timestamp;
+    }
+    return now - last_timestamp < 3600 ? current : std::string();
+}
@@ -0,0 +1,26 @@
+#ifndef NOOK_WEATHER_PRERENDER_H
+#define NOOK_WEATHER_PRERENDER_H
+
+#include <string>
+#include <vector>
+
+#include "profile.h"
+#include "weathertypes.h"
+
+struct Frame {
+    int64_t timestamp;      // Units: Unix time  (when the frame should be shown)
+    std::string filename;   // Filename of rendered svg, relative to image directory
+};
+
+size_t get_frame_hour(const Forecast & forecast, int64_t now);
+
+Forecast get_frame_forecast(const Forecast & forecast, size_t hour, int hours, int days);
+
+std::vector<Frame> prerender_frames(const Forecast & forecast, int frames, const DisplayProfile & profile,
+                                    const std::string & img_dir);
+
+std::string get_frame_queue(const DisplayProfile & profile);
+
+std::string find_frame(const std::string & img_dir, const std::string & queue_file, int64_t now);
+
+#endif //NOOK_WEATHER_PRERENDER_H
@@ -0,0 +1,89 @@
+#include <fstream>
+#include <stdexcept>
+
+#include <nlohmann/json.hpp>
+
+#include "profile.h"
+
+/**
+ * Gets the profile for the 800x600 Nook Simple Touch layout in template.svg
+ *
+ * @return default display profile
+ */
+DisplayProfile get_default_profile() {
+    return DisplayProfile{"nook", "template.svg", "generated.svg", 12, 5, {{550, 770}, {360, 460}}, false,
+                          {{500, 780}, {270, 294}}, false, {{340, 459}, {164, 188}}, false, ""};
+}
+
+/**
+ * Loads display profiles from a JSON file
+ * File is a list of objects with keys "name", "template", "output", "hours", "days", "graph_x" ([start, end]),
+ * "graph_y" ([start, end]), "nowcast", "nowcast_x", "nowcast_y", "aqi_trend", "aqi_trend_x" and "aqi_trend_y";
+ * anything left out is taken from the default profile
+ *
+ * @param [in] filepath path to profiles file
+ * @param [in] optimize default for profiles that don't set "optimize"
+ * @return display profiles, in file order
+ */
+std::vector<DisplayProfile> load_profiles(const std::string & filepath, const bool optimize) {
+    std::ifstream file(filepath);
+    if (!file) {
+        throw std::runtime_error("Failed to read profiles file");
+    }
+    nlohmann::json profiles_json = nlohmann::json::parse(file);
+
+    std::vector<DisplayProfile> profiles;
+    for (const nlohmann::json & profile_json : profiles_json) {
+        DisplayProfile profile = get_default_profile();
+        profile.optimize = optimize;
+
+        profile.name = profile_json.value("name", profile.name);
+        profile.template_svg = profile_json.value("template", profile.template_svg);
+        profile.output_svg = profile_json.value("output", profile.output_svg);
+        profile.hours = profile_json.value("hours", profile.hours);
+        profile.days = profile_json.value("days", profile.days);
+        profile.optimize = profile_json.value("optimize", profile.optimize);
+        profile.nowcast = profile_json.value("nowcast", profile.nowcast);
+        profile.aqi_trend = profile_json.value("aqi_trend", profile.aqi_trend);
+        for (int dimension = 0; dimension < 2; dimension++) {
+            const char *key = dimension == 0 ? "graph_x" : "graph_y";
+            if (profile_json.contains(key)) {
+                profile.graph_bounds[dimension][0] = profile_json[key].at(0);
+                profile.graph_bounds[dimension][1] = profile_json[key].at(1);
+            }
+            key = dimension == 0 ? "nowcast_x" : "nowcast_y";
+            if (profile_json.contains(key)) {
+                profile.nowcast_bounds[dimension][0] = profile_json[key].at(0);
+                profile.nowcast_bounds[dimension][1] = profile_json[key].at(1);
+            }
+            key = dimension == 0 ? "aqi_trend_x" : "aqi_trend_y";
+            if (profile_json.contains(key)) {
+                profile.aqi_trend_bounds[dimension][0] = profile_json[key].at(0);
+                profile.aqi_trend_bounds[dimension][1] = profile_json[key].at(1);
+            }
+        }
+
+        // Graph needs at least two points to draw a line
+        if (profile.hours < 2 || profile.days < 0) {
+            throw std::runtime_error("Invalid profile " + profile.name);
+        }
+
+        // Names end up in frame filenames, and profiles sharing a name or an output would overwrite each other
+        if (profile.name.empty() || profile.name.find('/') != std::string::npos) {
+            throw std::runtime_error("Invalid profile name " + profile.name);
+        }
+        if (profile.output_svg.empty()) {
+            throw std::runtime_error("Invalid profile output for " + profile.name);
+        }
+        for (const DisplayProfile & other : profiles) {
+            if (other.name == profile.name) {
+                throw std::runtime_error("Duplicate profile name " + profile.name);
+            }
+            if (other.output_svg == profile.output_svg) {
+                throw std::runtime_error("Duplicate profile output " + profile.output_svg);
+            }
+        }
+        profiles.push_back(profile);
+    }
+    return profiles;
+}
@@ -0,0 +1,25 @@
+#ifndef NOOK_WEATHER_PROFILE_H
+#define NOOK_WEATHER_PROFILE_H
+
+#include <string>
+#include <vector>
+
+struct DisplayProfile {
+    std::string name;                   // Profile name, also used to name pre-rendered frames
+    std::string template_svg;           // Filename of template svg
+    std::string output_svg;             // Filename of generated svg
+    int hours;                          // Number of hours in hourly graph
+    int days;                           // Number of daily forecast boxes in template
+    int graph_bounds[2][2];             // Hourly graph area  index 0: x (0) or y (1)  index 1: start (0) or end (1)
+    bool nowcast;                       // Show next hour's precipitation by the minute (fetches minutely data)
+    int nowcast_bounds[2][2];           // Nowcast chart area, indexed like graph_bounds
+    bool aqi_trend;                     // Show air quality for the next day (fetches the air pollution forecast)
+    int aqi_trend_bounds[2][2];         // Air quality strip area, indexed like graph_bounds
+    bool optimize;                      // Shrink generated svg before saving
+    std::string place;                  // Place name shown after the date (empty for none, set per location)
+};
+
+DisplayProfile get_default_profile();
+std::vector<DisplayProfile> load_profiles(const std::string & filepath, bool optimize);
+
+#endif //NOOK_WEATHER_PROFILE_H
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "profiler.h"
+
+// Samples are aggregated as they are taken, so the table only needs room for distinct stacks
+static const size_t table_size = 2048;      // Must be a power of two
+static const size_t max_probes = 64;
+static ProfileEntry table[table_size];
+static std::atomic<uint64_t> dropped{0};    // Samples with no room in the table
+
+static std::string profile_path;
+static int sample_frequency;                // Units: samples per second of CPU time
+static int sample_duration;                 // Units: seconds
+static int wake_fd = -1;                    // Written by SIGUSR2 to start or stop a profile
+static std::mutex profile_mutex;
+static bool profiling = false;
+
+/**
+ * Reads words from the sampled thread's stack, failing instead of faulting if they aren't mapped
+ *
+ * @param [in] address address of first word
+ * @param [out] words words read
+ * @param [in] count number of words to read
+ * @return true if every word was read
+ */
+static bool read_words(const uintptr_t address, uintptr_t *words, const size_t count) {
+    iovec local{words, count * sizeof(uintptr_t)};
+    iovec remote{(void *) address, count * sizeof(uintptr_t)};
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t) (count * sizeof(uintptr_t));
+}
+
+/**
+ * Walks the interrupted thread's stack by its frame pointers
+ * backtrace() can't be used in a signal handler: the unwinder takes the loader's lock, which the sampled thread may
+ * be holding (e.g. while unwinding an exception), so the handler would deadlock
+ * Frames of code built without frame pointers (e.g. most of libc) are skipped or end the walk, and a thread sampled
+ * in a function's prologue loses its caller
+ *
+ * @param [in] context register state of the interrupted thread
+ * @param [out] frames interrupted address, then return addresses, innermost first
+ * @return number of frames (0 if the architecture isn't supported)
+ */
+static int walk_stack(const ucontext_t *context, void **frames) {
+#if defined(__x86_64__)
+    uintptr_t pc = context->uc_mcontext.gregs[REG_RIP];
+    uintptr_t fp = context->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    uintptr_t pc = context->uc_mcontext.pc;
+    uintptr_t fp = context->uc_mcontext.regs[29];
+#elif defined(__arm__)
+    // 32-bit ARM compilers don't agree on a frame layout, so only the interrupted function is known
+    uintptr_t pc = context->uc_mcontext.arm_pc;
+    uintptr_t fp = 0;
+#else
+    (void) context;
+    uintptr_t pc = 0;
+    uintptr_t fp = 0;
+#endif
+    if (pc == 0) {
+        return 0;
+    }
+    int depth = 0;
+    frames[depth++] = (void *) pc;
+
+    // Each frame starts with the caller's frame pointer, then the return address (never in the unmapped first page)
+    uintptr_t record[2];
+    while (depth < max_sample_frames && fp != 0 && fp % sizeof(uintptr_t) == 0 && read_words(fp, record, 2)
+           && record[1] >= 4096) {
+        frames[depth++] = (void *) record[1];
+
+        // Stacks grow down, so a caller's frame is always higher; anything else isn't a frame pointer
+        if (record[0] <= fp) {
+            break;
+        }
+        fp = record[0];
+    }
+    return depth;
+}
+
+/**
+ * Counts a sample of the interrupted thread's stack
+ * Only uses async-signal-safe operations: the stack is looked up in the table by its hash, and a free entry is
+ * claimed with compare and swap, so threads sampled at the same time don't need a lock
+ *
+ * @param [in] signal signal number
+ * @param [in] info signal information
+ * @param [in] context register state of the interrupted thread
+ */
+static void handle_sample(const int signal, siginfo_t *info, void *context) {
+    int saved_errno = errno;
+    void *frames[max_sample_frames];
+    int depth = walk_stack((const ucontext_t *) context, frames);
+    Stage stage = get_current_stage();
+    if (depth <= 0) {
+        errno = saved_errno;
+        return;
+    }
+
+    // FNV-1a of stage and frames; 0 marks unused entries
+    uint64_t key = 14695981039346656037ULL ^ (uint64_t) stage;
+    for (int i = 0; i < depth; i++) {
+        key = (key ^ (uint64_t) (uintptr_t) frames[i]) * 1099511628211ULL;
+    }
+    key = key == 0 ? 1 : key;
+
+    bool counted = false;
+    for (size_t probe = 0; probe < max_probes && !counted; probe++) {
+        ProfileEntry & entry = table[(key + probe) & (table_size - 1)];
+        uint64_t current = 0;
+        if (entry.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+            entry.stage = stage;
+            entry.depth = depth;
+            memcpy(entry.frames, frames, depth * sizeof(void *));
+            entry.ready.store(true, std::memory_order_release);
+            entry.count.fetch_add(1, std::memory_order_relaxed);
+            counted = true;
+        } else if (current == key) {
+            // Same stack, though another thread may still be writing the entry's frames
+            entry.count.fetch_add(1, std::memory_order_relaxed);
+            counted = true;
+        }
+    }
+    if (!counted) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    errno = saved_errno;
+    (void) signal;
+    (void) info;
+}
+
+/**
+ * Asks the profiler thread to start a profile, or to stop the one running
+ *
+ * @param [in] signal signal number
+ */
+static void handle_toggle(const int signal) {
+    int saved_errno = errno;
+    uint64_t one = 1;
+    (void) !write(wake_fd, &one, sizeof(one));
+    errno = saved_errno;
+    (void) signal;
+}
+
+/**
+ * Gets a readable name for a code address
+ * Exported functions are demangled; anything else (e.g. static functions) is "<file>+0x<offset>", which addr2line
+ * can resolve against the unstripped binary
+ *
+ * @param [in] address code address
+ * @return name of function containing the address
+ */
+static std::string get_symbol(void *address) {
+    Dl_info info{};
+    if (dladdr(address, &info) == 0 || info.dli_fname == nullptr) {
+        std::stringstream unknown;
+        unknown << "0x" << std::hex << (uintptr_t) address;
+        return unknown.str();
+    }
+    if (info.dli_sname != nullptr) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+        free(demangled);
+        return name;
+    }
+    const char *file = strrchr(info.dli_fname, '/');
+    std::stringstream offset;
+    offset << (file ? file + 1 : info.dli_fname) << "+0x" << std::hex
+           << (uintptr_t) address - (uintptr_t) info.dli_fbase;
+    return offset.str();
+}
+
+/**
+ * Writes every stack sampled as folded stacks ("<stage>;<outermost>;...;<innermost> <samples>" on each line), the
+ * format flame graph tools read, replacing the file in one step
+ *
+ * @param [in] filepath file to write to
+ * @return number of samples written
+ */
+static uint64_t write_profile(const std::string & filepath) {
+    std::unordered_map<void *, std::string> symbols;
+    std::map<std::string, uint64_t> stacks;
+    uint64_t samples = 0;
+    for (ProfileEntry & entry : table) {
+        if (!entry.ready.load(std::memory_order_acquire)) {
+            continue;
+        }
+        std::string stack = get_stage_name(entry.stage);
+        for (int i = entry.depth - 1; i >= 0; i--) {
+            // Return addresses point after the call, which may be the start of the next function
+            void *address = i == 0 ? entry.frames[i] : (char *) entry.frames[i] - 1;
+            auto symbol = symbols.find(address);
+            if (symbol == symbols.end()) {
+                symbol = symbols.emplace(address, get_symbol(address)).first;
+            }
+            stack += ";" + symbol->second;
+        }
+        uint64_t count = entry.count.load(std::memory_order_relaxed);
+        stacks[stack] += count;
+        samples += count;
+    }
+
+    std::ofstream file(filepath + ".tmp");
+    for (const auto & stack : stacks) {
+        file << stack.first << " " << stack.second << "\n";
+    }
+    file.close();
+    if (!file || rename((filepath + ".tmp").c_str(), filepath.c_str()) != 0) {
+        throw std::runtime_error("Failed to write profile to " + filepath);
+    }
+    return samples;
+}
+
+/**
+ * Clears the table and starts sampling every thread's stack on CPU time
+ */
+static void begin_profile() {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    if (profiling) {
+        return;
+    }
+    for (ProfileEntry & entry : table) {
+        entry.ready.store(false, std::memory_order_relaxed);
+        entry.count.store(0, std::memory_order_relaxed);
+        entry.key.store(0, std::memory_order_release);
+    }
+    dropped.store(0, std::memory_order_relaxed);
+
+    itimerval interval{};
+    interval.it_interval.tv_usec = std::max(1, 1000000 / std::max(1, sample_frequency));
+    interval.it_value = interval.it_interval;
+    setitimer(ITIMER_PROF, &interval, nullptr);
+    profiling = true;
+    std::cerr << "profiling at " << sample_frequency << " Hz" << std::endl;
+}
+
+/**
+ * Stops sampling and writes the profile, if one is running
+ */
+static void finish_profile() {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    if (!profiling) {
+        return;
+    }
+    itimerval off{};
+    setitimer(ITIMER_PROF, &off, nullptr);
+    profiling = false;
+    try {
+        uint64_t samples = write_profile(profile_path);
+        std::cerr << "profile of " << samples << " samples (" << dropped.load() << " dropped) written to "
+                  << profile_path << std::endl;
+    } catch (std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+    }
+}
+
+/**
+ * Starts a profile every time it is woken, and finishes it after the duration or when woken again
+ */
+static void run_profiler() {
+    uint64_t count;
+    while (true) {
+        if (read(wake_fd, &count, sizeof(count)) != sizeof(count)) {
+            continue;
+        }
+        // Does nothing if start_profiling already began this profile
+        begin_profile();
+        pollfd wake{wake_fd, POLLIN, 0};
+        int ready;
+        do {
+            ready = poll(&wake, 1, sample_duration * 1000);
+        } while (ready < 0 && errno == EINTR);
+        if (ready > 0) {
+            (void) !read(wake_fd, &count, sizeof(count));
+        }
+        finish_profile();
+    }
+}
+
+/**
+ * Lets kill -USR2 <pid> profile the running program: every thread's stack is sampled on CPU time for the duration
+ * (or until the next SIGUSR2), then written to a file
+ * Costs nothing until a profile starts
+ *
+ * @param [in] filepath file to write folded stacks to (empty to disable)
+ * @param [in] frequency samples per second of CPU time
+ * @param [in] duration longest profile in seconds
+ */
+void install_profiler(const std::string & filepath, const int frequency, const int duration) {
+    if (filepath.empty() || wake_fd >= 0) {
+        return;
+    }
+    profile_path = filepath;
+    sample_frequency = frequency;
+    sample_duration = std::max(1, duration);
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        throw std::runtime_error("Failed to create profiler eventfd");
+    }
+
+    struct sigaction action{};
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    action.sa_sigaction = handle_sample;
+    sigaction(SIGPROF, &action, nullptr);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = handle_toggle;
+    sigaction(SIGUSR2, &action, nullptr);
+    std::thread(run_profiler).detach();
+}
+
+/**
+ * Starts a profile straight away, e.g. to profile start up
+ */
+void start_profiling() {
+    if (wake_fd >= 0) {
+        begin_profile();
+
+        // Have the profiler thread finish it after the duration
+        handle_toggle(SIGUSR2);
+    }
+}
+
+/**
+ * Writes the profile running now, so one is not lost when the program exits before the duration is up
+ */
+void stop_profiling() {
+    if (wake_fd >= 0) {
+        finish_profile();
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef NOOK_WEATHER_PROFILER_H
+#define NOOK_WEATHER_PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "flightrecorder.h"
+
+static const int max_sample_frames = 32;
+
+// One distinct stack; samples of the same stack in the same stage share an entry
+struct ProfileEntry {
+    std::atomic<uint64_t> key;              // Hash of stage and frames (0 if unused)
+    std::atomic<bool> ready;                // Stage and frames are written
+    std::atomic<uint64_t> count;            // Samples of this stack
+    Stage stage;                            // Stage of the sampled thread
+    int depth;                              // Number of frames
+    void *frames[max_sample_frames];        // Interrupted address, then return addresses, innermost first
+};
+
+void install_profiler(const std::string & filepath, int frequency, int duration);  // Profile on SIGUSR2
+void start_profiling();                     // Profile now, as if SIGUSR2 arrived
+void stop_profiling();                      // Write the profile now if one is running
+
+#endif //NOOK_WEATHER_PROFILER_H
@@ -0,0 +1,89 @@
+#include <cmath>
+#include <algorithm>
+
+#include "refresh.h"
+
+/**
+ * Creates a refresh policy
+ *
+ * @param [in] min_interval shortest allowed time between refreshes, in seconds
+ * @param [in] max_interval longest allowed time between refreshes, in seconds
+ * @param [in] pop_threshold probability of precipitation that counts as "rain is coming"
+ */
+RefreshPolicy::RefreshPolicy(const int64_t min_interval, const int64_t max_interval, const double pop_threshold)
+        : min_interval(min_interval), max_interval(std::max(min_interval, max_interval)), pop_threshold(pop_threshold) {}
+
+/**
+ * Gets the refresh interval based on how quickly conditions are changing
+ * Steady temperatures and dry weather back off to the maximum interval
+ *
+ * @param [in] precipitation precipitation data
+ * @param [in] hourly hourly forecast data
+ * @return refresh interval in seconds
+ */
+int64_t RefreshPolicy::get_volatility_interval(const Precipitation & precipitation,
+                                               const std::vector<HourlyWeather> & hourly) const {
+    // Fastest temperature change over the next few hours
+    const int lookahead = 4;
+    double rate = 0;
+    for (int i = 1; i < std::min(lookahead, (int) hourly.size()); i++) {
+        rate = std::max(rate, std::abs(hourly[i].temp - hourly[i - 1].temp));
+    }
+
+    // Every degree per hour of change shortens the interval
+    double interval = (double) max_interval / (1 + rate);
+
+    // Refresh more often while rain is likely
+    if (precipitation.hour >= pop_threshold) {
+        interval /= 2;
+    }
+
+    return (int64_t) interval;
+}
+
+/**
+ * Gets the time of the next refresh
+ * Refreshes sooner before alerts start or end, before precipitation becomes likely, and at the day rollover
+ *
+ * @param [in] now current time as unix time
+ * @param [in] precipitation precipitation data
+ * @param [in] hourly hourly forecast data
+ * @param [in] alerts weather alerts
+ * @param [in] time_format formatter for the location's time zone
+ * @return next refresh as unix time
+ */
+int64_t RefreshPolicy::get_next_refresh(const int64_t now, const Precipitation & precipitation,
+                                        const std::vector<HourlyWeather> & hourly,
+                                        const std::vector<WeatherAlert> & alerts,
+                                        const TimeFormatter & time_format) const {
+    const int64_t lead = 15 * 60;  // Refresh this long before a predicted change
+    int64_t next = now + get_volatility_interval(precipitation, hourly);
+
+    // Probability of precipitation rises past threshold
+    for (size_t i = 1; i < hourly.size(); i++) {
+        if (hourly[i - 1].pop < pop_threshold && hourly[i].pop >= pop_threshold) {
+            if (hourly[i].timestamp - lead > now) {
+                next = std::min(next, hourly[i].timestamp - lead);
+            }
+            break;
+        }
+    }
+
+    // Alerts starting soon, or expiring and needing to be removed
+    for (const WeatherAlert & alert : alerts) {
+        if (alert.get_start() - lead > now) {
+            next = std::min(next, alert.get_start() - lead);
+        } else if (alert.get_start() > now) {
+            // Already inside the lead time, so refresh as it starts
+            next = std::min(next, alert.get_start());
+        } else if (alert.get_end() > now) {
+            next = std::min(next, alert.get_end());
+        }
+    }
+
+    // Date header changes
+    next = std::min(next, time_format.get_next_midnight(now));
+
+    // Keep within limits
+    return std::clamp(next, now + min_interval, now + max_interval);
+}
@@ -0,0 +1,24 @@
+#ifndef NOOK_WEATHER_REFRESH_H
+#define NOOK_WEATHER_REFRESH_H
+
+#include <vector>
+
+#include "timeformat.h"
+#include "weathertypes.h"
+
+class RefreshPolicy {
+public:
+    explicit RefreshPolicy(int64_t min_interval = 300, int64_t max_interval = 3600, double pop_threshold = 0.3);
+    int64_t get_next_refresh(int64_t now, const Precipitation & precipitation,
+                             const std::vector<HourlyWeather> & hourly,
+                             const std::vector<WeatherAlert> & alerts,
+                             const TimeFormatter & time_format) const;           // Gets unix time of next refresh
+private:
+    int64_t min_interval;                       // Units: seconds
+    int64_t max_interval;                       // Units: seconds
+    double pop_threshold;                       // Units: 0 (0%) - 1 (100%)
+    int64_t get_volatility_interval(const Precipitation & precipitation,
+                                    const std::vector<HourlyWeather> & hourly) const;
+};
+
+#endif //NOOK_WEATHER_REFRESH_H
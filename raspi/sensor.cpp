@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "feelslike.h"
+#include "sensor.h"
+
+/**
+ * Creates a sensor backed by a text file, for sensors that are bridged in by another program
+ * (e.g. mosquitto_sub writing a local MQTT broker's readings)
+ *
+ * @param [in] filepath path to file with lines "temp <degrees Celsius>" and "humidity <percent>"
+ */
+FileSensor::FileSensor(const std::string & filepath) : filepath(filepath) {}
+
+/**
+ * Reads the file; the reading's time is when the file was last written
+ *
+ * @return observation
+ */
+Observation FileSensor::read() {
+    Observation observation{0, false, 0, false, 0};
+    struct stat file_stat{};
+    std::ifstream file(filepath);
+    if (!file || stat(filepath.c_str(), &file_stat) != 0) {
+        throw std::runtime_error("Failed to read sensor file " + filepath);
+    }
+    observation.timestamp = file_stat.st_mtime;
+
+    std::string key;
+    double value;
+    while (file >> key >> value) {
+        if (key == "temp") {
+            observation.has_temp = true;
+            observation.temp = value;
+        } else if (key == "humidity") {
+            observation.has_humidity = true;
+            observation.humidity = value / 100;
+        }
+    }
+    return observation;
+}
+
+/**
+ * Creates a sensor backed by an Industrial I/O device, e.g. /sys/bus/iio/devices/iio:device0
+ *
+ * @param [in] device_dir sysfs directory of device
+ */
+IIOSensor::IIOSensor(const std::string & device_dir) : device_dir(device_dir) {}
+
+/**
+ * Reads a channel, either processed (_input) or as raw, offset and scale
+ *
+ * @param [in] channel channel name, e.g. "in_temp"
+ * @param [out] value channel value in IIO units (milli degrees Celsius, milli percent)
+ * @return true if device has channel
+ */
+bool IIOSensor::read_channel(const std::string & channel, double & value) const {
+    std::ifstream input(device_dir + "/" + channel + "_input");
+    if (input >> value) {
+        return true;
+    }
+
+    double raw;
+    double offset = 0;
+    double scale = 1;
+    std::ifstream raw_file(device_dir + "/" + channel + "_raw");
+    if (!(raw_file >> raw)) {
+        return false;
+    }
+    std::ifstream(device_dir + "/" + channel + "_offset") >> offset;
+    std::ifstream(device_dir + "/" + channel + "_scale") >> scale;
+    value = (raw + offset) * scale;
+    return true;
+}
+
+/**
+ * Reads temperature and humidity from the device
+ *
+ * @return observation
+ */
+Observation IIOSensor::read() {
+    Observation observation{std::time(nullptr), false, 0, false, 0};
+    double value;
+    if (read_channel("in_temp", value)) {
+        observation.has_temp = true;
+        observation.temp = value / 1000;
+    }
+    if (read_channel("in_humidityrelative", value)) {
+        observation.has_humidity = true;
+        observation.humidity = value / 1000 / 100;
+    }
+    if (!observation.has_temp && !observation.has_humidity) {
+        throw std::runtime_error("No temperature or humidity channels in " + device_dir);
+    }
+    return observation;
+}
+
+/**
+ * Creates a sensor from a specification
+ *
+ * @param [in] spec "file:<path>" or "iio:<sysfs device directory>"
+ * @return sensor
+ */
+std::unique_ptr<SensorSource> make_sensor(const std::string & spec) {
+    size_t colon = spec.find(':');
+    std::string type = spec.substr(0, colon);
+    std::string path = colon == std::string::npos ? "" : spec.substr(colon + 1);
+    if (type == "file" && !path.empty()) {
+        return std::make_unique<FileSensor>(path);
+    }
+    if (type == "iio" && !path.empty()) {
+        return std::make_unique<IIOSensor>(path);
+    }
+    throw std::runtime_error("Unknown sensor " + spec);
+}
+
+/**
+ * Reads a sensor, ignoring it if it can't be read or its reading is stale
+ * Failures are reported but not fatal, since the API's current conditions are still there to fall back on
+ *
+ * @param [in] spec sensor specification (empty for no sensor)
+ * @param [in] now current time as unix time
+ * @param [in] max_age oldest reading to use, in seconds
+ * @return observation, with nothing set if there is no usable reading
+ */
+Observation read_observation(const std::string & spec, const int64_t now, const int64_t max_age) {
+    Observation observation{0, false, 0, false, 0};
+    if (spec.empty()) {
+        return observation;
+    }
+    try {
+        observation = make_sensor(spec)->read();
+    } catch (std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return Observation{0, false, 0, false, 0};
+    }
+
+    bool valid_temp = observation.has_temp && std::isfinite(observation.temp) && std::abs(observation.temp) < 100;
+    bool valid_humidity = observation.has_humidity && observation.humidity >= 0 && observation.humidity <= 1;
+    if (now - observation.timestamp > max_age || (!valid_temp && !valid_humidity)) {
+        return Observation{0, false, 0, false, 0};
+    }
+    observation.has_temp = valid_temp;
+    observation.has_humidity = valid_humidity;
+    return observation;
+}
+
+/**
+ * Overrides or blends current conditions with a local reading, then works out feels like from the result
+ * The API's feels like is kept unless the reading changed temperature or humidity
+ *
+ * @param [in,out] current current conditions from the API
+ * @param [in] observation local reading
+ * @param [in] blend weight of the local reading, 0 (API only) - 1 (sensor only)
+ */
+void apply_observation(CurrentWeather & current, const Observation & observation, const double blend) {
+    if ((!observation.has_temp && !observation.has_humidity) || blend <= 0) {
+        return;
+    }
+    const double temp = current.temp;
+    const double humidity = current.humidity;
+    if (observation.has_temp) {
+        current.temp = blend * observation.temp + (1 - blend) * current.temp;
+    }
+    if (observation.has_humidity) {
+        current.humidity = blend * observation.humidity + (1 - blend) * current.humidity;
+    }
+    if (current.temp != temp || current.humidity != humidity) {
+        current.feels_like = get_feels_like(current.temp, current.humidity, current.wind.get_wind_speed());
+    }
+    current.timestamp = std::max(current.timestamp, observation.timestamp);
+}
@@ -0,0 +1,44 @@
+#ifndef NOOK_WEATHER_SENSOR_H
+#define NOOK_WEATHER_SENSOR_H
+
+#include <memory>
+#include <string>
+
+#include "weathertypes.h"
+
+struct Observation {
+    int64_t timestamp;          // Units: Unix time
+    bool has_temp;              // Sensor reported temperature
+    double temp;                // Units: degrees Celsius
+    bool has_humidity;          // Sensor reported humidity
+    double humidity;            // Units: 0 (0%) - 1 (100%)
+};
+
+class SensorSource {
+public:
+    virtual ~SensorSource() = default;
+    virtual Observation read() = 0;                         // Get latest reading
+};
+
+class FileSensor : public SensorSource {
+public:
+    explicit FileSensor(const std::string & filepath);      // Sensor that reads "temp" and "humidity" lines from a file
+    Observation read() override;
+private:
+    std::string filepath;
+};
+
+class IIOSensor : public SensorSource {
+public:
+    explicit IIOSensor(const std::string & device_dir);     // Sensor that reads an Industrial I/O sysfs device
+    Observation read() override;
+private:
+    std::string device_dir;
+    bool read_channel(const std::string & channel, double & value) const;
+};
+
+std::unique_ptr<SensorSource> make_sensor(const std::string & spec);
+Observation read_observation(const std::string & spec, int64_t now, int64_t max_age = 900);
+void apply_observation(CurrentWeather & current, const Observation & observation, double blend);
+
+#endif //NOOK_WEATHER_SENSOR_H
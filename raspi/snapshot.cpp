@@ -0,0 +1,287 @@
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+
+#include "snapshot.h"
+
+// Snapshot layout: magic, version, then each struct field in declaration order
+// Numbers are stored in host byte order, strings as a 32 bit length followed by the characters
+static const uint64_t snapshot_magic = 0x50414e534b4f4f4e;  // "NOOKSNAP"
+static const uint32_t snapshot_version = 1;      // Bump when a released layout changes, loading older ones as well
+
+/**
+ * Appends binary data to a snapshot buffer
+ */
+class SnapshotWriter {
+public:
+    template<typename T>
+    void put(const T value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be written directly");
+        buffer.append((const char *) &value, sizeof(T));
+    }
+
+    void put(const std::string & value) {
+        put((uint32_t) value.size());
+        buffer.append(value);
+    }
+
+    const std::string & get_buffer() const {
+        return buffer;
+    }
+private:
+    std::string buffer;
+};
+
+/**
+ * Reads binary data from a snapshot buffer, failing on truncated data
+ */
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string & buffer) : pos(buffer.data()), end(buffer.data() + buffer.size()) {}
+
+    template<typename T>
+    T get() {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be read directly");
+        T value;
+        require(sizeof(T));
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    std::string get_string() {
+        auto length = get<uint32_t>();
+        require(length);
+        std::string value(pos, length);
+        pos += length;
+        return value;
+    }
+
+    uint32_t get_count(const size_t min_size) {
+        auto count = get<uint32_t>();
+        require((size_t) count * min_size);
+        return count;
+    }
+
+    void require(const size_t length) const {
+        if ((size_t) (end - pos) < length) {
+            throw std::runtime_error("Truncated snapshot file");
+        }
+    }
+private:
+    const char *pos;
+    const char *end;
+};
+
+/**
+ * Saves decoded forecast to a binary snapshot file
+ * The file is replaced in one step, so a crash while saving leaves the previous snapshot intact
+ *
+ * @param [in] filepath path to snapshot file
+ * @param [in] forecast forecast to save
+ */
+void save_snapshot(const std::string & filepath, const Forecast & forecast) {
+    SnapshotWriter writer;
+    writer.put(snapshot_magic);
+    writer.put(snapshot_version);
+
+    // Current weather
+    const CurrentWeather & current = forecast.current;
+    writer.put(current.timestamp);
+    writer.put(current.temp);
+    writer.put(current.feels_like);
+    writer.put(current.weather);
+    writer.put(current.icon);
+    writer.put((int32_t) current.aqi.get_number());
+    writer.put(current.aqi.get_description());
+    writer.put(current.aqi.get_pollutant());
+    writer.put(current.wind.get_wind_speed());
+    writer.put((int32_t) current.uvi.get_number());
+    writer.put(current.humidity);
+
+    // Precipitation
+    writer.put(forecast.precipitation.hour);
+    writer.put(forecast.precipitation.today);
+
+    // Hourly forecast
+    writer.put((uint32_t) forecast.hourly.size());
+    for (const HourlyWeather & hour : forecast.hourly) {
+        writer.put(hour.timestamp);
+        writer.put(hour.temp);
+        writer.put(hour.pop);
+        writer.put(hour.icon);
+        writer.put(hour.feels_like);
+        writer.put(hour.weather);
+        writer.put(hour.wind_speed);
+        writer.put(hour.uvi);
+        writer.put(hour.humidity);
+    }
+
+    // Daily forecast
+    writer.put((uint32_t) forecast.daily.size());
+    for (const DailyWeather & day : forecast.daily) {
+        writer.put(day.timestamp);
+        writer.put(day.hi);
+        writer.put(day.lo);
+        writer.put(day.weather);
+        writer.put(day.icon);
+        writer.put(day.pop);
+    }
+
+    // Alerts
+    writer.put((uint32_t) forecast.alerts.size());
+    for (const WeatherAlert & alert : forecast.alerts) {
+        writer.put(alert.get_name());
+        writer.put(alert.get_start());
+        writer.put(alert.get_end());
+    }
+
+    // Time zone
+    writer.put(forecast.timezone);
+    writer.put(forecast.timezone_offset);
+
+    // Minutely precipitation
+    writer.put((uint32_t) forecast.minutely.size());
+    for (const MinutelyPrecipitation & minute : forecast.minutely) {
+        writer.put(minute.timestamp);
+        writer.put(minute.precipitation);
+    }
+
+    // Location
+    writer.put(forecast.lat);
+    writer.put(forecast.lon);
+
+    // Air quality forecast
+    writer.put((uint32_t) forecast.airquality.size());
+    for (const HourlyAirQuality & hour : forecast.airquality) {
+        writer.put(hour.timestamp);
+        writer.put((int32_t) hour.aqi);
+        writer.put(hour.severity);
+        writer.put(hour.pollutant);
+    }
+
+    // Write to temporary file and move into place
+    std::string tmp_filepath = filepath + ".tmp";
+    std::ofstream file(tmp_filepath, std::ios::binary | std::ios::trunc);
+    file.write(writer.get_buffer().data(), (std::streamsize) writer.get_buffer().size());
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write snapshot file");
+    }
+    std::filesystem::rename(tmp_filepath, filepath);
+}
+
+/**
+ * Loads decoded forecast from a binary snapshot file
+ *
+ * @param [in] filepath path to snapshot file
+ * @return saved forecast
+ */
+Forecast load_snapshot(const std::string & filepath) {
+    // Read whole file at once
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Failed to read snapshot file");
+    }
+    std::string buffer((size_t) file.tellg(), '\0');
+    file.seekg(0);
+    file.read(&buffer[0], (std::streamsize) buffer.size());
+
+    SnapshotReader reader(buffer);
+    if (reader.get<uint64_t>() != snapshot_magic) {
+        throw std::runtime_error("Invalid snapshot file");
+    }
+    auto version = reader.get<uint32_t>();
+    if (version != snapshot_version) {
+        throw std::runtime_error("Invalid snapshot file");
+    }
+
+    // Current weather
+    auto timestamp = reader.get<int64_t>();
+    auto temp = reader.get<double>();
+    auto feels_like = reader.get<double>();
+    std::string weather = reader.get_string();
+    std::string icon = reader.get_string();
+    auto aqi_number = reader.get<int32_t>();
+    std::string aqi_description = reader.get_string();
+    std::string aqi_pollutant = reader.get_string();
+    auto wind_speed = reader.get<double>();
+    auto uvi = reader.get<int32_t>();
+    auto humidity = reader.get<double>();
+    CurrentWeather current{timestamp, temp, feels_like, weather, icon, AQI(aqi_number, aqi_description, aqi_pollutant),
+                           Beaufort(wind_speed), UVIndex(uvi), humidity};
+
+    // Precipitation
+    auto hour_pop = reader.get<double>();
+    auto today_pop = reader.get<double>();
+    Precipitation precipitation{hour_pop, today_pop};
+
+    // Hourly forecast
+    std::vector<HourlyWeather> hourly(reader.get_count(sizeof(HourlyWeather::timestamp)));
+    for (HourlyWeather & hour : hourly) {
+        hour.timestamp = reader.get<int64_t>();
+        hour.temp = reader.get<double>();
+        hour.pop = reader.get<double>();
+        hour.icon = reader.get_string();
+        hour.feels_like = reader.get<double>();
+        hour.weather = reader.get_string();
+        hour.wind_speed = reader.get<double>();
+        hour.uvi = reader.get<double>();
+        hour.humidity = reader.get<double>();
+    }
+
+    // Daily forecast
+    std::vector<DailyWeather> daily(reader.get_count(sizeof(DailyWeather::timestamp)));
+    for (DailyWeather & day : daily) {
+        day.timestamp = reader.get<int64_t>();
+        day.hi = reader.get<double>();
+        day.lo = reader.get<double>();
+        day.weather = reader.get_string();
+        day.icon = reader.get_string();
+        day.pop = reader.get<double>();
+    }
+
+    // Alerts
+    std::vector<WeatherAlert> alerts;
+    auto num_alerts = reader.get_count(sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_alerts; i++) {
+        std::string name = reader.get_string();
+        auto start = reader.get<int64_t>();
+        auto end = reader.get<int64_t>();
+        alerts.emplace_back(name, start, end);
+    }
+
+    // Time zone
+    std::string timezone = reader.get_string();
+    auto timezone_offset = reader.get<int64_t>();
+
+    // Minutely precipitation
+    std::vector<MinutelyPrecipitation> minutely(reader.get_count(sizeof(MinutelyPrecipitation)));
+    for (MinutelyPrecipitation & minute : minutely) {
+        minute.timestamp = reader.get<int64_t>();
+        minute.precipitation = reader.get<double>();
+    }
+
+    // Location
+    auto lat = reader.get<double>();
+    auto lon = reader.get<double>();
+
+    // Air quality forecast
+    std::vector<HourlyAirQuality> airquality(reader.get_count(sizeof(HourlyAirQuality::timestamp)));
+    for (HourlyAirQuality & hour : airquality) {
+        hour.timestamp = reader.get<int64_t>();
+        hour.aqi = reader.get<int32_t>();
+        hour.severity = reader.get<double>();
+
+        // Indexes the pollutant name table, so it can't be trusted as read
+        auto pollutant = reader.get<uint8_t>();
+        if (pollutant >= (uint8_t) Pollutant::count) {
+            throw std::runtime_error("Invalid snapshot file");
+        }
+        hour.pollutant = (Pollutant) pollutant;
+    }
+
+    return Forecast{current, precipitation, hourly, daily, alerts, timezone, timezone_offset, minutely, lat, lon,
+                    airquality};
+}
@@ -0,0 +1,11 @@
+#ifndef NOOK_WEATHER_SNAPSHOT_H
+#define NOOK_WEATHER_SNAPSHOT_H
+
+#include <string>
+
+#include "weathertypes.h"
+
+void save_snapshot(const std::string & filepath, const Forecast & forecast);
+Forecast load_snapshot(const std::string & filepath);
+
+#endif //NOOK_WEATHER_SNAPSHOT_H
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+
+#include <unistd.h>
+
+#include "location.h"
+#include "memstats.h"
+#include "snapshot.h"
+#include "soak.h"
+
+static const size_t warmup_windows = 1;     // Windows left out while caches, pools and the heap settle
+static const size_t median_windows = 3;     // Windows each measurement is the median of, so one noisy window can't fail
+
+/**
+ * Gets the fewest renders that give a baseline and at least one window to check against it
+ *
+ * @param [in] window renders between measurements
+ * @return minimum number of renders
+ */
+size_t SoakTest::get_min_renders(const size_t window) {
+    return (warmup_windows + median_windows + 1) * window;
+}
+
+// Alerts of varying length, so alert nodes are created, resized and deleted as the count changes
+static const char *alert_names[] = {"Heat Advisory", "Severe Thunderstorm Warning", "Winter Storm Watch",
+                                    "Coastal Flood Advisory for Low-Lying Shoreline Areas of the Bay"};
+
+/**
+ * Counts the file descriptors the process has open
+ *
+ * @return number of open file descriptors
+ */
+static int get_open_files() {
+    return (int) std::distance(std::filesystem::directory_iterator("/proc/self/fd"),
+                               std::filesystem::directory_iterator());
+}
+
+/**
+ * Gets a percentile of some latencies
+ *
+ * @param [in] sorted latencies in ascending order
+ * @param [in] percentile percentile to get, from 0 to 1
+ * @return latency at percentile
+ */
+static double get_percentile(const std::vector<double> & sorted, const double percentile) {
+    return sorted.empty() ? 0 : sorted[(size_t) (percentile * (double) (sorted.size() - 1))];
+}
+
+/**
+ * Gets the median of each measurement over some windows
+ *
+ * @param [in] first first window
+ * @param [in] last one past the last window
+ * @return median of each measurement, at the last window's render count
+ */
+static SoakSample get_median(std::vector<SoakSample>::const_iterator first,
+                             std::vector<SoakSample>::const_iterator last) {
+    std::vector<SoakSample> windows(first, last);
+    const auto middle = windows.begin() + (long) windows.size() / 2;
+    auto median = [&windows, &middle](auto member) {
+        std::nth_element(windows.begin(), middle, windows.end(),
+                         [member](const SoakSample & a, const SoakSample & b) { return a.*member < b.*member; });
+        return (*middle).*member;
+    };
+    return SoakSample{(last - 1)->renders, median(&SoakSample::rss), median(&SoakSample::allocations),
+                      median(&SoakSample::p50), median(&SoakSample::p95), median(&SoakSample::p99),
+                      median(&SoakSample::fds)};
+}
+
+/**
+ * Creates a soak test that renders synthetic locations made from a recorded forecast, without any network access
+ *
+ * @param [in] settings program settings, for the image directory, display profiles and number of workers
+ * @param [in] policy refresh policy
+ * @param [in] fixture recorded forecast
+ * @param [in] locations number of synthetic locations to cycle through
+ * @param [in] limits how far each measurement may drift from the first window before the test fails
+ */
+SoakTest::SoakTest(const Settings & settings, const RefreshPolicy & policy, Forecast fixture, const int locations,
+                   const SoakLimits & limits)
+        : settings(settings), policy(policy), fixture(std::move(fixture)), locations(std::max(1, locations)),
+          limits(limits), baseline() {}
+
+/**
+ * Varies the recorded forecast for one synthetic location and round
+ * Temperatures differ by location, and the number of alerts changes from one round to the next
+ *
+ * @param [in] location index of synthetic location
+ * @param [in] round index of pipeline run
+ * @return forecast to render
+ */
+Forecast SoakTest::get_forecast(const size_t location, const size_t round) const {
+    Forecast forecast = fixture;
+    const double offset = (double) (location % 41) - 20;
+
+    forecast.current.temp += offset;
+    forecast.current.feels_like += offset;
+    if (location % 5 == 0) {
+        forecast.current.weather = "thunderstorm with heavy drizzle and light rain";
+    }
+    for (HourlyWeather & hour : forecast.hourly) {
+        hour.temp += offset;
+        hour.feels_like += offset;
+    }
+    for (DailyWeather & day : forecast.daily) {
+        day.hi += offset;
+        day.lo += offset;
+    }
+
+    forecast.alerts.clear();
+    const int64_t now = forecast.current.timestamp;
+    for (size_t i = 0; i < (location + round) % 4; i++) {
+        forecast.alerts.emplace_back(alert_names[(location + i) % 4], now - 3600 * (int64_t) i,
+                                     now + 3600 * (int64_t) (i + 2));
+    }
+    return forecast;
+}
+
+/**
+ * Checks a sample against the baseline
+ *
+ * @param [in] sample median of the latest windows
+ * @param [in,out] out stream to explain failures on
+ * @return true if every measurement is within its limit
+ */
+bool SoakTest::check(const SoakSample & sample, std::ostream & out) const {
+    bool passed = true;
+    if (sample.rss > baseline.rss + limits.rss_growth) {
+        out << "error: rss grew by " << (sample.rss - baseline.rss) / 1024 << " KiB" << std::endl;
+        passed = false;
+    }
+    if (sample.allocations - baseline.allocations > limits.allocation_growth) {
+        out << "error: " << sample.allocations - baseline.allocations << " more libxml2 allocations are live"
+            << std::endl;
+        passed = false;
+    }
+    if (sample.p50 > baseline.p50 * limits.slowdown || sample.p99 > baseline.p99 * limits.slowdown) {
+        out << "error: renders slowed from " << baseline.p50 << "/" << baseline.p99 << " us to " << sample.p50 << "/"
+            << sample.p99 << " us (p50/p99)" << std::endl;
+        passed = false;
+    }
+    if (sample.fds - baseline.fds > limits.fd_growth) {
+        out << "error: " << sample.fds - baseline.fds << " more file descriptors are open" << std::endl;
+        passed = false;
+    }
+    return passed;
+}
+
+/**
+ * Refreshes synthetic locations through the pipeline, measuring after every window of renders
+ * Each run of the pipeline decodes a batch of locations from their snapshots, then renders, rasterizes and publishes
+ * them (to waiting displays and shared memory, when enabled) on the configured number of workers
+ * The first window warms up and is left out; the median of the next few becomes the baseline, and the median of the
+ * latest few is checked against it after every window from then on
+ *
+ * @param [in] renders total number of renders
+ * @param [in] window renders between measurements
+ * @param [in,out] out stream to write measurements to
+ * @return true if every measurement stayed within its limit, false if one drifted or nothing was checked
+ */
+bool SoakTest::run(const size_t renders, const size_t window, std::ostream & out) {
+    std::vector<double> latencies;
+    latencies.reserve(window);
+    samples.clear();
+
+    out << std::setw(10) << "renders" << std::setw(12) << "rss KiB" << std::setw(12) << "xml allocs"
+        << std::setw(10) << "p50 us" << std::setw(10) << "p95 us" << std::setw(10) << "p99 us" << std::setw(6)
+        << "fds" << std::endl;
+
+    // Each run keeps every worker busy; locations are named by their slot in the batch, so thousands of synthetic
+    // locations share a batch's worth of snapshot and output files
+    Settings batch = settings;
+    batch.offline = true;
+    batch.snapshot_file = (std::filesystem::temp_directory_path()
+                           / ("nook-weather-soak-" + std::to_string(getpid()) + ".bin")).string();
+    batch.locations.resize(std::min((size_t) locations, 2 * (size_t) settings.workers));
+
+    bool passed = true;
+    size_t rendered = 0;
+    for (size_t round = 0; rendered < renders && passed; round++) {
+        for (size_t slot = 0; slot < batch.locations.size(); slot++) {
+            size_t location = (round * batch.locations.size() + slot) % locations;
+            std::string place = location % 7 == 0 ? "Llanfairpwllgwyngyllgogerychwyrndrobwllllantysiliogogogoch"
+                                                  : "Soak " + std::to_string(location);
+            batch.locations[slot] = Location{"soak" + std::to_string(slot), 0, 0, place, ""};
+            save_snapshot(get_location_file(batch.snapshot_file, batch.locations[slot]),
+                          get_forecast(location, round));
+        }
+
+        memory_report.start(batch.workers == 1);
+        Pipeline pipeline(batch, policy, memory_report);
+        PipelineResult result = pipeline.run();
+        for (const std::string & error : result.errors) {
+            out << "error: " << error << std::endl;
+            passed = false;
+        }
+        rendered += result.latencies.size();
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+
+        if (passed && (latencies.size() >= window || rendered >= renders)) {
+            std::sort(latencies.begin(), latencies.end());
+            SoakSample sample{rendered, get_rss(), get_xml_allocations(), get_percentile(latencies, 0.5),
+                              get_percentile(latencies, 0.95), get_percentile(latencies, 0.99), get_open_files()};
+            latencies.clear();
+
+            samples.push_back(sample);
+            out << std::setw(10) << sample.renders << std::setw(12) << sample.rss / 1024 << std::setw(12)
+                << sample.allocations << std::setw(10) << std::fixed << std::setprecision(0) << sample.p50
+                << std::setw(10) << sample.p95 << std::setw(10) << sample.p99 << std::setw(6) << sample.fds
+                << (samples.size() <= warmup_windows ? "  warm-up" : "") << std::endl;
+
+            if (samples.size() == warmup_windows + median_windows) {
+                baseline = get_median(samples.begin() + warmup_windows, samples.end());
+            } else if (samples.size() > warmup_windows + median_windows) {
+                passed = check(get_median(samples.end() - median_windows, samples.end()), out);
+            }
+        }
+    }
+    if (passed && samples.size() <= warmup_windows + median_windows) {
+        out << "error: too few windows to compare, run more renders or shrink --soak-window" << std::endl;
+        passed = false;
+    }
+
+    for (const Location & location : batch.locations) {
+        std::filesystem::remove(get_location_file(batch.snapshot_file, location));
+        for (const DisplayProfile & profile : get_location_profiles(batch.profiles, location)) {
+            std::string svg = batch.img_dir + profile.output_svg;
+            std::filesystem::remove(svg);
+            std::filesystem::remove(std::filesystem::path(svg).replace_extension(".png"));
+        }
+    }
+    return passed;
+}
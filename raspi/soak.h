@@ -0,0 +1,48 @@
+#ifndef NOOK_WEATHER_SOAK_H
+#define NOOK_WEATHER_SOAK_H
+
+#include <ostream>
+#include <vector>
+
+#include "memstats.h"
+#include "pipeline.h"
+#include "refresh.h"
+#include "weathertypes.h"
+
+struct SoakLimits {
+    size_t rss_growth;                      // Units: bytes
+    long allocation_growth;                 // Live libxml2 allocations
+    double slowdown;                        // Units: ratio of render latency to the baseline's
+    int fd_growth;                          // Open file descriptors
+};
+
+struct SoakSample {
+    size_t renders;                         // Renders done so far
+    size_t rss;                             // Units: bytes
+    long allocations;                       // Live libxml2 allocations
+    double p50;                             // Units: microseconds
+    double p95;                             // Units: microseconds
+    double p99;                             // Units: microseconds
+    int fds;                                // Open file descriptors
+};
+
+class SoakTest {
+public:
+    SoakTest(const Settings & settings, const RefreshPolicy & policy, Forecast fixture, int locations,
+             const SoakLimits & limits);
+    bool run(size_t renders, size_t window, std::ostream & out);   // Render repeatedly, false if anything drifted
+    static size_t get_min_renders(size_t window);                 // Fewest renders that check anything
+private:
+    const Settings & settings;
+    const RefreshPolicy & policy;
+    Forecast fixture;                       // Recorded forecast every synthetic location is varied from
+    int locations;                          // Number of synthetic locations
+    SoakLimits limits;
+    MemoryReport memory_report;             // Peak memory of the latest pipeline run
+    std::vector<SoakSample> samples;        // One per window, including warm-up
+    SoakSample baseline;                    // Median of the windows after warm-up
+    Forecast get_forecast(size_t location, size_t round) const;
+    bool check(const SoakSample & sample, std::ostream & out) const;
+};
+
+#endif //NOOK_WEATHER_SOAK_H
@@ -0,0 +1,332 @@
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <numeric>
+
+#include <fontconfig/fontconfig.h>
+
+#include "textlayout.h"
+
+// Average advance of a sans-serif glyph, for when no font can be loaded
+static const double estimated_advance = 0.55;  // Units: em
+static const char32_t ellipsis = U'…';
+
+/**
+ * Decodes a UTF-8 string; invalid bytes are passed through as single characters
+ *
+ * @param [in] text UTF-8 string
+ * @return string of code points
+ */
+static std::u32string decode_utf8(const std::string & text) {
+    std::u32string decoded;
+    for (size_t i = 0; i < text.size();) {
+        auto byte = (unsigned char) text[i];
+        int length = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : byte >= 0xc0 ? 2 : 1;
+        if (i + length > text.size()) {
+            length = 1;
+        }
+        char32_t code_point = length == 1 ? byte : byte & (0x7f >> length);
+        for (int j = 1; j < length; j++) {
+            code_point = (code_point << 6) | ((unsigned char) text[i + j] & 0x3f);
+        }
+        decoded += code_point;
+        i += length;
+    }
+    return decoded;
+}
+
+/**
+ * Encodes part of a string of code points as UTF-8
+ *
+ * @param [in] text string of code points
+ * @param [in] start index of first code point
+ * @param [in] end index after last code point
+ * @return UTF-8 string
+ */
+static std::string encode_utf8(const std::u32string & text, size_t start, size_t end) {
+    std::string encoded;
+    for (size_t i = start; i < end; i++) {
+        char32_t c = text[i];
+        if (c < 0x80) {
+            encoded += (char) c;
+        } else if (c < 0x800) {
+            encoded += (char) (0xc0 | (c >> 6));
+            encoded += (char) (0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            encoded += (char) (0xe0 | (c >> 12));
+            encoded += (char) (0x80 | ((c >> 6) & 0x3f));
+            encoded += (char) (0x80 | (c & 0x3f));
+        } else {
+            encoded += (char) (0xf0 | (c >> 18));
+            encoded += (char) (0x80 | ((c >> 12) & 0x3f));
+            encoded += (char) (0x80 | ((c >> 6) & 0x3f));
+            encoded += (char) (0x80 | (c & 0x3f));
+        }
+    }
+    return encoded;
+}
+
+/**
+ * Finds the font file fontconfig picks for a CSS font-family list, the same way the rasterizer will
+ *
+ * @param [in] family comma separated list of families, optionally quoted
+ * @return path to font file, or an empty string if there is no match
+ */
+static std::string find_font_file(const std::string & family) {
+    if (!FcInit()) {
+        return "";
+    }
+    FcPattern *pattern = FcPatternCreate();
+    size_t start = 0;
+    while (start <= family.size()) {
+        size_t end = family.find(',', start);
+        if (end == std::string::npos) {
+            end = family.size();
+        }
+        std::string name = family.substr(start, end - start);
+        size_t first = name.find_first_not_of(" \t\"'");
+        size_t last = name.find_last_not_of(" \t\"'");
+        if (first != std::string::npos) {
+            name = name.substr(first, last - first + 1);
+            FcPatternAddString(pattern, FC_FAMILY, (const FcChar8 *) name.c_str());
+        }
+        start = end + 1;
+    }
+    FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+    FcDefaultSubstitute(pattern);
+
+    std::string file;
+    FcResult result;
+    FcPattern *match = FcFontMatch(nullptr, pattern, &result);
+    FcChar8 *path;
+    if (match && FcPatternGetString(match, FC_FILE, 0, &path) == FcResultMatch) {
+        file = (char *) path;
+    }
+    if (match) {
+        FcPatternDestroy(match);
+    }
+    FcPatternDestroy(pattern);
+    return file;
+}
+
+/**
+ * Loads the font a CSS font-family list resolves to
+ * If no font can be loaded, widths are estimated from an average glyph advance instead
+ *
+ * @param [in] family font-family list from the template's stylesheet
+ */
+FontMetrics::FontMetrics(const std::string & family) {
+    file = find_font_file(family);
+    if (file.empty() || FT_Init_FreeType(&library) != 0 || FT_New_Face(library, file.c_str(), 0, &face) != 0) {
+        std::cerr << "Could not load a font for " << family << ", estimating text widths" << std::endl;
+        file.clear();
+        face = nullptr;
+        return;
+    }
+    units_per_em = face->units_per_EM > 0 ? face->units_per_EM : 1000;
+}
+
+FontMetrics::~FontMetrics() {
+    if (face) {
+        FT_Done_Face(face);
+    }
+    if (library) {
+        FT_Done_FreeType(library);
+    }
+}
+
+/**
+ * Gets the shared metrics for a font family, loading the font on first use
+ *
+ * @param [in] family font-family list from the template's stylesheet
+ * @return font metrics
+ */
+std::shared_ptr<FontMetrics> FontMetrics::get_instance(const std::string & family) {
+    static std::mutex instances_mutex;
+    static std::map<std::string, std::shared_ptr<FontMetrics>> instances;
+
+    std::lock_guard<std::mutex> lock(instances_mutex);
+    std::shared_ptr<FontMetrics> & instance = instances[family];
+    if (!instance) {
+        instance = std::make_shared<FontMetrics>(family);
+    }
+    return instance;
+}
+
+/**
+ * Gets the advance of each character, loading glyphs the first time they are seen
+ * Advances are unhinted, so they scale linearly with font size and one cache serves every size
+ *
+ * @param [in] text string of code points
+ * @return advance of each character in ems
+ */
+std::vector<double> FontMetrics::get_advances(const std::u32string & text) {
+    std::vector<double> widths;
+    widths.reserve(text.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (char32_t c : text) {
+        auto cached = advances.find(c);
+        if (cached != advances.end()) {
+            widths.push_back(cached->second);
+            continue;
+        }
+        double advance = estimated_advance;
+        if (face && FT_Load_Char(face, c, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING) == 0) {
+            advance = face->glyph->advance.x / units_per_em;
+        }
+        advances[c] = advance;
+        widths.push_back(advance);
+    }
+    return widths;
+}
+
+/**
+ * Measures a string
+ *
+ * @param [in] text UTF-8 string
+ * @param [in] size font size in px
+ * @return advance width in px
+ */
+double FontMetrics::measure(const std::string & text, const double size) {
+    std::vector<double> widths = get_advances(decode_utf8(text));
+    return std::accumulate(widths.begin(), widths.end(), 0.0) * size;
+}
+
+/**
+ * Cuts a string short with an ellipsis so it fits in a width
+ *
+ * @param [in] text string of code points
+ * @param [in] widths advance of each character in ems
+ * @param [in] width width available in ems
+ * @return UTF-8 string, unchanged if it already fits
+ */
+std::string FontMetrics::ellipsize(const std::u32string & text, const std::vector<double> & widths,
+                                   const double width) {
+    if (std::accumulate(widths.begin(), widths.end(), 0.0) <= width) {
+        return encode_utf8(text, 0, text.size());
+    }
+    double total = get_advances(std::u32string(1, ellipsis))[0];
+    size_t end = 0;
+    while (end < text.size() && total + widths[end] <= width) {
+        total += widths[end];
+        end++;
+    }
+    while (end > 0 && text[end - 1] == U' ') {
+        end--;
+    }
+    return encode_utf8(text, 0, end) + encode_utf8(std::u32string(1, ellipsis), 0, 1);
+}
+
+/**
+ * Breaks a string into lines at spaces, greedily filling each line
+ *
+ * @param [in] text string of code points
+ * @param [in] widths advance of each character in ems
+ * @param [in] width width available in ems
+ * @param [out] cut set if a word was too long for a line and had to be split
+ * @return start and end index of each line
+ */
+static std::vector<std::pair<size_t, size_t>> wrap_lines(const std::u32string & text,
+                                                         const std::vector<double> & widths, const double width,
+                                                         bool & cut) {
+    std::vector<std::pair<size_t, size_t>> lines;
+    cut = false;
+    size_t start = 0;
+    while (true) {
+        while (start < text.size() && text[start] == U' ') {
+            start++;
+        }
+        if (start == text.size()) {
+            break;
+        }
+
+        double total = 0;
+        size_t last_space = std::string::npos;
+        size_t i = start;
+        for (; i < text.size() && total + widths[i] <= width; i++) {
+            if (text[i] == U' ') {
+                last_space = i;
+            }
+            total += widths[i];
+        }
+
+        if (i == text.size()) {
+            lines.emplace_back(start, i);
+            break;
+        } else if (text[i] == U' ') {
+            lines.emplace_back(start, i);
+            start = i + 1;
+        } else if (last_space != std::string::npos) {
+            lines.emplace_back(start, last_space);
+            start = last_space + 1;
+        } else {
+            i = std::max(i, start + 1);
+            lines.emplace_back(start, i);
+            start = i;
+            cut = true;
+        }
+    }
+    return lines;
+}
+
+/**
+ * Fits a string in a box: first by shrinking the font, then by wrapping onto more lines, then by ellipsizing
+ *
+ * @param [in] text UTF-8 string
+ * @param [in] size preferred font size in px
+ * @param [in] min_size smallest font size allowed, in px
+ * @param [in] width width of box in px
+ * @param [in] max_lines number of lines the box has room for
+ * @return lines to show and the font size to show them at
+ */
+TextFit FontMetrics::fit(const std::string & text, const double size, const double min_size, const double width,
+                         const int max_lines) {
+    std::u32string chars = decode_utf8(text);
+    std::vector<double> widths = get_advances(chars);
+    double total = std::accumulate(widths.begin(), widths.end(), 0.0);
+
+    // Fits as is, or after shrinking to a tenth of a pixel
+    if (total * size <= width) {
+        return TextFit{{text}, size};
+    }
+    double shrunk = std::floor(width / total * 10) / 10;
+    if (shrunk >= min_size) {
+        return TextFit{{text}, shrunk};
+    }
+
+    // Wrap whole words at the preferred size if there are enough lines, otherwise fill every line at the smallest
+    bool cut = false;
+    if (max_lines > 1) {
+        std::vector<std::pair<size_t, size_t>> lines = wrap_lines(chars, widths, width / size, cut);
+        double fit_size = size;
+        if (lines.size() > (size_t) max_lines || cut) {
+            lines = wrap_lines(chars, widths, width / min_size, cut);
+            fit_size = min_size;
+        }
+
+        TextFit fitted{{}, fit_size};
+        for (size_t i = 0; i < lines.size() && i < (size_t) max_lines; i++) {
+            size_t start = lines[i].first;
+            size_t end = i + 1 == (size_t) max_lines ? chars.size() : lines[i].second;
+            while (end > start && chars[end - 1] == U' ') {
+                end--;
+            }
+            std::u32string line = chars.substr(start, end - start);
+            fitted.lines.push_back(ellipsize(line, std::vector<double>(widths.begin() + start, widths.begin() + end),
+                                             width / fit_size));
+        }
+        return fitted;
+    }
+
+    return TextFit{{ellipsize(chars, widths, width / min_size)}, min_size};
+}
+
+/**
+ * Gets the font file widths are measured from
+ *
+ * @return path to font file, or an empty string if widths are estimated
+ */
+const std::string & FontMetrics::get_file() const {
+    return file;
+}
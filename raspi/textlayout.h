@@ -0,0 +1,39 @@
+#ifndef NOOK_WEATHER_TEXTLAYOUT_H
+#define NOOK_WEATHER_TEXTLAYOUT_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+struct TextFit {
+    std::vector<std::string> lines;                         // Text of each line, ellipsized if it had to be cut
+    double size;                                            // Units: px  (font size the lines fit at)
+};
+
+class FontMetrics {
+public:
+    explicit FontMetrics(const std::string & family);      // Load the font a CSS font-family list resolves to
+    ~FontMetrics();
+    FontMetrics(const FontMetrics &) = delete;
+    FontMetrics & operator=(const FontMetrics &) = delete;
+    static std::shared_ptr<FontMetrics> get_instance(const std::string & family);
+    double measure(const std::string & text, double size);  // Units: px  (advance width of text)
+    TextFit fit(const std::string & text, double size, double min_size, double width, int max_lines = 1);
+    const std::string & get_file() const;                   // Font file used, or empty if widths are estimated
+private:
+    FT_Library library = nullptr;
+    FT_Face face = nullptr;
+    std::string file;
+    double units_per_em = 1;
+    std::mutex mutex;
+    std::unordered_map<char32_t, double> advances;          // Units: em  (scales linearly with font size)
+    std::vector<double> get_advances(const std::u32string & text);
+    std::string ellipsize(const std::u32string & text, const std::vector<double> & widths, double width);
+};
+
+#endif //NOOK_WEATHER_TEXTLAYOUT_H
@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#include "timeformat.h"
+
+static const char *weekday_names[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+static const char *month_names[] = {"January", "February", "March", "April", "May", "June", "July",
+                                    "August", "September", "October", "November", "December"};
+static const size_t date_cache_size = 16;  // Days of formatted dates kept per thread (a render shows about 8)
+
+/**
+ * Reads a big-endian signed integer from zoneinfo data
+ *
+ * @param [in] data pointer to first byte
+ * @param [in] size number of bytes (4 or 8)
+ * @return decoded integer
+ */
+static int64_t read_be(const unsigned char *data, const int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value = (value << 8) | data[i];
+    }
+    if (size == 4) {
+        return (int32_t) (uint32_t) value;
+    }
+    return (int64_t) value;
+}
+
+/**
+ * Counts days from 1970-01-01 to a civil date (proleptic Gregorian calendar, eras of 400 years)
+ *
+ * @param [in] year year
+ * @param [in] month month, 1 (January) - 12 (December)
+ * @param [in] day day of month, from 1
+ * @return days since 1970-01-01
+ */
+static int64_t get_day_number(int64_t year, const int month, const int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+/**
+ * Parses a zone abbreviation from a POSIX TZ string, either letters or anything between angle brackets
+ *
+ * @param [in] tz TZ string
+ * @param [in,out] pos position of abbreviation, moved past it
+ * @return true if there was an abbreviation
+ */
+static bool parse_tz_name(const std::string & tz, size_t & pos) {
+    if (pos < tz.size() && tz[pos] == '<') {
+        size_t end = tz.find('>', pos);
+        if (end == std::string::npos) {
+            return false;
+        }
+        pos = end + 1;
+        return true;
+    }
+    size_t start = pos;
+    while (pos < tz.size() && std::isalpha((unsigned char) tz[pos])) {
+        pos++;
+    }
+    return pos > start;
+}
+
+/**
+ * Parses a number from a POSIX TZ string
+ *
+ * @param [in] tz TZ string
+ * @param [in,out] pos position of number, moved past it
+ * @param [out] value parsed number
+ * @return true if there was a number
+ */
+static bool parse_tz_number(const std::string & tz, size_t & pos, int & value) {
+    size_t start = pos;
+    value = 0;
+    while (pos < tz.size() && std::isdigit((unsigned char) tz[pos]) && pos - start < 3) {
+        value = value * 10 + (tz[pos++] - '0');
+    }
+    return pos > start;
+}
+
+/**
+ * Parses a time or offset from a POSIX TZ string: [+|-]hh[:mm[:ss]]
+ *
+ * @param [in] tz TZ string
+ * @param [in,out] pos position of time, moved past it
+ * @param [out] seconds parsed time in seconds
+ * @return true if there was a time
+ */
+static bool parse_tz_time(const std::string & tz, size_t & pos, int32_t & seconds) {
+    int sign = 1;
+    if (pos < tz.size() && (tz[pos] == '+' || tz[pos] == '-')) {
+        sign = tz[pos++] == '-' ? -1 : 1;
+    }
+    int hours;
+    int minutes = 0;
+    int secs = 0;
+    if (!parse_tz_number(tz, pos, hours) || hours > 167) {
+        return false;
+    }
+    if (pos < tz.size() && tz[pos] == ':') {
+        pos++;
+        if (!parse_tz_number(tz, pos, minutes) || minutes > 59) {
+            return false;
+        }
+        if (pos < tz.size() && tz[pos] == ':') {
+            pos++;
+            if (!parse_tz_number(tz, pos, secs) || secs > 59) {
+                return false;
+            }
+        }
+    }
+    seconds = sign * (hours * 3600 + minutes * 60 + secs);
+    return true;
+}
+
+/**
+ * Loads a time zone from the system zoneinfo database
+ *
+ * @param [in] name IANA zone name (e.g. "America/New_York"), or an empty string for the host's zone
+ * @param [in] fallback_offset offset to use when the zone can't be loaded, or past its last known transition
+ */
+TimeZone::TimeZone(const std::string & name, const int64_t fallback_offset)
+        : initial_offset((int32_t) fallback_offset), fallback_offset(fallback_offset) {
+    // Zone names come from the API, so don't let them leave the zoneinfo directory
+    if (name.find("..") != std::string::npos) {
+        return;
+    }
+
+    const char *tzdir = std::getenv("TZDIR");
+    std::string filepath = name.empty() ? "/etc/localtime" : std::string(tzdir ? tzdir : "/usr/share/zoneinfo") + "/" + name;
+    if (!load(filepath)) {
+        transitions.clear();
+        transition_offsets.clear();
+        initial_offset = (int32_t) fallback_offset;
+        has_footer = false;
+    }
+}
+
+/**
+ * Parses a TZif file
+ *
+ * @param [in] filepath path to TZif file
+ * @return true if the file was parsed
+ */
+bool TimeZone::load(const std::string & filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto *bytes = (const unsigned char *) data.data();
+    size_t pos = 0;
+
+    // Version 1 data uses 32 bit times; version 2+ repeats everything with 64 bit times after it
+    for (int pass = 0; pass < 2; pass++) {
+        const size_t header_size = 44;
+        if (data.size() < pos + header_size || data.compare(pos, 4, "TZif") != 0) {
+            return false;
+        }
+        bool has_v2 = bytes[pos + 4] >= '2';
+        int64_t isutcnt = read_be(bytes + pos + 20, 4);
+        int64_t isstdcnt = read_be(bytes + pos + 24, 4);
+        int64_t leapcnt = read_be(bytes + pos + 28, 4);
+        int64_t timecnt = read_be(bytes + pos + 32, 4);
+        int64_t typecnt = read_be(bytes + pos + 36, 4);
+        int64_t charcnt = read_be(bytes + pos + 40, 4);
+        int time_size = pass == 0 ? 4 : 8;
+        pos += header_size;
+
+        size_t block_size = timecnt * time_size + timecnt + typecnt * 6 + charcnt
+                            + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+        if (data.size() < pos + block_size || typecnt <= 0) {
+            return false;
+        }
+
+        // Skip version 1 data if 64 bit data follows
+        if (pass == 0 && has_v2) {
+            pos += block_size;
+            continue;
+        }
+
+        const unsigned char *times = bytes + pos;
+        const unsigned char *indices = times + timecnt * time_size;
+        const unsigned char *types = indices + timecnt;
+
+        transitions.resize(timecnt);
+        transition_offsets.resize(timecnt);
+        for (int64_t i = 0; i < timecnt; i++) {
+            unsigned char type = indices[i] < typecnt ? indices[i] : 0;
+            transitions[i] = read_be(times + i * time_size, time_size);
+            transition_offsets[i] = (int32_t) read_be(types + type * 6, 4);
+        }
+        initial_offset = (int32_t) read_be(types, 4);
+
+        // Version 2+ data is followed by a TZ string for times past the last transition, between newlines
+        pos += block_size;
+        size_t footer_end = data.find('\n', pos + 1);
+        if (pass == 1 && pos < data.size() && data[pos] == '\n' && footer_end != std::string::npos) {
+            has_footer = parse_footer(data.substr(pos + 1, footer_end - pos - 1));
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parses the POSIX TZ string that gives offsets past a zone's last transition, e.g. "EST5EDT,M3.2.0,M11.1.0"
+ * Newer zoneinfo files only list transitions until the current rules started, so this covers most future times
+ *
+ * @param [in] footer TZ string
+ * @return true if the string was parsed
+ */
+bool TimeZone::parse_footer(const std::string & footer) {
+    // TZ strings count hours west of UTC
+    size_t pos = 0;
+    int32_t offset;
+    if (!parse_tz_name(footer, pos) || !parse_tz_time(footer, pos, offset)) {
+        return false;
+    }
+    std_offset = -offset;
+    has_dst = pos < footer.size();
+    if (!has_dst) {
+        return true;
+    }
+
+    // Daylight saving time is an hour ahead unless it says otherwise
+    if (!parse_tz_name(footer, pos)) {
+        return false;
+    }
+    dst_offset = std_offset + 3600;
+    if (pos < footer.size() && footer[pos] != ',') {
+        if (!parse_tz_time(footer, pos, offset)) {
+            return false;
+        }
+        dst_offset = -offset;
+    }
+
+    for (Rule *rule : {&dst_start, &dst_end}) {
+        if (pos >= footer.size() || footer[pos++] != ',') {
+            return false;
+        }
+        rule->time = 2 * 3600;
+        if (footer[pos] == 'M') {
+            pos++;
+            rule->kind = 'M';
+            if (!parse_tz_number(footer, pos, rule->month) || footer[pos++] != '.'
+                || !parse_tz_number(footer, pos, rule->week) || footer[pos++] != '.'
+                || !parse_tz_number(footer, pos, rule->day)
+                || rule->month < 1 || rule->month > 12 || rule->week < 1 || rule->week > 5 || rule->day > 6) {
+                return false;
+            }
+        } else {
+            rule->kind = footer[pos] == 'J' ? 'J' : 'D';
+            pos += rule->kind == 'J';
+            if (!parse_tz_number(footer, pos, rule->day) || rule->day > 365 || (rule->kind == 'J' && rule->day < 1)) {
+                return false;
+            }
+        }
+        if (pos < footer.size() && footer[pos] == '/') {
+            pos++;
+            if (!parse_tz_time(footer, pos, rule->time)) {
+                return false;
+            }
+        }
+    }
+    return pos == footer.size();
+}
+
+/**
+ * Gets the offset a zone's TZ string gives for a time
+ *
+ * @param [in] timestamp unix time
+ * @return offset in seconds east of UTC
+ */
+int64_t TimeZone::get_footer_offset(const int64_t timestamp) const {
+    if (!has_dst) {
+        return std_offset;
+    }
+
+    // Year of the time in local standard time
+    int64_t days = (timestamp + std_offset >= 0 ? timestamp + std_offset : timestamp + std_offset - 86399) / 86400;
+    int64_t year = 1970 + days / 366;
+    while (get_day_number(year + 1, 1, 1) <= days) {
+        year++;
+    }
+
+    // Local time of each change as seconds since 1970-01-01 in that year
+    auto get_change = [year](const Rule & rule) {
+        int64_t day;
+        if (rule.kind == 'M') {
+            int64_t first = get_day_number(year, rule.month, 1);
+            int64_t next_month = rule.month == 12 ? get_day_number(year + 1, 1, 1) : get_day_number(year, rule.month + 1, 1);
+            day = first + ((rule.day - (first + 4) % 7) + 7) % 7 + (rule.week - 1) * 7;
+            while (day >= next_month) {
+                day -= 7;
+            }
+        } else {
+            bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+            day = get_day_number(year, 1, 1) + rule.day - (rule.kind == 'J' && !(leap && rule.day >= 60));
+        }
+        return day * 86400 + rule.time;
+    };
+    int64_t start = get_change(dst_start) - std_offset;
+    int64_t end = get_change(dst_end) - dst_offset;
+
+    // Southern hemisphere zones are on daylight saving time over the new year
+    bool dst = start < end ? timestamp >= start && timestamp < end : timestamp < end || timestamp >= start;
+    return dst ? dst_offset : std_offset;
+}
+
+/**
+ * Gets the offset from UTC in effect at a given time
+ *
+ * @param [in] timestamp unix time
+ * @return offset in seconds east of UTC
+ */
+int64_t TimeZone::get_offset(const int64_t timestamp) const {
+    if (transitions.empty() || timestamp >= transitions.back()) {
+        // Without a TZ string (version 1 files, or a zone that couldn't be loaded) trust the offset the API gave,
+        // which is the one in effect now, so forecast times past a daylight saving change may be an hour out
+        return has_footer ? get_footer_offset(timestamp) : fallback_offset;
+    }
+    auto next = std::upper_bound(transitions.begin(), transitions.end(), timestamp);
+    if (next == transitions.begin()) {
+        return initial_offset;
+    }
+    return transition_offsets[next - transitions.begin() - 1];
+}
+
+/**
+ * Creates a formatter for a time zone
+ *
+ * @param [in] timezone IANA zone name, or an empty string for the host's zone
+ * @param [in] fallback_offset offset to use if the zone data is unavailable  Units: seconds east of UTC
+ */
+TimeFormatter::TimeFormatter(const std::string & timezone, const int64_t fallback_offset)
+        : zone(timezone, fallback_offset) {}
+
+/**
+ * Gets a shared formatter for a time zone, so its cache is reused across renders
+ *
+ * @param [in] timezone IANA zone name, or an empty string for the host's zone
+ * @param [in] fallback_offset offset to use if the zone data is unavailable  Units: seconds east of UTC
+ * @return shared formatter
+ */
+std::shared_ptr<TimeFormatter> TimeFormatter::get_instance(const std::string & timezone, const int64_t fallback_offset) {
+    static std::mutex instances_mutex;
+    static std::map<std::pair<std::string, int64_t>, std::shared_ptr<TimeFormatter>> instances;
+
+    std::lock_guard<std::mutex> lock(instances_mutex);
+    std::shared_ptr<TimeFormatter> & instance = instances[{timezone, fallback_offset}];
+    if (!instance) {
+        instance = std::make_shared<TimeFormatter>(timezone, fallback_offset);
+    }
+    return instance;
+}
+
+/**
+ * Gets a shared formatter for the host's time zone
+ *
+ * @return shared formatter
+ */
+std::shared_ptr<TimeFormatter> TimeFormatter::get_host() {
+    // Only used if /etc/localtime can't be read
+    static const int64_t host_offset = [] {
+        time_t now = std::time(nullptr);
+        tm local{};
+        localtime_r(&now, &local);
+        return (int64_t) local.tm_gmtoff;
+    }();
+    return get_instance("", host_offset);
+}
+
+/**
+ * Converts unix time to local time
+ *
+ * @param [in] timestamp unix time
+ * @return local time
+ */
+LocalTime TimeFormatter::get_local(const int64_t timestamp) const {
+    int64_t local_seconds = timestamp + zone.get_offset(timestamp);
+    int64_t days = local_seconds >= 0 ? local_seconds / 86400 : (local_seconds - 86399) / 86400;
+    int64_t seconds_of_day = local_seconds - days * 86400;
+
+    // Civil date from day count (proleptic Gregorian calendar, eras of 400 years)
+    int64_t shifted = days + 719468;
+    int64_t era = (shifted >= 0 ? shifted : shifted - 146096) / 146097;
+    int64_t day_of_era = shifted - era * 146097;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t month_index = (5 * day_of_year + 2) / 153;
+    int month = (int) (month_index < 10 ? month_index + 3 : month_index - 9);
+
+    LocalTime local{};
+    local.year = (int) (year_of_era + era * 400 + (month <= 2));
+    local.month = month;
+    local.day = (int) (day_of_year - (153 * month_index + 2) / 5 + 1);
+    local.weekday = (int) (((days + 4) % 7 + 7) % 7);
+    local.hour = (int) (seconds_of_day / 3600);
+    local.minute = (int) (seconds_of_day % 3600 / 60);
+    local.day_number = days;
+    return local;
+}
+
+/**
+ * Gets the start of the next local day
+ *
+ * @param [in] timestamp unix time
+ * @return next local midnight as unix time
+ */
+int64_t TimeFormatter::get_next_midnight(const int64_t timestamp) const {
+    int64_t local_midnight = (get_local(timestamp).day_number + 1) * 86400;
+    int64_t guess = local_midnight - zone.get_offset(timestamp);
+    return local_midnight - zone.get_offset(guess);
+}
+
+/**
+ * Formats the full date, matching strftime's "%A, %B %e, %Y"
+ * Dates don't depend on the zone, so each thread keeps the last few it formatted for every formatter without locking
+ *
+ * @param [in] timestamp unix time
+ * @return formatted date
+ */
+std::string TimeFormatter::format_date(const int64_t timestamp) const {
+    struct CachedDate {
+        int64_t day_number = INT64_MIN;
+        std::string text;
+    };
+    static thread_local CachedDate dates[date_cache_size];
+
+    LocalTime local = get_local(timestamp);
+    CachedDate & cached = dates[(uint64_t) local.day_number % date_cache_size];
+    if (cached.day_number != local.day_number) {
+        cached.day_number = local.day_number;
+        cached.text = std::string(weekday_names[local.weekday]) + ", " + month_names[local.month - 1] + " "
+                      + (local.day < 10 ? " " : "") + std::to_string(local.day) + ", " + std::to_string(local.year);
+    }
+    return cached.text;
+}
+
+/**
+ * Formats the time of day, matching strftime's "%R"
+ * Every minute of the day is formatted once, up front, and shared by every thread
+ *
+ * @param [in] timestamp unix time
+ * @return formatted time
+ */
+std::string TimeFormatter::format_time(const int64_t timestamp) const {
+    static const std::vector<std::string> times = [] {
+        std::vector<std::string> formatted(24 * 60);
+        for (int minute = 0; minute < 24 * 60; minute++) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "%02d:%02d", minute / 60, minute % 60);
+            formatted[minute] = buf;
+        }
+        return formatted;
+    }();
+
+    LocalTime local = get_local(timestamp);
+    return times[local.hour * 60 + local.minute];
+}
+
+/**
+ * Formats the abbreviated day of week, matching strftime's "%a"
+ *
+ * @param [in] timestamp unix time
+ * @return formatted day of week
+ */
+std::string TimeFormatter::format_weekday(const int64_t timestamp) const {
+    return std::string(weekday_names[get_local(timestamp).weekday], 3);
+}
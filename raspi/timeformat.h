@@ -0,0 +1,59 @@
+#ifndef NOOK_WEATHER_TIMEFORMAT_H
+#define NOOK_WEATHER_TIMEFORMAT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct LocalTime {
+    int year;
+    int month;              // Units: 1 (January) - 12 (December)
+    int day;                // Units: day of month, from 1
+    int weekday;            // Units: 0 (Sunday) - 6 (Saturday)
+    int hour;
+    int minute;
+    int64_t day_number;     // Units: local days since 1970-01-01
+};
+
+class TimeZone {
+public:
+    explicit TimeZone(const std::string & name, int64_t fallback_offset);     // Load zone from system zoneinfo
+    int64_t get_offset(int64_t timestamp) const;                              // Units: seconds east of UTC
+private:
+    struct Rule {                               // Day and time daylight saving time starts or ends
+        char kind;                              // 'J' (day 1 - 365, never counting Feb 29), 'D' (day 0 - 365) or 'M'
+        int month;                              // Units: 1 (January) - 12 (December)  (only for 'M')
+        int week;                               // Units: 1 - 5 (5 is the last)  (only for 'M')
+        int day;                                // Units: day of year for 'J' and 'D', 0 (Sunday) - 6 for 'M'
+        int32_t time;                           // Units: seconds after local midnight (may be negative or past 24h)
+    };
+    std::vector<int64_t> transitions;           // Units: Unix time, sorted
+    std::vector<int32_t> transition_offsets;    // Offset in effect from each transition  Units: seconds
+    int32_t initial_offset;                     // Offset before the first transition  Units: seconds
+    int64_t fallback_offset;                    // Offset after the last known transition  Units: seconds
+    bool has_footer = false;                    // Offsets after the last transition follow the file's TZ string
+    int32_t std_offset = 0;                     // Standard time offset from the TZ string  Units: seconds
+    int32_t dst_offset = 0;                     // Daylight saving time offset from the TZ string  Units: seconds
+    bool has_dst = false;                       // TZ string has daylight saving time
+    Rule dst_start{};                           // In local standard time
+    Rule dst_end{};                             // In local daylight saving time
+    bool load(const std::string & filepath);
+    bool parse_footer(const std::string & footer);
+    int64_t get_footer_offset(int64_t timestamp) const;
+};
+
+class TimeFormatter {
+public:
+    explicit TimeFormatter(const std::string & timezone, int64_t fallback_offset);
+    static std::shared_ptr<TimeFormatter> get_instance(const std::string & timezone, int64_t fallback_offset);
+    static std::shared_ptr<TimeFormatter> get_host();       // Formatter for the host's own time zone
+    LocalTime get_local(int64_t timestamp) const;           // Convert unix time to local time
+    int64_t get_next_midnight(int64_t timestamp) const;     // Start of the next local day as unix time
+    std::string format_date(int64_t timestamp) const;       // e.g. "Sunday, October 18, 2026"
+    std::string format_time(int64_t timestamp) const;       // e.g. "14:05"
+    std::string format_weekday(int64_t timestamp) const;    // e.g. "Sun"
+private:
+    TimeZone zone;
+};
+
+#endif //NOOK_WEATHER_TIMEFORMAT_H
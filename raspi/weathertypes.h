@@ -1,6 +1,8 @@
 #ifndef NOOK_WEATHER_WEATHERTYPES_H
 #define NOOK_WEATHER_WEATHERTYPES_H
 
+#include <vector>
+
 #include "aqi.h"
 #include "alert.h"
 #include "beaufort.h"
@@ -23,11 +25,21 @@ struct Precipitation {
     double today;           // Units: 0 (0%) - 1 (100%)
 };
 
+struct MinutelyPrecipitation {
+    int64_t timestamp;      // Units: Unix time
+    double precipitation;   // Units: mm/h
+};
+
 struct HourlyWeather {
     int64_t timestamp;      // Units: Unix time
     double temp;            // Units: degrees Celsius
     double pop;             // Probability of precipitation  Units: 0 (0%) - 1 (100%)
-    std::string icon;       // Icon to use  (currently unused)
+    std::string icon;       // Icon to use  (used for pre-rendered frames)
+    double feels_like;      // Units: degrees Celsius
+    std::string weather;    // English weather description
+    double wind_speed;      // Units: m/s
+    double uvi;             // Units: UV index
+    double humidity;        // Units: 0 (0%) - 1 (100%)
 };
 
 struct DailyWeather {
@@ -36,6 +48,28 @@ struct DailyWeather {
     double lo;              // Units: degrees Celsius
     std::string weather;    // English weather description
     std::string icon;       // Icon to use
+    double pop;             // Probability of precipitation  Units: 0 (0%) - 1 (100%)
+};
+
+struct HourlyAirQuality {
+    int64_t timestamp;      // Units: Unix time
+    int aqi;                // Units: AQI (1 - 5)
+    double severity;        // Units: CAQI sub-index of the worst pollutant (0 - 5, more past the scale)
+    Pollutant pollutant;    // Worst pollutant
+};
+
+struct Forecast {
+    CurrentWeather current;
+    Precipitation precipitation;
+    std::vector<HourlyWeather> hourly;
+    std::vector<DailyWeather> daily;
+    std::vector<WeatherAlert> alerts;
+    std::string timezone;   // IANA time zone name of location
+    int64_t timezone_offset;// Units: seconds east of UTC
+    std::vector<MinutelyPrecipitation> minutely;  // Next hour, only for the current conditions (empty if not fetched)
+    double lat;             // Units: degrees  (NaN if unknown)
+    double lon;             // Units: degrees east  (NaN if unknown)
+    std::vector<HourlyAirQuality> airquality;     // Coming hours, from the current one (empty if not fetched)
 };
 
 #endif
\ No newline at end of file